@@ -31,7 +31,7 @@ namespace eval "include" {
       FbleGenerateC FbleGenerateCExport FbleGenerateCMain
     }
     fble-link.h {
-      FbleLink
+      FbleLink FbleLinkParallel
     }
     fble-load.h {
       FbleParse
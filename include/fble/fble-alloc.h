@@ -1,6 +1,9 @@
 /**
  * @file fble-alloc.h
  *  Memory allocation routines.
+ *
+ *  These routines are safe to call from multiple threads at once. Allocations
+ *  are counted per thread and the counts are combined on demand.
  */
 
 #ifndef FBLE_ALLOC_H_
@@ -116,6 +119,11 @@ void FbleFree(void* ptr);
 
 /**
  * @func[FbleMaxTotalBytesAllocated] Gets the max bytes allocated.
+ *  This is exact if all allocations since the most recent call to
+ *  FbleResetMaxTotalBytesAllocated happened on a single thread. Otherwise it
+ *  is the sum of each thread's high watermark, which is an upper bound on
+ *  the true high watermark.
+ *
  *  @returns size_t
  *   The high watermark of bytes allocated using the fble allocation routines
  *   since the most recent call to FbleResetMaxTotalBytesAllocated.
@@ -124,6 +132,8 @@ size_t FbleMaxTotalBytesAllocated();
 
 /**
  * @func[FbleResetMaxTotalBytesAllocated] Resets the max bytes allocated.
+ *  May be called from any thread, including while other threads allocate.
+ *
  *  @sideeffects
  *   Resets the max total alloc size to the current number of bytes allocated
  *   using the fble allocation routines.
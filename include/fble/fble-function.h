@@ -59,14 +59,36 @@ typedef FbleValue* FbleRunFunction(
  *   arguments in addition to the function to tail call.
  *  @field[FbleRunFunction*][run]
  *   How to run the function. See FbleRunFunction for more info.
+ *  @field[void*][data]
+ *   Data shared by all functions with this executable for use by the run
+ *   function, such as the code to interpret for interpreted functions. The
+ *   data must outlive the functions unless on_free is set. NULL if not used.
+ *  @field[void (*)(void*)][on_free]
+ *   If not NULL, each function value created with this executable owns a
+ *   reference to data, which the runtime releases by calling on_free on data
+ *   when it frees the function value. The function value is allocated on
+ *   the heap right away in that case, so there is exactly one call per
+ *   function value created.
  */
 typedef struct {
   size_t num_args;
   size_t num_statics;
   size_t max_call_args;
   FbleRunFunction* run;
+  void* data;
+  void (*on_free)(void* data);
 } FbleExecutable;
 
+/**
+ * @struct[FbleExecutableV] Vector of FbleExecutable*.
+ *  @field[size_t][size] Number of elements.
+ *  @field[FbleExecutable**][xs] Elements.
+ */
+typedef struct {
+  size_t size;
+  FbleExecutable** xs;
+} FbleExecutableV;
+
 /**
  * @struct[FbleForeign] Implementation of a foreign value.
  *  FbleForeign is intended to be statically allocated so that
@@ -26,4 +26,30 @@
  */
 FbleValue* FbleLink(FbleRuntime* runtime, FbleProgram* program);
 
+/**
+ * @func[FbleLinkParallel] Links modules to compute them in parallel.
+ *  Same as FbleLink, except that when the returned function is executed,
+ *  modules that don't depend on each other are computed in parallel using
+ *  up to the given number of threads.
+ *
+ *  Modules are computed one at a time if profiling is enabled when the
+ *  returned function is executed.
+ *
+ *  @arg[FbleRuntime*] runtime
+ *   The runtime context.
+ *  @arg[FbleProgram*] program
+ *   The program of modules to link together.
+ *  @arg[size_t] threads
+ *   The number of threads to use, including the calling thread. 0 or 1 to
+ *   compute modules one at a time on the calling thread.
+ *
+ *  @returns FbleValue*
+ *   A zero-argument fble function that computes the value of the program when
+ *   executed, or NULL in case of error.
+ *
+ *  @sideeffects
+ *   Allocates a value on the heap.
+ */
+FbleValue* FbleLinkParallel(FbleRuntime* runtime, FbleProgram* program, size_t threads);
+
 #endif // FBLE_LINK_H_
@@ -27,15 +27,21 @@ typedef struct {
 
 /**
  * @func[FbleNewLiteralValue] Creates an fble literal value.
+ *  The literal value is reused when the literal is evaluated again while
+ *  the previous value is known to be alive.
+ *
  *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[size_t*][id]
+ *   Cache slot for the literal. Must be initialized to 0 and passed along
+ *   with @a[data] every time the literal is evaluated.
  *  @arg[size_t][size] The size of the literal data.
  *  @arg[size_t*][data] The contents of the literal data.
- *  @returns[FbleValue*] A newly allocated literal value.
+ *  @returns[FbleValue*] The literal value.
  *  @sideeffects
- *   @i Allocates a value on the heap.
+ *   @i Allocates a value on the heap if there's no value to reuse.
  *   @i Behavior is undefined if @a[data] is malformed.
  */
-FbleValue* FbleNewLiteralValue(FbleRuntime* runtime, size_t size, uint8_t* data);
+FbleValue* FbleNewLiteralValue(FbleRuntime* runtime, size_t* id, size_t size, uint8_t* data);
 
 #endif // FBLE_LITERAL_H_
 
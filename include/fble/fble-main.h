@@ -68,6 +68,9 @@ typedef enum {
  *    Evaluates the main module, with whatever side effects that has on heap
  *    and profile.
  *   @i Enables or disables profiling as requested.
+ *   @i Sets runtime stack and merge limit options as requested.
+ *   @i Arranges for runtime stats to be printed on free if requested.
+ *   @i Loads or saves a snapshot of the main module's value if requested.
  *   @i Sets profile_output_file and result based on results.
  */
 FbleMainStatus FbleMain(
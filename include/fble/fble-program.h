@@ -6,6 +6,7 @@
 #ifndef FBLE_PROGRAM_H_
 #define FBLE_PROGRAM_H_
 
+#include <stdint.h> // for uint64_t
 #include <stdio.h>  // for FILE
 
 #include "fble-function.h"
@@ -85,6 +86,12 @@ typedef enum {
  *   values for each module listed in 'link_deps' as arguments to the function
  *  @field[FbleNameV][profile_blocks]
  *   Profiling blocks used by the compiled code for the module.
+ *  @field[FbleExecutableV][executables]
+ *   Executables of the functions defined by @a[exe], borrowed from the
+ *   preloaded module. Empty if @a[exe] is NULL.
+ *  @field[uint64_t][hash]
+ *   Hash of the module's compiled code, identifying the contents of the
+ *   module for snapshots. 0 if the module hasn't been compiled.
  */
 struct FbleModule {
   size_t refcount;
@@ -97,6 +104,8 @@ struct FbleModule {
   FbleCode* code;
   FbleExecutable* exe;
   FbleNameV profile_blocks;
+  FbleExecutableV executables;
+  uint64_t hash;
 };
 
 /**
@@ -160,12 +169,18 @@ typedef struct {
  *   executable->statics must be 0.
  *  @field[FbleNameV][profile_blocks]
  *   Profile blocks used by functions in the module.
+ *  @field[FbleExecutableV][executables]
+ *   Executables of all the functions defined in the module, including
+ *   @a[executable].
+ *  @field[uint64_t][hash] Hash of the code the module was compiled from.
  */
 struct FblePreloadedModule {
   FbleModulePath* path;
   FblePreloadedModuleV deps;
   FbleExecutable* executable;
   FbleNameV profile_blocks;
+  FbleExecutableV executables;
+  uint64_t hash;
 };
 
 #endif // FBLE_PROGRAM_H_
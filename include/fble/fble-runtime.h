@@ -7,6 +7,7 @@
 #define FBLE_RUNTIME_H_
 
 #include <stdbool.h>    // for bool
+#include <stdio.h>      // for FILE
 
 #include "fble-function.h"    // for FbleExecutable, FbleFunction
 #include "fble-module-path.h" // for FbleModulePath
@@ -29,10 +30,12 @@
  *  architecture. The type value is packed as a zero argument struct value.
  *
  *  @i Bit 0 is set to 1 to indicate it is a packed value.
- *  @i Bits [6:1] indicate the length of the packed content in bits.
  *  @item
- *   The remaining bits are packed content depending on if it's a struct or
- *   union.
+ *   The packed content starts at bit 1. The content depends on if it's a
+ *   struct or union.
+ *  @item
+ *   The most significant 1 bit marks the end of the packed content. That
+ *   leaves room for up to 62 bits of packed content.
  *  @item
  *   Packed content for a union is binary encoded tag bits, using sufficient
  *   number of bits to represent all possible tags of that particular union
@@ -42,7 +45,7 @@
  *   Packed content for a struct is a list of N-1 6-bit sizes giving the
  *   number of bits past the end of the struct header to reach the packed
  *   content for the ith field of the struct.
- *  @i The unused most significant bits of the packed value are always 0.
+ *  @i The bits above the end marker bit are always 0.
  * 
  *  For example:
  *
@@ -55,18 +58,18 @@
  *  bits on the left and least significant bit on the right:
  *
  *  @code[txt] @
- *   Decimal:  1   2      3 0   6      3 0   1      3 0     31 1
- *   Binary:   1 011 000011 0 110 000011 0 001 000011 0 011111 1
- *   Label:    t ooo OOOOOO t ooo OOOOOO t ooo OOOOOO t LLLLLL P
+ *   Decimal:  1 1   2      3 0   6      3 0   1      3 0 1
+ *   Binary:   1 1 010 000011 0 110 000011 0 001 000011 0 1
+ *   Label:    E t ooo OOOOOO t ooo OOOOOO t ooo OOOOOO t P
  * 
  *   o: tag bits for an octal element.
  *   O: number of bits offset to tail field of cons struct.
  *   t: list tag: 0 for cons, 1 for nil.
- *   L: length of packed content
+ *   E: end of packed content marker
  *   P: pack bit
  * 
- *  A 32-bit pointer architecture uses 5 bit length and offset instead of 6
- *  bit length and offset.
+ *  A 32-bit pointer architecture uses 5 bit offsets instead of 6 bit
+ *  offsets, and has room for up to 30 bits of packed content.
  *
  *  Before recursive values are defined, they are represented as a packed
  *  undefined value with the least two significant bits set to 'b10. Any value
@@ -164,11 +167,22 @@ typedef struct {
  *  are automatically freed when their frame is popped from the stack. See
  *  FblePushFrame and FblePopFrame for more info.
  *
+ *  Different threads may use different runtimes at the same time. The state
+ *  runtimes do share, like the bytecode the interpreter decodes for a
+ *  program's code and the ids of cached literals, is synchronized
+ *  internally. A runtime, the values allocated on it, and the profiles it
+ *  uses must only be used by one thread at a time. Only the main thread's
+ *  stack limit gets raised. Other threads that evaluate deeply recursive
+ *  fble code need large enough stacks of their own.
+ *
  *  @returns FbleRuntime*
  *   A context for allocating and evaluating values.
  *
  *  @sideeffects
- *   Allocates a runtime context that should be freed using FbleFreeRuntime.
+ *   @i Allocates a runtime context that should be freed using FbleFreeRuntime.
+ *   @item
+ *    Raises the process stack size limit until the last runtime is freed,
+ *    because fble function calls may use an unbounded amount of C stack.
  */
 FbleRuntime* FbleNewRuntime();
 
@@ -177,8 +191,10 @@ FbleRuntime* FbleNewRuntime();
  *  @arg[FbleRuntime*][runtime] The runtime to free.
  *
  *  @sideeffects
- *   The resources associated with the runtime context are freed. The runtime
- *   should not be used after this call.
+ *   @item
+ *    The resources associated with the runtime context are freed. The runtime
+ *    should not be used after this call.
+ *   @i Restores the process stack size limit if this is the last runtime.
  */
 void FbleFreeRuntime(FbleRuntime* runtime);
 
@@ -425,7 +441,10 @@ FbleValue* FbleNewListValue_(FbleRuntime* runtime, size_t argc, ...);
  *   A newly allocated function value.
  *
  *  @sideeffects
- *   Allocates a function value on the heap.
+ *   @i Allocates a function value on the heap.
+ *   @item
+ *    If executable->on_free is set, takes ownership of a reference to
+ *    executable->data, released when the function value is freed.
  */
 FbleValue* FbleNewFuncValue(FbleRuntime* runtime, FbleExecutable* executable, size_t profile_block_id, FbleValue** statics);
 
@@ -553,6 +572,27 @@ size_t FbleDefineRecursiveValues(FbleRuntime* runtime, FbleValue* decl, FbleValu
 FbleValue* FbleNewNativeValue(FbleRuntime* runtime,
     void* data, void (*on_free)(void* data));
 
+/**
+ * @func[FbleNewConcurrentNativeValue] Creates a native value freed off-thread.
+ *  Same as FbleNewNativeValue, except that on_free may be called from the
+ *  background sweeper thread if background sweeping is enabled for the
+ *  runtime. See FbleSetBackgroundSweep. The on_free function must be safe to
+ *  call concurrently with the rest of the program.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[void*][data] The user data to store on the native value.
+ *  @arg[void (*)(void*)][on_free]
+ *   Function called just before freeing the allocated native data. May be
+ *   NULL to indicate that nothing should be done on free.
+ *
+ *  @returns[FbleValue*] The newly allocated native value.
+ *
+ *  @sideeffects
+ *   Allocates a value on the heap.
+ */
+FbleValue* FbleNewConcurrentNativeValue(FbleRuntime* runtime,
+    void* data, void (*on_free)(void* data));
+
 /**
  * @func[FbleNativeValueData] Gets a native value's user data.
  *  @arg[FbleValue*][value] The value to get the native allocation for.
@@ -595,4 +635,236 @@ FbleValue* FbleRuntimeError(FbleRuntime* runtime, size_t line, size_t col, FbleB
  */
 void FbleFullGc(FbleRuntime* runtime);
 
+/**
+ * @func[FbleSetGcPace] Sets the pace of incremental garbage collection.
+ *  The runtime performs some garbage collection work every time it
+ *  allocates a value. The pace is the number of incremental GC steps to
+ *  perform per allocation. The runtime automatically speeds up when garbage
+ *  is allocated faster than it is being reclaimed.
+ *
+ *  A higher pace reclaims memory sooner at the cost of more work per
+ *  allocation. A lower pace reduces the overhead per allocation at the cost
+ *  of more memory use. The default pace is 1.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[size_t][pace] The GC pace to use. Must be positive.
+ *
+ *  @sideeffects
+ *   Sets the GC pace for future allocations on the runtime.
+ */
+void FbleSetGcPace(FbleRuntime* runtime, size_t pace);
+
+/**
+ * @func[FbleSetBackgroundSweep] Enables or disables background sweeping.
+ *  With background sweeping enabled, the runtime starts a background thread
+ *  to call on_free for garbage native values created with
+ *  FbleNewConcurrentNativeValue. That way slow native destructors don't
+ *  hold up the program.
+ *
+ *  Background sweeping is disabled by default. It is an option for the
+ *  whole life of the runtime: it must be enabled right after FbleNewRuntime,
+ *  before any values are allocated on the runtime, and stays enabled until
+ *  FbleFreeRuntime disables it. Worker runtimes inherit the setting.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[bool][enabled] True to enable background sweeping, false to disable.
+ *
+ *  @sideeffects
+ *   @i Starts or stops the background sweeper thread.
+ *   @item
+ *    When disabling, waits for the background thread to finish freeing any
+ *    values handed off to it.
+ *   @item
+ *    Leaves background sweeping disabled if the background thread could
+ *    not be started.
+ */
+void FbleSetBackgroundSweep(FbleRuntime* runtime, bool enabled);
+
+/**
+ * @func[FbleSetStackChunkSize] Sets the size of stack chunks.
+ *  The runtime allocates memory for its stack in chunks, 1MB by default.
+ *  Smaller chunks use less memory for shallow programs at the cost of
+ *  allocating chunks more often for deep recursion.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[size_t][size]
+ *   The size of new stack chunks in bytes. Sizes smaller than 4KB are
+ *   rounded up to 4KB.
+ *
+ *  @sideeffects
+ *   @i Sets the size of stack chunks allocated from now on.
+ *   @i Frees any stack chunks not currently in use.
+ */
+void FbleSetStackChunkSize(FbleRuntime* runtime, size_t size);
+
+/**
+ * @func[FbleSetMergeLimit] Sets the frame merge limit.
+ *  A function call reuses its caller's stack frame if the caller has
+ *  allocated fewer than the merge limit bytes on the frame, 4KB by default.
+ *  Values returned from a merged frame don't need to be promoted to the GC
+ *  heap, but merged frames can't be compacted when they tail call.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[size_t][limit] The merge limit in bytes. 0 disables merging.
+ *
+ *  @sideeffects
+ *   Sets the merge limit for future function calls.
+ */
+void FbleSetMergeLimit(FbleRuntime* runtime, size_t limit);
+
+/**
+ * @func[FbleSetMergeLimitTuning] Enables or disables merge limit tuning.
+ *  With tuning enabled, the runtime periodically doubles the merge limit
+ *  when it sees a lot of values being promoted to the GC heap, and halves it
+ *  when it sees few, keeping it between 1KB and 16KB. Tuning is disabled by
+ *  default.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[bool][enabled] True to enable tuning, false to disable.
+ *
+ *  @sideeffects
+ *   Enables or disables automatic tuning of the merge limit.
+ */
+void FbleSetMergeLimitTuning(FbleRuntime* runtime, bool enabled);
+
+/**
+ * @func[FbleSetHashConsing] Enables or disables hash consing.
+ *  With hash consing enabled, the runtime looks up small struct and union
+ *  values in a fixed size cache before allocating them, reusing an existing
+ *  identical value when it can instead of allocating a new one. This trades
+ *  a hash lookup per allocation for less memory use in programs that build
+ *  the same values over and over. Hash consing is disabled by default.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[bool][enabled] True to enable hash consing, false to disable.
+ *
+ *  @sideeffects
+ *   Enables or disables hash consing of values allocated from now on.
+ */
+void FbleSetHashConsing(FbleRuntime* runtime, bool enabled);
+
+/**
+ * @struct[FbleRuntimeStats] Statistics about a runtime.
+ *  Divide gc_steps by gc_allocs to get the average amount of GC work done
+ *  per allocation. Compare promoted to stack_allocs to see how many values
+ *  escape the function that allocated them.
+ *
+ *  @field[size_t][stack_allocs] Number of values allocated on the stack.
+ *  @field[size_t][merges]
+ *   Number of function calls that reused their caller's stack frame.
+ *  @field[size_t][gc_allocs]
+ *   Number of values allocated on the GC heap, including promoted values.
+ *  @field[size_t][gc_frees] Number of GC values reclaimed as garbage.
+ *  @field[size_t][gc_steps] Number of incremental GC steps performed.
+ *  @field[size_t][gc_traversed] Number of reachable GC values traversed.
+ *  @field[size_t][gc_visited] Number of GC values scanned or swept.
+ *  @field[size_t][gc_cycles]
+ *   Number of times GC started working on a new frame.
+ *  @field[size_t][promoted]
+ *   Number of stack allocated values promoted to the GC heap.
+ *  @field[size_t][gc_bytes]
+ *   Number of bytes of GC values currently allocated, including garbage not
+ *   yet reclaimed.
+ *  @field[size_t][max_gc_bytes] Peak value of gc_bytes.
+ *  @field[size_t][stack_bytes]
+ *   Number of bytes of memory currently allocated for the stack, including
+ *   idle memory.
+ *  @field[size_t][stack_idle_bytes]
+ *   Number of bytes of memory allocated for the stack that are not currently
+ *   in use, retained for reuse when the stack grows again.
+ *  @field[size_t][hash_cons_hits]
+ *   Number of values reused from the hash cons cache instead of allocated.
+ *  @field[size_t][hash_cons_misses]
+ *   Number of values allocated and added to the hash cons cache.
+ */
+typedef struct {
+  size_t stack_allocs;
+  size_t merges;
+  size_t gc_allocs;
+  size_t gc_frees;
+  size_t gc_steps;
+  size_t gc_traversed;
+  size_t gc_visited;
+  size_t gc_cycles;
+  size_t promoted;
+  size_t gc_bytes;
+  size_t max_gc_bytes;
+  size_t stack_bytes;
+  size_t stack_idle_bytes;
+  size_t hash_cons_hits;
+  size_t hash_cons_misses;
+} FbleRuntimeStats;
+
+/**
+ * @func[FbleGetRuntimeStats] Gets statistics about a runtime.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @returns[FbleRuntimeStats] Statistics since the runtime was created.
+ *  @sideeffects None.
+ */
+FbleRuntimeStats FbleGetRuntimeStats(FbleRuntime* runtime);
+
+/**
+ * @func[FblePrintRuntimeStats] Prints statistics about a runtime.
+ *  @arg[FILE*][fout] The stream to print to.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @sideeffects
+ *   Prints a human readable summary of FbleGetRuntimeStats to fout.
+ */
+void FblePrintRuntimeStats(FILE* fout, FbleRuntime* runtime);
+
+/**
+ * @func[FbleSetRuntimeStatsOutput] Prints runtime statistics on free.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FILE*][fout]
+ *   The stream to print runtime statistics to when the runtime is freed.
+ *   NULL to not print runtime statistics. Defaults to NULL.
+ *  @sideeffects
+ *   Causes FbleFreeRuntime to print runtime statistics to fout.
+ */
+void FbleSetRuntimeStatsOutput(FbleRuntime* runtime, FILE* fout);
+
+/**
+ * @func[FbleSaveValue] Saves a snapshot of a value.
+ *  The snapshot can be loaded with FbleLoadValue in a later run of the same
+ *  executable. Function values are saved as references to the runtime's
+ *  known executables: those of registered foreign values and of linked
+ *  compiled modules. Values containing interpreted functions, functions with
+ *  other executables, or native values can't be saved.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FbleValue*][value] The value to save.
+ *  @arg[FILE*][fout] The stream to write the snapshot to.
+ *  @arg[const char**][error]
+ *   Output for a static message saying why the value can't be saved.
+ *  @returns[bool] True on success, false if the value can't be saved.
+ *  @sideeffects
+ *   @i Writes the snapshot to @a[fout].
+ *   @i Sets @a[error] if the value can't be saved.
+ */
+bool FbleSaveValue(FbleRuntime* runtime, FbleValue* value, FILE* fout, const char** error);
+
+/**
+ * @func[FbleLoadValue] Loads a snapshot of a value.
+ *  The snapshot must have been saved by FbleSaveValue in a run of the same
+ *  executable. The runtime must have the same profile blocks, known
+ *  executables and linked modules as the runtime the snapshot was saved
+ *  from, which is the case after registering the same foreign values and
+ *  linking the same program. The structure and checksum of the snapshot are
+ *  checked, but not that its values have the types the program expects, so
+ *  only load snapshots you trust.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FILE*][fin]
+ *   The stream to read the snapshot from. Must support seeking.
+ *  @arg[const char**][error]
+ *   Output for a static message saying why the snapshot can't be loaded.
+ *  @returns[FbleValue*]
+ *   The loaded value, or NULL if the snapshot is invalid or doesn't match the
+ *   runtime.
+ *  @sideeffects
+ *   @i Allocates values on the heap.
+ *   @i Sets @a[error] if the snapshot can't be loaded.
+ */
+FbleValue* FbleLoadValue(FbleRuntime* runtime, FILE* fin, const char** error);
+
 #endif // FBLE_RUNTIME_H_
@@ -71,7 +71,7 @@ static void StringLit(FILE* fout, const char* string);
 static LabelId StaticString(FILE* fout, LabelId* label_id, const char* string);
 static LabelId StaticNames(FILE* fout, LabelId* label_id, FbleNameV names);
 static LabelId StaticModulePath(FILE* fout, LabelId* label_id, FbleModulePath* path);
-static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module);
+static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module, FbleCodeV blocks);
 
 static void GetFrameVar(FILE* fout, const char* rdst, FbleVar index);
 static void SetFrameVar(FILE* fout, const char* rsrc, FbleLocalIndex index);
@@ -359,12 +359,13 @@ static LabelId StaticModulePath(FILE* fout, LabelId* label_id, FbleModulePath* p
  *  @arg[LabelId*][label_id] Pointer to next available label id for use.
  *  @arg[FbleModule*][module]
  *   The FbleModule to generate code for.
+ *  @arg[FbleCodeV][blocks] The code blocks of the module's functions.
  *
  *  @sideeffects
  *   @i Outputs code to fout.
  *   @i Increments label_id based on the number of internal labels used.
  */
-static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module)
+static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module, FbleCodeV blocks)
 {
   LabelId path_id = StaticModulePath(fout, label_id, module->path);
 
@@ -391,9 +392,36 @@ static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* mod
   SanitizeString(function_block.name->str, function_label);
   fprintf(fout, "  .xword %s.%04zx\n",
       function_label, module->code->profile_block_id);
+  fprintf(fout, "  .xword 0\n");   // .data
+  fprintf(fout, "  .xword 0\n");   // .on_free
 
   LabelId profile_blocks_xs_id = StaticNames(fout, label_id, module->profile_blocks);
 
+  LabelId executables_id = (*label_id)++;
+  fprintf(fout, "  .section .data\n");
+  fprintf(fout, "  .align 3\n");
+  fprintf(fout, LABEL ":\n", executables_id);
+  for (size_t i = 0; i < blocks.size; ++i) {
+    FbleCode* code = blocks.xs[i];
+    FbleName block = module->profile_blocks.xs[code->profile_block_id];
+    char label[SizeofSanitizedString(block.name->str)];
+    SanitizeString(block.name->str, label);
+    fprintf(fout, "  .xword %zi\n", code->executable.num_args);
+    fprintf(fout, "  .xword %zi\n", code->executable.num_statics);
+    fprintf(fout, "  .xword %zi\n", code->executable.max_call_args);
+    fprintf(fout, "  .xword %s.%04zx\n", label, code->profile_block_id);
+    fprintf(fout, "  .xword 0\n");   // .data
+    fprintf(fout, "  .xword 0\n");   // .on_free
+  }
+
+  LabelId executables_xs_id = (*label_id)++;
+  fprintf(fout, "  .section .data\n");
+  fprintf(fout, "  .align 3\n");
+  fprintf(fout, LABEL ":\n", executables_xs_id);
+  for (size_t i = 0; i < blocks.size; ++i) {
+    fprintf(fout, "  .xword " LABEL "+%zi\n", executables_id, i * sizeof(FbleExecutable));
+  }
+
   FbleString* module_name = FbleMangleModulePath(module->path);
   fprintf(fout, "  .section .data\n");
   fprintf(fout, "  .align 3\n");
@@ -407,6 +435,9 @@ static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* mod
   fprintf(fout, "  .xword " LABEL "\n", executable_id);
   fprintf(fout, "  .xword %zi\n", module->profile_blocks.size);
   fprintf(fout, "  .xword " LABEL "\n", profile_blocks_xs_id);
+  fprintf(fout, "  .xword %zi\n", blocks.size);                 // .executables
+  fprintf(fout, "  .xword " LABEL "\n", executables_xs_id);
+  fprintf(fout, "  .xword 0x%llx\n", (unsigned long long)module->hash); // .hash
   FbleFreeString(module_name);
 }
 
@@ -723,7 +754,7 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
       GetFrameVar(fout, "x0", access_instr->obj);
 
       size_t header_length = (access_instr->fieldc == 0) ? 0 : (6 * (access_instr->fieldc - 1));
-      bool packable = header_length + 7 <= 64;
+      bool packable = header_length + 2 <= 64;
 
       // Check if the value is NULL, packed, or undefined.
       fprintf(fout, "  cbz x0, .Lo.%04zx.%zi.u\n", func_id, pc);            // NULL
@@ -745,7 +776,7 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
           // Single arg struct access, there is nothing to do. The packed
           // representation of the field is exactly the same as the packed
           // representation of the single element struct.
-          // { 0, arg, length, 1 } ==> { 0, arg, length, 1 }
+          // { 0, 1, arg, 1 } ==> { 0, 1, arg, 1 }
           assert(access_instr->field == 0);
         } else {
 
@@ -753,30 +784,38 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
           if (access_instr->field == 0) {
             fprintf(fout, "  mov x1, %zi\n", header_length);
           } else {
-            fprintf(fout, "  ubfx x1, x0, %zi, #6\n", 7 + 6 * (access_instr->field - 1));
+            fprintf(fout, "  ubfx x1, x0, %zi, #6\n", 1 + 6 * (access_instr->field - 1));
             fprintf(fout, "  add x1, x1, %zi\n", header_length);
           }
 
           // x2: bit offset of end of arg relative to the start of header.
           if (access_instr->field + 1 == access_instr->fieldc) {
-            fprintf(fout, "  ubfx x2, x0, #1, #6\n");
+            // The end of the last arg is the end of the data, which is
+            // marked by the most significant 1 bit.
+            fprintf(fout, "  clz x2, x0\n");
+            fprintf(fout, "  neg x2, x2\n");
+            fprintf(fout, "  add x2, x2, #62\n");
           } else {
-            fprintf(fout, "  ubfx x2, x0, %zi, #6\n", 7 + 6 * access_instr->field);
+            fprintf(fout, "  ubfx x2, x0, %zi, #6\n", 1 + 6 * access_instr->field);
             fprintf(fout, "  add x2, x2, %zi\n", header_length);
           }
 
           // Shift arg to its final position.
           fprintf(fout, "  lsr x0, x0, x1\n");
 
-          // Compute and insert the length and pack bit.
+          // x1: the length of the arg.
           fprintf(fout, "  sub x1, x2, x1\n");
-          fprintf(fout, "  bfi x0, x1, #1, #6\n");
-          fprintf(fout, "  orr x0, x0, #1\n");
 
           // Zero out any bits beyond the length.
           fprintf(fout, "  mov x2, -1\n");
           fprintf(fout, "  lsl x2, x2, x1\n");
-          fprintf(fout, "  bic x0, x0, x2, lsl #7\n");
+          fprintf(fout, "  bic x0, x0, x2, lsl #1\n");
+
+          // Insert the end of data marker and pack bit.
+          fprintf(fout, "  mov x2, #2\n");
+          fprintf(fout, "  lsl x2, x2, x1\n");
+          fprintf(fout, "  orr x0, x0, x2\n");
+          fprintf(fout, "  orr x0, x0, #1\n");
         }
 
         fprintf(fout, ".Lr.%04zx.%zi.save:\n", func_id, pc);
@@ -809,14 +848,14 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
       fprintf(fout, ".Lr.%04zx.%zi.packed:\n", func_id, pc);
 
       // Get and check the tag is as expected.
-      fprintf(fout, "  ubfx x2, x0, #7, #%zi\n", access_instr->tagwidth);
+      fprintf(fout, "  ubfx x2, x0, #1, #%zi\n", access_instr->tagwidth);
       fprintf(fout, "  cmp x2, #%zi\n", access_instr->tag);
       fprintf(fout, "  b.ne .Lo.%04zx.%zi.bt\n", func_id, pc);
 
       // Extract the argument.
-      fprintf(fout, "  sub x1, x0, %zi\n", 2 * access_instr->tagwidth);
+      // { 0, 1, arg, tag, 1 } ==> { 0, 1, arg, 1 }
       fprintf(fout, "  lsr x0, x0, %zi\n", access_instr->tagwidth);
-      fprintf(fout, "  bfi x0, x1, #0, #7\n");
+      fprintf(fout, "  orr x0, x0, #1\n");
 
       fprintf(fout, ".Lr.%04zx.%zi.save:\n", func_id, pc);
       SetFrameVar(fout, "x0", access_instr->dest);
@@ -841,7 +880,7 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
 
       // Get the tag from a packed value:
       fprintf(fout, ".Lr.%04zx.%zi.packed:\n", func_id, pc);
-      fprintf(fout, "  ubfx x0, x0, #7, #%zi\n", select_instr->tagwidth);
+      fprintf(fout, "  ubfx x0, x0, #1, #%zi\n", select_instr->tagwidth);
 
       // Binary search for the jump target based on the tag in x0.
       fprintf(fout, ".Lr.%04zx.%zi.switch:\n", func_id, pc);
@@ -877,6 +916,8 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
       SanitizeString(function_block.name->str, function_label);
       fprintf(fout, "  .xword %s.%04zx\n",
           function_label, func_instr->code->profile_block_id);
+      fprintf(fout, "  .xword 0\n");   // .data
+      fprintf(fout, "  .xword 0\n");   // .on_free
 
       fprintf(fout, "  .text\n");
       fprintf(fout, "  .align 2\n");
@@ -1038,12 +1079,16 @@ static void EmitInstr(FILE* fout, LabelId* label_id, FbleNameV profile_blocks, s
         fprintf(fout, "\\x%02x", literal_instr->literal.data[i]);
       }
       fprintf(fout, "\"\n");
+      fprintf(fout, "  .align 3\n");
+      fprintf(fout, ".Lr.%04zx.%zi.id:\n", func_id, pc);
+      fprintf(fout, "  .xword 0\n");
 
       fprintf(fout, "  .text\n");
       fprintf(fout, "  .align 2\n");
       fprintf(fout, "  mov x0, R_RUNTIME\n");
-      Mov(fout, "x1", literal_instr->literal.size);
-      Adr(fout, "x2", ".Lr.%04zx.%zi.prgm", func_id, pc);
+      Adr(fout, "x1", ".Lr.%04zx.%zi.id", func_id, pc);
+      Mov(fout, "x2", literal_instr->literal.size);
+      Adr(fout, "x3", ".Lr.%04zx.%zi.prgm", func_id, pc);
       fprintf(fout, "  bl FbleNewLiteralValue\n");
       SetFrameVar(fout, "x0", literal_instr->dest);
       return;
@@ -1340,7 +1385,7 @@ void FbleGenerateAArch64(FILE* fout, FbleModule* module)
   }
   fprintf(fout, ".L.high_pc:\n");
 
-  StaticPreloadedModule(fout, &label_id, module);
+  StaticPreloadedModule(fout, &label_id, module, blocks);
 
   // Emit dwarf debug info.
   fprintf(fout, "  .section .debug_info\n");
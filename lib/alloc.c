@@ -5,29 +5,75 @@
 
 #include <fble/fble-alloc.h>
 
+#include <pthread.h>  // for pthread_once, pthread_getspecific, etc.
+#include <stdint.h>   // for intptr_t
 #include <stdio.h>    // for fprintf, stderr
-#include <stdbool.h>  // for bool
 #include <stdlib.h>   // for malloc
 
+#include "alloc.h"
+
+/**
+ * @struct[Counter] Allocation counts for a thread.
+ *  Only the owning thread updates the counts. Other threads read the counts
+ *  to aggregate them. A thread may free memory allocated on another thread,
+ *  so total can be negative.
+ *
+ *  FbleResetMaxTotalBytesAllocated doesn't touch the counts. It bumps
+ *  gEpoch instead, and the owning thread resets its max the next time it
+ *  counts an allocation. Until then, total is the max since the reset.
+ *
+ *  @field[Counter*][next] The next counter in the list of all counters.
+ *  @field[Counter*][prev] The previous counter in the list of all counters.
+ *  @field[intptr_t][total] Bytes allocated minus bytes freed by the thread.
+ *  @field[intptr_t][max] Max value of total since the start of epoch.
+ *  @field[uint64_t][epoch] The value of gEpoch max was last reset for.
+ */
+typedef struct Counter {
+  struct Counter* next;
+  struct Counter* prev;
+  intptr_t total;
+  intptr_t max;
+  uint64_t epoch;
+} Counter;
+
+/**
+ * @value[gInitOnce] Makes sure Init is called only once.
+ *  @type[pthread_once_t]
+ */
+static pthread_once_t gInitOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @value[gCounterKey] Thread specific key for the thread's Counter.
+ *  @type[pthread_key_t]
+ */
+static pthread_key_t gCounterKey;
+
+/**
+ * @value[gCountersLock] Lock for gCounters and gRetired.
+ *  @type[pthread_mutex_t]
+ */
+static pthread_mutex_t gCountersLock = PTHREAD_MUTEX_INITIALIZER;
+
 /**
- * @value[gTotalBytesAllocated]
- * @ Total number of bytes currently allocated via FbleAlloc routines.
- *  @type[size_t]
+ * @value[gCounters] Counters of threads that are still running.
+ *  @type[Counter*]
  */
-static size_t gTotalBytesAllocated = 0;
+static Counter* gCounters = NULL;
 
 /**
- * @value[gMaxTotalBytesAllocated]
- * @ Max value of gTotalBytesAllocated since last cleared.
- *  @type[size_t]
+ * @value[gRetired] Combined counts from threads that have exited.
+ *  @type[Counter]
  */
-static size_t gMaxTotalBytesAllocated = 0;
+static Counter gRetired = { .next = NULL, .prev = NULL, .total = 0, .max = 0, .epoch = 0 };
 
 /**
- * @value[gInitialized] True if the exit routine has been registered.
- *  @type[bool]
+ * @value[gEpoch] Number of calls to FbleResetMaxTotalBytesAllocated.
+ *  Written with gCountersLock held. Read without the lock by threads
+ *  counting allocations.
+ *
+ *  @type[uint64_t]
  */
-static bool gInitialized = false;
+static uint64_t gEpoch = 0;
 
 /**
  * @struct[Alloc] An allocation.
@@ -40,6 +86,11 @@ typedef struct {
 } Alloc;
 
 static void Exit();
+static void Init();
+static void RetireCounter(void* data);
+static Counter* GetCounter();
+static intptr_t CounterMax(Counter* counter);
+static void Count(intptr_t delta);
 
 /**
  * @func[Exit] Exit function to check for memory leaks.
@@ -48,25 +99,147 @@ static void Exit();
  */
 static void Exit()
 {
-  if (gTotalBytesAllocated != 0) {
+  pthread_mutex_lock(&gCountersLock);
+  intptr_t total = gRetired.total;
+  for (Counter* counter = gCounters; counter != NULL; counter = counter->next) {
+    total += __atomic_load_n(&counter->total, __ATOMIC_RELAXED);
+  }
+  pthread_mutex_unlock(&gCountersLock);
+
+  if (total != 0) {
     fprintf(stderr, "ERROR: MEMORY LEAK DETECTED\n");
     fprintf(stderr, "Try running again using: valgrind --leak-check=full\n");
     abort();
   }
 }
 
-// See documentation in fble-alloc.h.
-void* FbleAllocRaw(size_t size)
+/**
+ * @func[Init] Initializes allocation accounting.
+ *  @sideeffects
+ *   Creates the thread specific key for counters and registers the exit
+ *   routine.
+ */
+static void Init()
+{
+  if (pthread_key_create(&gCounterKey, &RetireCounter) != 0) {
+    fprintf(stderr, "ERROR: unable to create thread specific key\n");
+    abort();
+  }
+  atexit(&Exit);
+}
+
+/**
+ * @func[RetireCounter] Retires the counter of a thread that has exited.
+ *  @arg[void*][data] The Counter* of the thread.
+ *  @sideeffects
+ *   Adds the thread's counts to gRetired and frees the counter.
+ */
+static void RetireCounter(void* data)
+{
+  Counter* counter = (Counter*)data;
+  pthread_mutex_lock(&gCountersLock);
+  if (counter->prev == NULL) {
+    gCounters = counter->next;
+  } else {
+    counter->prev->next = counter->next;
+  }
+  if (counter->next != NULL) {
+    counter->next->prev = counter->prev;
+  }
+  gRetired.total += counter->total;
+  gRetired.max += CounterMax(counter);
+  pthread_mutex_unlock(&gCountersLock);
+  free(counter);
+}
+
+/**
+ * @func[GetCounter] Gets the counter for the current thread.
+ *  @returns[Counter*] The counter for the current thread.
+ *  @sideeffects
+ *   Allocates and registers a new counter the first time it is called on a
+ *   thread.
+ */
+static Counter* GetCounter()
+{
+  pthread_once(&gInitOnce, &Init);
+
+  Counter* counter = pthread_getspecific(gCounterKey);
+  if (counter == NULL) {
+    counter = malloc(sizeof(Counter));
+    counter->prev = NULL;
+    counter->total = 0;
+    counter->max = 0;
+
+    pthread_mutex_lock(&gCountersLock);
+    counter->epoch = gEpoch;
+    counter->next = gCounters;
+    if (gCounters != NULL) {
+      gCounters->prev = counter;
+    }
+    gCounters = counter;
+    pthread_mutex_unlock(&gCountersLock);
+
+    pthread_setspecific(gCounterKey, counter);
+  }
+  return counter;
+}
+
+/**
+ * @func[CounterMax] Gets a counter's max since the last reset.
+ *  @arg[Counter*][counter] The counter. gCountersLock must be held.
+ *  @returns[intptr_t] The max bytes allocated since the last reset.
+ *  @sideeffects None.
+ */
+static intptr_t CounterMax(Counter* counter)
 {
-  if (!gInitialized) {
-    gInitialized = true;
-    atexit(&Exit);
+  // The owning thread stores max before epoch, so if we see the current
+  // epoch we see the max for it.
+  if (__atomic_load_n(&counter->epoch, __ATOMIC_ACQUIRE) == gEpoch) {
+    return __atomic_load_n(&counter->max, __ATOMIC_RELAXED);
   }
+  return __atomic_load_n(&counter->total, __ATOMIC_RELAXED);
+}
+
+/**
+ * @func[Count] Updates the count of bytes allocated by the current thread.
+ *  @arg[intptr_t][delta] The change in number of bytes allocated.
+ *  @sideeffects
+ *   Updates the current thread's total and max bytes allocated.
+ */
+static void Count(intptr_t delta)
+{
+  Counter* counter = GetCounter();
+  intptr_t total = counter->total + delta;
+  __atomic_store_n(&counter->total, total, __ATOMIC_RELAXED);
 
-  gTotalBytesAllocated += size;
-  if (gTotalBytesAllocated > gMaxTotalBytesAllocated) {
-    gMaxTotalBytesAllocated = gTotalBytesAllocated;
+  uint64_t epoch = __atomic_load_n(&gEpoch, __ATOMIC_RELAXED);
+  if (counter->epoch != epoch) {
+    // The max was reset since we last counted. The total before this
+    // allocation is the max since the reset.
+    intptr_t max = total - delta;
+    __atomic_store_n(&counter->max, total > max ? total : max, __ATOMIC_RELAXED);
+    __atomic_store_n(&counter->epoch, epoch, __ATOMIC_RELEASE);
+  } else if (total > counter->max) {
+    __atomic_store_n(&counter->max, total, __ATOMIC_RELAXED);
   }
+}
+
+// See documentation in alloc.h.
+void FbleCountAlloc(size_t size)
+{
+  Count((intptr_t)size);
+}
+
+// See documentation in alloc.h.
+void FbleCountFree(size_t size)
+{
+  Count(-(intptr_t)size);
+}
+
+// See documentation in fble-alloc.h.
+void* FbleAllocRaw(size_t size)
+{
+  FbleCountAlloc(size);
 
   Alloc* alloc = malloc(sizeof(Alloc) + size);
   alloc->size = size;
@@ -80,10 +253,7 @@ void* FbleReAllocRaw(void* ptr, size_t size)
   }
 
   Alloc* alloc = ((Alloc*)ptr) - 1;
-  gTotalBytesAllocated += size - alloc->size;
-  if (gTotalBytesAllocated > gMaxTotalBytesAllocated) {
-    gMaxTotalBytesAllocated = gTotalBytesAllocated;
-  }
+  Count((intptr_t)size - (intptr_t)alloc->size);
 
   alloc = realloc(alloc, sizeof(Alloc) + size);
   alloc->size = size;
@@ -98,18 +268,27 @@ void FbleFree(void* ptr)
   }
 
   Alloc* alloc = ((Alloc*)ptr) - 1;
-  gTotalBytesAllocated -= alloc->size;
+  FbleCountFree(alloc->size);
   free(alloc);
 }
 
 // See documentation in fble-alloc.h.
 size_t FbleMaxTotalBytesAllocated()
 {
-  return gMaxTotalBytesAllocated;
+  pthread_mutex_lock(&gCountersLock);
+  intptr_t max = gRetired.max;
+  for (Counter* counter = gCounters; counter != NULL; counter = counter->next) {
+    max += CounterMax(counter);
+  }
+  pthread_mutex_unlock(&gCountersLock);
+  return max < 0 ? 0 : (size_t)max;
 }
 
 // See documentation in fble-alloc.h.
 void FbleResetMaxTotalBytesAllocated()
 {
-  gMaxTotalBytesAllocated = gTotalBytesAllocated;
+  pthread_mutex_lock(&gCountersLock);
+  gRetired.max = gRetired.total;
+  __atomic_add_fetch(&gEpoch, 1, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&gCountersLock);
 }
@@ -0,0 +1,34 @@
+/**
+ * @file alloc.h
+ *  Internal allocation accounting routines.
+ *
+ *  For use by parts of the implementation that manage their own memory but
+ *  want that memory to show up in the totals reported by
+ *  FbleMaxTotalBytesAllocated.
+ */
+
+#ifndef FBLE_INTERNAL_ALLOC_H_
+#define FBLE_INTERNAL_ALLOC_H_
+
+#include <sys/types.h>    // for size_t
+
+/**
+ * @func[FbleCountAlloc] Records bytes as allocated.
+ *  @arg[size_t][size] The number of bytes allocated.
+ *
+ *  @sideeffects
+ *   Adds @a[size] to the total number of bytes allocated. The bytes should
+ *   be released with a matching call to FbleCountFree when no longer in use.
+ */
+void FbleCountAlloc(size_t size);
+
+/**
+ * @func[FbleCountFree] Records bytes as freed.
+ *  @arg[size_t][size] The number of bytes freed.
+ *
+ *  @sideeffects
+ *   Subtracts @a[size] from the total number of bytes allocated.
+ */
+void FbleCountFree(size_t size);
+
+#endif // FBLE_INTERNAL_ALLOC_H_
@@ -29,7 +29,7 @@ static void StringLit(FILE* fout, const char* string);
 static LabelId StaticString(FILE* fout, LabelId* label_id, const char* string);
 static LabelId StaticNames(FILE* fout, LabelId* label_id, FbleNameV names);
 static LabelId StaticModulePath(FILE* fout, LabelId* label_id, FbleModulePath* path);
-static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module);
+static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module, FbleCodeV blocks);
 
 static void ReturnAbort(FILE* fout, const char* lmsg, FbleLoc loc);
 
@@ -203,12 +203,13 @@ static LabelId StaticModulePath(FILE* fout, LabelId* label_id, FbleModulePath* p
  *  @arg[FILE*][fout] The output stream to write the code to.
  *  @arg[LabelId*][label_id] Pointer to next available label id for use.
  *  @arg[FbleModule*][module] The FbleModule to generate code for.
+ *  @arg[FbleCodeV][blocks] The code blocks of the module's functions.
  *
  *  @sideeffects
  *   @i Outputs code to fout.
  *   @i Increments label_id based on the number of internal labels used.
  */
-static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module)
+static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* module, FbleCodeV blocks)
 {
   LabelId path_id = StaticModulePath(fout, label_id, module->path);
 
@@ -241,6 +242,26 @@ static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* mod
 
   LabelId profile_blocks_xs_id = StaticNames(fout, label_id, module->profile_blocks);
 
+  LabelId executables_id = (*label_id)++;
+  fprintf(fout, "static FbleExecutable " LABEL "[] = {\n", executables_id);
+  for (size_t i = 0; i < blocks.size; ++i) {
+    FbleCode* code = blocks.xs[i];
+    FbleName block = module->profile_blocks.xs[code->profile_block_id];
+    char label[SizeofSanitizedString(block.name->str)];
+    SanitizeString(block.name->str, label);
+    fprintf(fout, "  { .num_args = %zi, .num_statics = %zi, .max_call_args = %zi, .run = &%s_%04zx },\n",
+        code->executable.num_args, code->executable.num_statics,
+        code->executable.max_call_args, label, code->profile_block_id);
+  }
+  fprintf(fout, "};\n");
+
+  LabelId executables_xs_id = (*label_id)++;
+  fprintf(fout, "static FbleExecutable* " LABEL "[] = {\n", executables_xs_id);
+  for (size_t i = 0; i < blocks.size; ++i) {
+    fprintf(fout, "  &" LABEL "[%zi],\n", executables_id, i);
+  }
+  fprintf(fout, "};\n");
+
   FbleString* module_name = FbleMangleModulePath(module->path);
   fprintf(fout, "FblePreloadedModule %s = {\n", module_name->str);
   fprintf(fout, "  .path = &" LABEL ",\n", path_id);
@@ -249,6 +270,9 @@ static void StaticPreloadedModule(FILE* fout, LabelId* label_id, FbleModule* mod
   fprintf(fout, "  .executable = &" LABEL ",\n", executable_id);
   fprintf(fout, "  .profile_blocks = { .size = %zi, .xs = " LABEL "},\n",
       module->profile_blocks.size, profile_blocks_xs_id);
+  fprintf(fout, "  .executables = { .size = %zi, .xs = " LABEL "},\n",
+      blocks.size, executables_xs_id);
+  fprintf(fout, "  .hash = 0x%llxULL,\n", (unsigned long long)module->hash);
   fprintf(fout, "};\n");
   FbleFreeString(module_name);
 }
@@ -540,11 +564,14 @@ static void EmitCode(FILE* fout, FbleNameV profile_blocks, FbleCode* code)
       case FBLE_LITERAL_INSTR: {
         FbleLiteralInstr* literal_instr = (FbleLiteralInstr*)instr;
         size_t argc = literal_instr->literal.size;
-        fprintf(fout, "  l[%zi] = FbleNewLiteralValue(runtime, %zi, \"", literal_instr->dest, argc);
+        fprintf(fout, "  {\n");
+        fprintf(fout, "    static size_t id = 0;\n");
+        fprintf(fout, "    l[%zi] = FbleNewLiteralValue(runtime, &id, %zi, \"", literal_instr->dest, argc);
         for (size_t i = 0; i < argc; ++i) {
           fprintf(fout, "\\x%02x", literal_instr->literal.data[i]);
         }
         fprintf(fout, "\");\n");
+        fprintf(fout, "  }\n");
         break;
       }
 
@@ -649,7 +676,7 @@ void FbleGenerateC(FILE* fout, FbleModule* module)
   }
 
   LabelId label_id = 0;
-  StaticPreloadedModule(fout, &label_id, module);
+  StaticPreloadedModule(fout, &label_id, module, blocks);
 
   FbleFreeVector(blocks);
 }
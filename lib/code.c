@@ -6,16 +6,22 @@
 #include "code.h"
 
 #include <assert.h>   // for assert
+#include <stdint.h>   // for uint64_t
 #include <stdio.h>    // for fprintf
 #include <stdlib.h>   // for NULL
 
 #include <fble/fble-alloc.h>      // for FbleAlloc, FbleFree, etc.
 #include <fble/fble-function.h>   // for FbleExecutable
+#include <fble/fble-module-path.h>  // for FbleMangleModulePath
 #include <fble/fble-vector.h>     // for FbleInitVector, etc.
 
 #include "tc.h"
 #include "unreachable.h"
 
+static uint64_t HashWord(uint64_t hash, uint64_t word);
+static uint64_t HashString(uint64_t hash, const char* str);
+static uint64_t HashVar(uint64_t hash, FbleVar var);
+static uint64_t HashVars(uint64_t hash, FbleVarV vars);
 static void PrintLoc(FILE* fout, FbleLoc loc);
 
 // See documentation in code.h.
@@ -175,6 +181,8 @@ FbleCode* FbleNewCode(size_t num_args, size_t num_statics, size_t num_locals, Fb
   code->profile_block_id = profile_block_id;
   code->num_locals = num_locals;
   FbleInitVector(code->instrs);
+  code->decoded = NULL;
+  code->free_decoded = NULL;
   return code;
 }
 
@@ -193,16 +201,250 @@ void FbleFreeCode(FbleCode* code)
   assert(code->magic == FBLE_CODE_MAGIC && "corrupt FbleCode");
   assert(code->refcount > 0);
 
-  code->refcount--;
-  if (code->refcount == 0) {
+  // Function values sharing the code may be freed on different threads.
+  if (__atomic_sub_fetch(&code->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
     for (size_t i = 0; i < code->instrs.size; ++i) {
       FbleFreeInstr(code->instrs.xs[i]);
     }
     FbleFreeVector(code->instrs);
+    if (code->decoded != NULL) {
+      code->free_decoded(code->decoded);
+    }
     FbleFree(code);
   }
 }
 
+/**
+ * @func[HashWord] Adds a word to a hash.
+ *  Uses the FNV-1a hash function.
+ *
+ *  @arg[uint64_t][hash] The hash so far.
+ *  @arg[uint64_t][word] The word to add to the hash.
+ *  @returns[uint64_t] The updated hash.
+ */
+static uint64_t HashWord(uint64_t hash, uint64_t word)
+{
+  for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+    hash = (hash ^ (word & 0xFF)) * 0x100000001b3;
+    word >>= 8;
+  }
+  return hash;
+}
+
+/**
+ * @func[HashString] Adds a string to a hash.
+ *  Uses the FNV-1a hash function.
+ *
+ *  @arg[uint64_t][hash] The hash so far.
+ *  @arg[const char*][str] The string to add to the hash.
+ *  @returns[uint64_t] The updated hash.
+ */
+static uint64_t HashString(uint64_t hash, const char* str)
+{
+  for (const char* c = str; *c != '\0'; ++c) {
+    hash = (hash ^ (unsigned char)*c) * 0x100000001b3;
+  }
+  return HashWord(hash, 0);
+}
+
+/**
+ * @func[HashVar] Adds a variable to a hash.
+ *  @arg[uint64_t][hash] The hash so far.
+ *  @arg[FbleVar][var] The variable to add to the hash.
+ *  @returns[uint64_t] The updated hash.
+ */
+static uint64_t HashVar(uint64_t hash, FbleVar var)
+{
+  hash = HashWord(hash, var.tag);
+  return HashWord(hash, var.index);
+}
+
+/**
+ * @func[HashVars] Adds a vector of variables to a hash.
+ *  @arg[uint64_t][hash] The hash so far.
+ *  @arg[FbleVarV][vars] The variables to add to the hash.
+ *  @returns[uint64_t] The updated hash.
+ */
+static uint64_t HashVars(uint64_t hash, FbleVarV vars)
+{
+  hash = HashWord(hash, vars.size);
+  for (size_t i = 0; i < vars.size; ++i) {
+    hash = HashVar(hash, vars.xs[i]);
+  }
+  return hash;
+}
+
+// See documentation in code.h.
+uint64_t FbleHashCode(FbleCode* code)
+{
+  uint64_t hash = 0xcbf29ce484222325;
+
+  FbleCodeV blocks;
+  FbleInitVector(blocks);
+  FbleAppendToVector(blocks, code);
+  while (blocks.size > 0) {
+    FbleCode* block = blocks.xs[--blocks.size];
+    hash = HashWord(hash, block->executable.num_args);
+    hash = HashWord(hash, block->executable.num_statics);
+    hash = HashWord(hash, block->executable.max_call_args);
+    hash = HashWord(hash, block->profile_block_id);
+    hash = HashWord(hash, block->num_locals);
+    hash = HashWord(hash, block->instrs.size);
+    for (size_t pc = 0; pc < block->instrs.size; ++pc) {
+      FbleInstr* instr = block->instrs.xs[pc];
+      hash = HashWord(hash, instr->tag);
+      hash = HashWord(hash, instr->profile_sample_count);
+
+      switch (instr->tag) {
+        case FBLE_STRUCT_VALUE_INSTR: {
+          FbleStructValueInstr* i = (FbleStructValueInstr*)instr;
+          hash = HashVars(hash, i->args);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_UNION_VALUE_INSTR: {
+          FbleUnionValueInstr* i = (FbleUnionValueInstr*)instr;
+          hash = HashWord(hash, i->tagwidth);
+          hash = HashWord(hash, i->tag);
+          hash = HashVar(hash, i->arg);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_STRUCT_ACCESS_INSTR: {
+          FbleStructAccessInstr* i = (FbleStructAccessInstr*)instr;
+          hash = HashVar(hash, i->obj);
+          hash = HashWord(hash, i->fieldc);
+          hash = HashWord(hash, i->field);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_UNION_ACCESS_INSTR: {
+          FbleUnionAccessInstr* i = (FbleUnionAccessInstr*)instr;
+          hash = HashVar(hash, i->obj);
+          hash = HashWord(hash, i->tagwidth);
+          hash = HashWord(hash, i->tag);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_UNION_SELECT_INSTR: {
+          FbleUnionSelectInstr* i = (FbleUnionSelectInstr*)instr;
+          hash = HashVar(hash, i->condition);
+          hash = HashWord(hash, i->tagwidth);
+          hash = HashWord(hash, i->num_tags);
+          hash = HashWord(hash, i->targets.size);
+          for (size_t j = 0; j < i->targets.size; ++j) {
+            hash = HashWord(hash, i->targets.xs[j].tag);
+            hash = HashWord(hash, i->targets.xs[j].target);
+          }
+          hash = HashWord(hash, i->default_);
+          break;
+        }
+
+        case FBLE_GOTO_INSTR: {
+          FbleGotoInstr* i = (FbleGotoInstr*)instr;
+          hash = HashWord(hash, i->target);
+          break;
+        }
+
+        case FBLE_FUNC_VALUE_INSTR: {
+          FbleFuncValueInstr* i = (FbleFuncValueInstr*)instr;
+          hash = HashWord(hash, i->dest);
+          hash = HashWord(hash, i->profile_block_offset);
+          hash = HashVars(hash, i->scope);
+          FbleAppendToVector(blocks, i->code);
+          break;
+        }
+
+        case FBLE_CALL_INSTR: {
+          FbleCallInstr* i = (FbleCallInstr*)instr;
+          hash = HashVar(hash, i->func);
+          hash = HashVars(hash, i->args);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_TAIL_CALL_INSTR: {
+          FbleTailCallInstr* i = (FbleTailCallInstr*)instr;
+          hash = HashVar(hash, i->func);
+          hash = HashVars(hash, i->args);
+          break;
+        }
+
+        case FBLE_COPY_INSTR: {
+          FbleCopyInstr* i = (FbleCopyInstr*)instr;
+          hash = HashVar(hash, i->source);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_REC_DECL_INSTR: {
+          FbleRecDeclInstr* i = (FbleRecDeclInstr*)instr;
+          hash = HashWord(hash, i->n);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_REC_DEFN_INSTR: {
+          FbleRecDefnInstr* i = (FbleRecDefnInstr*)instr;
+          hash = HashWord(hash, i->decl);
+          hash = HashWord(hash, i->defn);
+          break;
+        }
+
+        case FBLE_RETURN_INSTR: {
+          FbleReturnInstr* i = (FbleReturnInstr*)instr;
+          hash = HashVar(hash, i->result);
+          break;
+        }
+
+        case FBLE_TYPE_INSTR: {
+          FbleTypeInstr* i = (FbleTypeInstr*)instr;
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_LIST_INSTR: {
+          FbleListInstr* i = (FbleListInstr*)instr;
+          hash = HashVars(hash, i->args);
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_LITERAL_INSTR: {
+          FbleLiteralInstr* i = (FbleLiteralInstr*)instr;
+          hash = HashWord(hash, i->literal.size);
+          for (size_t j = 0; j < i->literal.size; ++j) {
+            hash = HashWord(hash, i->literal.data[j]);
+          }
+          hash = HashWord(hash, i->dest);
+          break;
+        }
+
+        case FBLE_FOREIGN_VALUE_INSTR: {
+          FbleForeignValueInstr* i = (FbleForeignValueInstr*)instr;
+          FbleString* path = FbleMangleModulePath(i->path);
+          hash = HashString(hash, path->str);
+          FbleFreeString(path);
+          hash = HashString(hash, i->name.name->str);
+          hash = HashWord(hash, i->dest);
+          hash = HashWord(hash, i->profile_block_offset);
+          break;
+        }
+
+        case FBLE_NOP_INSTR: {
+          break;
+        }
+      }
+    }
+  }
+  FbleFreeVector(blocks);
+  return hash;
+}
+
 /**
  * @func[PrintLoc] Prints a location.
  *  For use in the diassembly output.
@@ -6,6 +6,8 @@
 #ifndef FBLE_INTERNAL_CODE_H_
 #define FBLE_INTERNAL_CODE_H_
 
+#include <stdint.h>              // for uint64_t
+
 #include <fble/fble-compile.h>   // for FbleCode forward declaration.
 #include <fble/fble-function.h>  // for FbleExecutable.
 #include <fble/fble-literal.h>   // for FbleLiteral.
@@ -118,16 +120,34 @@ typedef enum {
   FBLE_CODE_MAGIC = 0xB01CE,
 } FbleCodeMagic;
 
+/**
+ * @func[FbleFreeDecodedFunction] Frees the decoded form of code.
+ *  @arg[void*][decoded] The decoded code to free.
+ *  @sideeffects
+ *   Frees resources associated with the decoded code.
+ */
+typedef void FbleFreeDecodedFunction(void* decoded);
+
 /**
  * @struct[FbleCode] Fble bytecode.
- *  @field[size_t][refcount] Reference count.
+ *  @field[size_t][refcount]
+ *   Reference count. Updated atomically, because code may be shared by
+ *   function values on different threads.
  *  @field[FbleCodeMagic][magic] FBLE_CODE_MAGIC
  *  @field[FbleExecutable][executable] FbleExecutable. Run function is unused.
  *  @field[FbleBlockId][profile_block_id]
  *   Id of the profile block for this code.
  *  @field[size_t][num_locals]
  *   Number of local variable slots used/required.
- *  @field[FbleInstrV][instrs] The instructions to execute.
+ *  @field[FbleInstrV][instrs]
+ *   The instructions to execute. Empty once the code has been decoded: the
+ *   interpreter frees the instructions after encoding them.
+ *  @field[void*][decoded]
+ *   The instructions encoded as flat bytecode for the interpreter, built
+ *   the first time the code is interpreted. NULL until then. Owned by the
+ *   code.
+ *  @field[FbleFreeDecodedFunction*][free_decoded]
+ *   Function to free decoded with. Set along with decoded.
  */
 struct FbleCode {
   size_t refcount;
@@ -136,6 +156,8 @@ struct FbleCode {
   FbleBlockId profile_block_id;
   size_t num_locals;
   FbleInstrV instrs;
+  void* decoded;
+  FbleFreeDecodedFunction* free_decoded;
 };
 
 /**
@@ -464,11 +486,13 @@ typedef struct {
  *
  *  @field[FbleInstr][_base] FbleInstr base class.
  *  @field[FbleLiteral][literal] The literal value.
+ *  @field[size_t][id] Cache slot for the literal value.
  *  @field[FbleLocalIndex][dest] Where to put the created value.
  */
 typedef struct {
   FbleInstr _base;
   FbleLiteral literal;
+  size_t id;
   FbleLocalIndex dest;
 } FbleLiteralInstr;
 
@@ -489,6 +513,9 @@ typedef struct {
  *   Module path associated with the function.
  *  @field[FbleString*][name]
  *   The name of the foreign function.
+ *  @field[FbleForeign*][foreign]
+ *   The foreign function, cached by the interpreter the first time it is
+ *   looked up. NULL if it hasn't been looked up yet.
  */
 typedef struct {
   FbleInstr _base;
@@ -496,6 +523,7 @@ typedef struct {
   FbleBlockId profile_block_offset;
   FbleModulePath* path;
   FbleName name;
+  FbleForeign* foreign;
 } FbleForeignValueInstr;
 
 /**
@@ -596,4 +624,16 @@ FbleCode* FbleNewCode(size_t num_args, size_t num_statics, size_t num_locals, Fb
  */
 void FbleFreeCode(FbleCode* code);
 
+/**
+ * @func[FbleHashCode] Computes a hash of compiled code.
+ *  The hash covers the instructions of the code and of the functions it
+ *  defines, but not debug info or source locations. It identifies the
+ *  contents of a compiled module for snapshots.
+ *
+ *  @arg[FbleCode*][code] The code to hash. Must still have its instructions.
+ *  @returns[uint64_t] The hash of the code.
+ *  @sideeffects None.
+ */
+uint64_t FbleHashCode(FbleCode* code);
+
 #endif // FBLE_INTERNAL_CODE_H_
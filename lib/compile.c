@@ -1351,6 +1351,7 @@ static Local* CompileExpr(Blocks* blocks, bool stmt, bool exit, Scope* scope, Fb
       Local* local = NewLocal(scope);
       FbleLiteralInstr* literal_instr = FbleAllocInstr(FbleLiteralInstr, FBLE_LITERAL_INSTR);
       literal_instr->dest = local->var.index;
+      literal_instr->id = 0;
       literal_instr->literal.size = literal_tc->literal.size;
       literal_instr->literal.data = FbleAllocArray(uint8_t, literal_tc->literal.size);
       memcpy(literal_instr->literal.data, literal_tc->literal.data, literal_tc->literal.size);
@@ -1372,6 +1373,7 @@ static Local* CompileExpr(Blocks* blocks, bool stmt, bool exit, Scope* scope, Fb
       instr->profile_block_offset = block - scope->code->profile_block_id;
       instr->path = FbleCopyModulePath(foreign_tc->path);
       instr->name = FbleCopyName(foreign_tc->name);
+      instr->foreign = NULL;
       AppendInstr(scope, &instr->_base);
 
       PushVar(scope, foreign_tc->name, var);
@@ -1456,6 +1458,7 @@ static void CompileModule(FbleModule* module, FbleTc* tc)
 
   FbleName label = FbleModulePathName(module->path);
   module->code = Compile(args, tc, label, &module->profile_blocks);
+  module->hash = FbleHashCode(module->code);
   for (size_t i = 0; i < args.size; ++i) {
     FbleFreeName(args.xs[i]);
   }
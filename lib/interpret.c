@@ -6,19 +6,162 @@
 #include "interpret.h"
 
 #include <assert.h>   // for assert
+#include <pthread.h>  // for pthread_mutex_t, etc.
 #include <stdlib.h>   // for rand
-#include <string.h>   // for memcpy
+#include <string.h>   // for memset, memcpy
 
 #include <fble/fble-alloc.h>    // for FbleAlloc, FbleFree
 #include <fble/fble-function.h> // For FbleFunction, etc.
-#include <fble/fble-runtime.h>  // for FbleNativeValueData, etc.
+#include <fble/fble-runtime.h>  // for FbleNewFuncValue, etc.
 #include <fble/fble-vector.h>   // for FbleInitVector, etc.
 
 #include "code.h"
+#include "runtime.h"      // for FbleEnterCallFrame, FbleAllocRegisters, etc.
 #include "unreachable.h"
 
+#ifdef __GNUC__
+/**
+ * @def[FBLE_THREADED_DISPATCH]
+ * @ Dispatch instructions using computed goto.
+ *  Defined when the compiler supports taking the address of a label. Each
+ *  encoded instruction then starts with the address of its own handler, so
+ *  dispatch is a single indirect jump from the end of the previous handler.
+ *  Otherwise the interpreter falls back to a portable switch.
+ */
+#define FBLE_THREADED_DISPATCH
+#endif
+
+/**
+ * @def[PROFILE_SAMPLE_OP]
+ * @ Pseudo instruction tag for taking a profile sample.
+ *  Encoded in front of any instruction with a non-zero profile sample count,
+ *  so that other instructions don't need to check for profiling.
+ */
+#define PROFILE_SAMPLE_OP (FBLE_NOP_INSTR + 1)
+
+/**
+ * @def[STRUCT_ACCESSES_OP]
+ * @ Superinstruction tag for a run of struct accesses.
+ *  Consecutive FBLE_STRUCT_ACCESS_INSTR instructions, such as those
+ *  unpacking a module or chasing a chain of fields, are executed with a
+ *  single dispatch.
+ */
+#define STRUCT_ACCESSES_OP (FBLE_NOP_INSTR + 2)
+
+/**
+ * @struct[Word] A word of encoded bytecode.
+ *  Each instruction is encoded as a handler word followed by its operands
+ *  inline. Variables are encoded as (index << 2 | tag).
+ *
+ *  @field[const void*][label]
+ *   The handler for an instruction, with threaded dispatch.
+ *  @field[uintptr_t][u]
+ *   The tag of an instruction without threaded dispatch, or an immediate
+ *   operand.
+ *  @field[void*][p] A pointer operand.
+ *  @field[union Word*][target] A branch target.
+ */
+typedef union Word {
+  const void* label;
+  uintptr_t u;
+  void* p;
+  union Word* target;
+} Word;
+
+/**
+ * @struct[Program] Flat bytecode for a block of code.
+ *  Allocated as a single block, with the kept, executables, offsets, locs
+ *  and words arrays following the Program struct. The instructions the
+ *  program was encoded from are freed once it is encoded, except for those
+ *  in kept.
+ *
+ *  @field[size_t][num_kept] The number of instructions in kept.
+ *  @field[FbleInstr**][kept]
+ *   The function value, literal and foreign value instructions the encoded
+ *   instructions refer to. Owned by the program.
+ *  @field[FbleExecutable*][executables]
+ *   Executables for the functions created by the program's
+ *   FBLE_FUNC_VALUE_INSTR instructions.
+ *  @field[size_t][max_args]
+ *   The most args to any struct value, call or list instruction in the
+ *   program.
+ *  @field[size_t][num_locs] The number of entries in offsets and locs.
+ *  @field[size_t*][offsets]
+ *   Side table of the offset in words of each encoded handler that can
+ *   report an error, in increasing order. A handler has an entry per
+ *   location it can report: one per fused access for a run of struct
+ *   accesses, one per value for a recursive definition, one otherwise.
+ *  @field[FbleLoc*][locs]
+ *   The location to report for the corresponding entry in offsets. Owned
+ *   by the program.
+ *  @field[Word*][words] The encoded instructions.
+ */
+typedef struct {
+  size_t num_kept;
+  FbleInstr** kept;
+  FbleExecutable* executables;
+  size_t max_args;
+  size_t num_locs;
+  size_t* offsets;
+  FbleLoc* locs;
+  Word* words;
+} Program;
+
+/**
+ * @value[gEncodeLock] Lock for encoding code.
+ *  Held while encoding, because encoding frees the instructions another
+ *  thread wanting to encode the same code would read.
+ *
+ *  @type[pthread_mutex_t]
+ */
+static pthread_mutex_t gEncodeLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @struct[Activation] An interpreted call in progress.
+ *  Allocated in registers on the runtime stack, so that calls from
+ *  interpreted code to interpreted code can run in place instead of
+ *  recursing on the native stack. The locals of the function are followed
+ *  by scratch space for instructions that take a variable number of args,
+ *  then the args of the call for calls made in place.
+ *
+ *  @field[Activation*][caller]
+ *   The activation to return to, or NULL to return from Interpret.
+ *  @field[Program*][program] The program being run.
+ *  @field[FbleFunction*][function] The function being run.
+ *  @field[FbleValue**][args] The args to the function.
+ *  @field[FbleValue**][scratch]
+ *   Space for the args of struct value, call and list instructions.
+ *  @field[Word*][pc] The call instruction waiting for a callee to return.
+ *  @field[FbleValue**][locals] The local variables of the function.
+ */
+typedef struct Activation {
+  struct Activation* caller;
+  Program* program;
+  FbleFunction* function;
+  FbleValue** args;
+  FbleValue** scratch;
+  Word* pc;
+  FbleValue* locals[];
+} Activation;
+
 static FbleValue* RuntimeError(FbleRuntime* runtime, FbleLoc loc, FbleBlockId func, const char* msg);
 static void FreeCode(void* code);
+static void FreeProgram(void* decoded);
+static FbleExecutable Executable(FbleCode* code);
+static size_t EncodedSize(FbleInstr* instr);
+static size_t NumLocs(FbleInstr* instr);
+static bool Kept(FbleInstr* instr);
+static size_t SelectTarget(FbleUnionSelectInstr* select, size_t tag);
+static FbleUnionAccessInstr* BoundAccess(FbleCode* code, FbleUnionSelectInstr* select, size_t tag);
+static bool* BranchTargets(FbleCode* code);
+static size_t AccessRun(FbleCode* code, bool* targets, size_t i);
+static Word Handler(const void** labels, size_t tag);
+static Word Var(FbleVar var);
+static Word* EncodeVars(Word* w, FbleVarV vars);
+static Program* Encode(FbleCode* code, const void** labels);
+static FbleLoc Loc(Program* program, Word* pc, size_t k);
+static Activation* Activate(FbleRuntime* runtime, const void** labels, Activation* caller, FbleFunction* function, FbleValue** args);
+static FbleValue* Interpret(FbleRuntime* runtime, FbleProfileThread* profile, FbleFunction* function, FbleValue** args);
 
 /**
  * @func[GET] Gets the value of a variable in scope.
@@ -30,7 +173,7 @@ static void FreeCode(void* code);
  *   vars[FBLE_ARG_VAR] = args;
  *   vars[FBLE_LOCAL_VAR] = locals;
  *
- *  @arg[FbleVar][var] The index of the variable.
+ *  @arg[Word][var] The encoded variable.
  *
  *  @returns[FbleValue*]
  *   The value of the variable.
@@ -38,7 +181,7 @@ static void FreeCode(void* code);
  *  @sideeffects
  *   None.
  */
-#define GET(var) (vars[var.tag][var.index])
+#define GET(var) (vars[(var).u & 0x3][(var).u >> 2])
 
 /**
  * @func[RuntimeError] Reports and returns a runtime error.
@@ -57,6 +200,9 @@ static FbleValue* RuntimeError(FbleRuntime* runtime, FbleLoc loc, FbleBlockId fu
 
 /**
  * @func[FreeCode] Calls FbleFreeCode.
+ *  The on_free function of interpreted executables. Function values may be
+ *  freed on any thread, which FbleFreeCode is safe for.
+ *
  *  @arg[void*][code] The code to free.
  *  @sideeffects
  *   Calls FbleFreeCode on the given code.
@@ -66,271 +212,1049 @@ static void FreeCode(void* data)
   FbleFreeCode((FbleCode*)data);
 }
 
-// FbleRunFunction for running interpreted code.
-// See documentation for FbleRunFunction in fble-function.h.
-static FbleValue* Interpret(
-    FbleRuntime* runtime,
-    FbleProfileThread* profile,
-    FbleFunction* function,
-    FbleValue** args)
+/**
+ * @func[FreeProgram] Frees a Program.
+ *  @arg[void*][decoded] The Program to free.
+ *  @sideeffects
+ *   Frees the program along with its kept instructions and locations.
+ */
+static void FreeProgram(void* decoded)
+{
+  Program* program = (Program*)decoded;
+  for (size_t i = 0; i < program->num_kept; ++i) {
+    FbleFreeInstr(program->kept[i]);
+  }
+  for (size_t i = 0; i < program->num_locs; ++i) {
+    FbleFreeLoc(program->locs[i]);
+  }
+  FbleFree(program);
+}
+
+/**
+ * @func[Executable] Gets the executable for interpreting code.
+ *  Each function value created with the executable holds a reference to the
+ *  code, so the code lives as long as any function running it.
+ *
+ *  @arg[FbleCode*][code] The code to interpret.
+ *  @returns[FbleExecutable]
+ *   An executable that runs the code using the interpreter.
+ *  @sideeffects None.
+ */
+static FbleExecutable Executable(FbleCode* code)
+{
+  FbleExecutable exe = {
+    .num_args = code->executable.num_args,
+    .num_statics = code->executable.num_statics,
+    .max_call_args = code->executable.max_call_args,
+    .run = &Interpret,
+    .data = code,
+    .on_free = &FreeCode
+  };
+  return exe;
+}
+
+/**
+ * @func[EncodedSize] Computes the number of words to encode an instruction.
+ *  @arg[FbleInstr*][instr] The instruction.
+ *  @returns[size_t]
+ *   The number of words needed to encode the instruction, including any
+ *   profile sample in front of it.
+ *  @sideeffects None.
+ */
+static size_t EncodedSize(FbleInstr* instr)
+{
+  size_t size = instr->profile_sample_count == 0 ? 0 : 2;
+  switch (instr->tag) {
+    case FBLE_STRUCT_VALUE_INSTR: return size + 3 + ((FbleStructValueInstr*)instr)->args.size;
+    case FBLE_UNION_VALUE_INSTR: return size + 5;
+    case FBLE_STRUCT_ACCESS_INSTR: return size + 5;
+    case FBLE_UNION_ACCESS_INSTR: return size + 5;
+    case FBLE_UNION_SELECT_INSTR: return size + 3 + 3 * ((FbleUnionSelectInstr*)instr)->num_tags;
+    case FBLE_GOTO_INSTR: return size + 2;
+    case FBLE_FUNC_VALUE_INSTR: return size + 5 + ((FbleFuncValueInstr*)instr)->scope.size;
+    case FBLE_CALL_INSTR: return size + 4 + ((FbleCallInstr*)instr)->args.size;
+    case FBLE_TAIL_CALL_INSTR: return size + 3 + ((FbleTailCallInstr*)instr)->args.size;
+    case FBLE_COPY_INSTR: return size + 3;
+    case FBLE_REC_DECL_INSTR: return size + 3;
+    case FBLE_REC_DEFN_INSTR: return size + 3;
+    case FBLE_RETURN_INSTR: return size + 2;
+    case FBLE_TYPE_INSTR: return size + 2;
+    case FBLE_LIST_INSTR: return size + 3 + ((FbleListInstr*)instr)->args.size;
+    case FBLE_LITERAL_INSTR: return size + 3;
+    case FBLE_FOREIGN_VALUE_INSTR: return size + 3;
+    case FBLE_NOP_INSTR: return size;
+  }
+
+  FbleUnreachable("should never get here");
+  return 0;
+}
+
+/**
+ * @func[NumLocs] Computes the number of locations of an instruction.
+ *  @arg[FbleInstr*][instr] The instruction.
+ *  @returns[size_t]
+ *   The number of locations the interpreter may report errors at for the
+ *   instruction.
+ *  @sideeffects None.
+ */
+static size_t NumLocs(FbleInstr* instr)
+{
+  switch (instr->tag) {
+    case FBLE_STRUCT_ACCESS_INSTR: return 1;
+    case FBLE_UNION_ACCESS_INSTR: return 1;
+    case FBLE_UNION_SELECT_INSTR: return 1;
+    case FBLE_CALL_INSTR: return 1;
+    case FBLE_TAIL_CALL_INSTR: return 1;
+    case FBLE_REC_DEFN_INSTR: return ((FbleRecDefnInstr*)instr)->locs.size;
+    default: return 0;
+  }
+}
+
+/**
+ * @func[Kept] Checks if an instruction is kept after encoding.
+ *  @arg[FbleInstr*][instr] The instruction.
+ *  @returns[bool]
+ *   True if the encoded instruction refers to the instruction itself.
+ *  @sideeffects None.
+ */
+static bool Kept(FbleInstr* instr)
+{
+  return instr->tag == FBLE_FUNC_VALUE_INSTR
+    || instr->tag == FBLE_LITERAL_INSTR
+    || instr->tag == FBLE_FOREIGN_VALUE_INSTR;
+}
+
+/**
+ * @func[SelectTarget] Finds the branch a union select takes for a tag.
+ *  @arg[FbleUnionSelectInstr*][select] The union select instruction.
+ *  @arg[size_t][tag] The tag of the condition.
+ *  @returns[size_t] The index of the instruction to branch to.
+ *  @sideeffects None.
+ */
+static size_t SelectTarget(FbleUnionSelectInstr* select, size_t tag)
+{
+  for (size_t i = 0; i < select->targets.size; ++i) {
+    if (select->targets.xs[i].tag == tag) {
+      return select->targets.xs[i].target;
+    }
+  }
+  return select->default_;
+}
+
+/**
+ * @func[BoundAccess] Checks for select-and-bind.
+ *  A union select whose branch starts by accessing the field of the
+ *  condition for that branch's tag can do the access itself, because the
+ *  tag is already known to match.
+ *
+ *  @arg[FbleCode*][code] The code the select is in.
+ *  @arg[FbleUnionSelectInstr*][select] The union select instruction.
+ *  @arg[size_t][tag] The tag of the branch.
+ *  @returns[FbleUnionAccessInstr*]
+ *   The union access at the start of the branch for the given tag, if the
+ *   select can do that access itself. NULL otherwise.
+ *  @sideeffects None.
+ */
+static FbleUnionAccessInstr* BoundAccess(FbleCode* code, FbleUnionSelectInstr* select, size_t tag)
+{
+  FbleInstr* instr = code->instrs.xs[SelectTarget(select, tag)];
+  if (instr->tag != FBLE_UNION_ACCESS_INSTR) {
+    return NULL;
+  }
+
+  FbleUnionAccessInstr* access = (FbleUnionAccessInstr*)instr;
+  if (access->obj.tag != select->condition.tag
+      || access->obj.index != select->condition.index
+      || access->tagwidth != select->tagwidth
+      || access->tag != tag) {
+    return NULL;
+  }
+  return access;
+}
+
+/**
+ * @func[BranchTargets] Finds the instructions that can be branched to.
+ *  @arg[FbleCode*][code] The code to find branch targets in.
+ *  @returns[bool*]
+ *   An array with an entry per instruction, true if something may branch to
+ *   that instruction other than the instruction before it.
+ *  @sideeffects
+ *   Allocates an array that should be freed with FbleFree when no longer
+ *   needed.
+ */
+static bool* BranchTargets(FbleCode* code)
+{
+  bool* targets = FbleAllocArray(bool, code->instrs.size);
+  memset(targets, 0, code->instrs.size * sizeof(bool));
+  for (size_t i = 0; i < code->instrs.size; ++i) {
+    FbleInstr* instr = code->instrs.xs[i];
+    if (instr->tag == FBLE_GOTO_INSTR) {
+      targets[((FbleGotoInstr*)instr)->target] = true;
+    } else if (instr->tag == FBLE_UNION_SELECT_INSTR) {
+      FbleUnionSelectInstr* select = (FbleUnionSelectInstr*)instr;
+      for (size_t tag = 0; tag < select->num_tags; ++tag) {
+        size_t target = SelectTarget(select, tag);
+        targets[target] = true;
+        if (BoundAccess(code, select, tag) != NULL) {
+          // Select-and-bind branches past the access.
+          assert(target + 1 < code->instrs.size);
+          targets[target + 1] = true;
+        }
+      }
+    }
+  }
+  return targets;
+}
+
+/**
+ * @func[AccessRun] Finds a run of struct accesses to fuse.
+ *  @arg[FbleCode*][code] The code.
+ *  @arg[bool*][targets] The branch targets of the code.
+ *  @arg[size_t][i] The index of the first instruction of the run.
+ *  @returns[size_t]
+ *   The number of instructions starting at i to encode together as a single
+ *   STRUCT_ACCESSES_OP. 1 if there is nothing to fuse.
+ *  @sideeffects None.
+ */
+static size_t AccessRun(FbleCode* code, bool* targets, size_t i)
 {
-  size_t num_statics = function->executable.num_statics;
-  FbleCode* code = (FbleCode*)FbleNativeValueData(function->statics[num_statics - 1]);
   FbleInstr** instrs = code->instrs.xs;
-  FbleValue* locals[code->num_locals];
+  if (instrs[i]->tag != FBLE_STRUCT_ACCESS_INSTR) {
+    return 1;
+  }
 
-  FbleValue** vars[3];
-  vars[FBLE_STATIC_VAR] = function->statics;
-  vars[FBLE_ARG_VAR] = args;
-  vars[FBLE_LOCAL_VAR] = locals;
+  size_t n = 1;
+  while (i + n < code->instrs.size
+      && instrs[i + n]->tag == FBLE_STRUCT_ACCESS_INSTR
+      && instrs[i + n]->profile_sample_count == 0
+      && !targets[i + n]) {
+    n++;
+  }
+  return n;
+}
+
+/**
+ * @func[Handler] Encodes the handler word for an instruction.
+ *  @arg[const void**][labels]
+ *   Handler addresses indexed by tag with threaded dispatch. NULL otherwise.
+ *  @arg[size_t][tag] The FbleInstrTag or pseudo instruction tag to encode.
+ *  @returns[Word] The handler word.
+ *  @sideeffects None.
+ */
+static Word Handler(const void** labels, size_t tag)
+{
+  Word w;
+  if (labels == NULL) {
+    w.u = tag;
+  } else {
+    w.label = labels[tag];
+  }
+  return w;
+}
+
+/**
+ * @func[Var] Encodes a variable operand.
+ *  @arg[FbleVar][var] The variable to encode.
+ *  @returns[Word] The encoded variable.
+ *  @sideeffects None.
+ */
+static Word Var(FbleVar var)
+{
+  Word w = { .u = (var.index << 2) | var.tag };
+  return w;
+}
+
+/**
+ * @func[EncodeVars] Encodes a count followed by a list of variables.
+ *  @arg[Word*][w] Where to encode the variables.
+ *  @arg[FbleVarV][vars] The variables to encode.
+ *  @returns[Word*] The word after the encoded variables.
+ *  @sideeffects Writes 1 + vars.size words to w.
+ */
+static Word* EncodeVars(Word* w, FbleVarV vars)
+{
+  (w++)->u = vars.size;
+  for (size_t i = 0; i < vars.size; ++i) {
+    *w++ = Var(vars.xs[i]);
+  }
+  return w;
+}
+
+/**
+ * @func[Encode] Encodes a block of code as flat bytecode.
+ *  Fuses common instruction sequences into superinstructions along the way:
+ *  runs of struct accesses, and union selects whose branches start by
+ *  accessing the condition's field for the branch's tag.
+ *
+ *  @arg[FbleCode*][code] The code to encode.
+ *  @arg[const void**][labels]
+ *   Handler addresses indexed by tag with threaded dispatch. NULL otherwise.
+ *  @returns[Program*] The encoded program for the code.
+ *  @sideeffects
+ *   @i Sets code->decoded and code->free_decoded.
+ *   @item
+ *    Frees code->instrs, except for instructions the program keeps. Must be
+ *    called with gEncodeLock held.
+ */
+static Program* Encode(FbleCode* code, const void** labels)
+{
+  size_t num_instrs = code->instrs.size;
+  FbleInstr** instrs = code->instrs.xs;
+  bool* targets = BranchTargets(code);
+
+  // Lay out the encoded instructions. Instructions fused into a run share
+  // the start of the run.
+  size_t* starts = FbleAllocArray(size_t, num_instrs);
+  size_t* runs = FbleAllocArray(size_t, num_instrs);
+  size_t num_words = 0;
+  size_t num_kept = 0;
+  size_t num_locs = 0;
+  size_t num_funcs = 0;
+  size_t max_args = 0;
+  for (size_t i = 0; i < num_instrs; i += runs[i]) {
+    runs[i] = AccessRun(code, targets, i);
+    for (size_t k = 0; k < runs[i]; ++k) {
+      starts[i + k] = num_words;
+    }
 
-  FbleBlockId profile_block_id = function->profile_block_id;
+    if (runs[i] > 1) {
+      num_words += (instrs[i]->profile_sample_count == 0 ? 0 : 2) + 2 + 4 * runs[i];
+    } else {
+      num_words += EncodedSize(instrs[i]);
+    }
+
+    num_locs += runs[i] > 1 ? runs[i] : NumLocs(instrs[i]);
 
-  size_t pc = 0;
-  while (true) {
-    FbleInstr* instr = instrs[pc];
+    if (Kept(instrs[i])) {
+      num_kept++;
+    }
 
-    if (profile && instr->profile_sample_count != 0) {
-      FbleProfileSample(profile, instr->profile_sample_count);
+    if (instrs[i]->tag == FBLE_FUNC_VALUE_INSTR) {
+      num_funcs++;
+    }
+
+    size_t argc = 0;
+    switch (instrs[i]->tag) {
+      case FBLE_STRUCT_VALUE_INSTR: argc = ((FbleStructValueInstr*)instrs[i])->args.size; break;
+      case FBLE_CALL_INSTR: argc = ((FbleCallInstr*)instrs[i])->args.size; break;
+      case FBLE_LIST_INSTR: argc = ((FbleListInstr*)instrs[i])->args.size; break;
+      default: break;
+    }
+    if (argc > max_args) {
+      max_args = argc;
+    }
+  }
+
+  Program* program = FbleAllocRaw(sizeof(Program)
+      + num_kept * sizeof(FbleInstr*)
+      + num_funcs * sizeof(FbleExecutable)
+      + num_locs * (sizeof(size_t) + sizeof(FbleLoc))
+      + num_words * sizeof(Word));
+  program->num_kept = num_kept;
+  program->kept = (FbleInstr**)(program + 1);
+  program->executables = (FbleExecutable*)(program->kept + num_kept);
+  program->max_args = max_args;
+  program->num_locs = num_locs;
+  program->offsets = (size_t*)(program->executables + num_funcs);
+  program->locs = (FbleLoc*)(program->offsets + num_locs);
+  program->words = (Word*)(program->locs + num_locs);
+
+  Word* words = program->words;
+  Word* w = words;
+  size_t locs = 0;
+  FbleExecutable* exe = program->executables;
+  for (size_t i = 0; i < num_instrs; i += runs[i]) {
+    FbleInstr* instr = instrs[i];
+    assert(w == words + starts[i]);
+
+    if (instr->profile_sample_count != 0) {
+      *w++ = Handler(labels, PROFILE_SAMPLE_OP);
+      (w++)->u = instr->profile_sample_count;
+    }
+
+    if (runs[i] > 1) {
+      for (size_t k = 0; k < runs[i]; ++k) {
+        FbleStructAccessInstr* access_instr = (FbleStructAccessInstr*)instrs[i + k];
+        program->offsets[locs] = w - words;
+        program->locs[locs++] = FbleCopyLoc(access_instr->loc);
+      }
+
+      *w++ = Handler(labels, STRUCT_ACCESSES_OP);
+      (w++)->u = runs[i];
+      for (size_t k = 0; k < runs[i]; ++k) {
+        FbleStructAccessInstr* access_instr = (FbleStructAccessInstr*)instrs[i + k];
+        (w++)->u = access_instr->dest;
+        *w++ = Var(access_instr->obj);
+        (w++)->u = access_instr->fieldc;
+        (w++)->u = access_instr->field;
+      }
+      continue;
+    }
+
+    for (size_t k = 0; k < NumLocs(instr); ++k) {
+      program->offsets[locs + k] = w - words;
+    }
+
+    if (instr->tag != FBLE_NOP_INSTR) {
+      *w++ = Handler(labels, instr->tag);
     }
 
     switch (instr->tag) {
       case FBLE_STRUCT_VALUE_INSTR: {
         FbleStructValueInstr* struct_value_instr = (FbleStructValueInstr*)instr;
-        size_t argc = struct_value_instr->args.size;
-        FbleValue* struct_args[argc];
-        for (size_t i = 0; i < argc; ++i) {
-          struct_args[i] = GET(struct_value_instr->args.xs[i]);
-        }
-
-        locals[struct_value_instr->dest] = FbleNewStructValue(runtime, argc, struct_args);
-        pc++;
+        (w++)->u = struct_value_instr->dest;
+        w = EncodeVars(w, struct_value_instr->args);
         break;
       }
 
       case FBLE_UNION_VALUE_INSTR: {
         FbleUnionValueInstr* union_value_instr = (FbleUnionValueInstr*)instr;
-        size_t tagwidth = union_value_instr->tagwidth;
-        size_t tag = union_value_instr->tag;
-        FbleValue* arg = GET(union_value_instr->arg);
-        locals[union_value_instr->dest] = FbleNewUnionValue(runtime, tagwidth, tag, arg);
-        pc++;
+        (w++)->u = union_value_instr->dest;
+        (w++)->u = union_value_instr->tagwidth;
+        (w++)->u = union_value_instr->tag;
+        *w++ = Var(union_value_instr->arg);
         break;
       }
 
       case FBLE_STRUCT_ACCESS_INSTR: {
         FbleStructAccessInstr* access_instr = (FbleStructAccessInstr*)instr;
-
-        FbleValue* obj = GET(access_instr->obj);
-        locals[access_instr->dest] = FbleStructValueField(obj, access_instr->fieldc, access_instr->field);
-
-        if (locals[access_instr->dest] == NULL) {
-          return RuntimeError(runtime, access_instr->loc, profile_block_id, "undefined struct value access");
-        }
-
-        pc++;
+        program->locs[locs++] = FbleCopyLoc(access_instr->loc);
+        (w++)->u = access_instr->dest;
+        *w++ = Var(access_instr->obj);
+        (w++)->u = access_instr->fieldc;
+        (w++)->u = access_instr->field;
         break;
       }
 
       case FBLE_UNION_ACCESS_INSTR: {
         FbleUnionAccessInstr* access_instr = (FbleUnionAccessInstr*)instr;
-
-        FbleValue* obj = GET(access_instr->obj);
-        locals[access_instr->dest] = FbleUnionValueField(obj, access_instr->tagwidth, access_instr->tag);
-
-        if (locals[access_instr->dest] == NULL) {
-          return RuntimeError(runtime, access_instr->loc, profile_block_id, "undefined union value access");
-        }
-
-        if (locals[access_instr->dest] == FbleWrongUnionTag) {
-          locals[access_instr->dest] = NULL;
-          return RuntimeError(runtime, access_instr->loc, profile_block_id, "union field access undefined: wrong tag");
-        }
-
-        pc++;
+        program->locs[locs++] = FbleCopyLoc(access_instr->loc);
+        (w++)->u = access_instr->dest;
+        *w++ = Var(access_instr->obj);
+        (w++)->u = access_instr->tagwidth;
+        (w++)->u = access_instr->tag;
         break;
       }
 
       case FBLE_UNION_SELECT_INSTR: {
+        // The branches are a dense table indexed by tag. Each branch is the
+        // target, followed by the local to bind the field of the condition
+        // to plus one, or zero for no binding, followed by the profile
+        // sample count of the bound access.
         FbleUnionSelectInstr* select_instr = (FbleUnionSelectInstr*)instr;
-        FbleValue* obj = GET(select_instr->condition);
-        size_t tag = FbleUnionValueTag(obj, select_instr->tagwidth);
-
-        if (tag == (size_t)(-1)) {
-          return RuntimeError(runtime, select_instr->loc, profile_block_id, "undefined union value select");
-        }
-
-        // Binary search for the matching tag.
-        assert(select_instr->targets.size > 0);
-        size_t target = select_instr->default_;
-        size_t lo = 0;
-        size_t hi = select_instr->targets.size;
-        while (lo < hi) {
-          size_t mid = (lo + hi)/2;
-          size_t mid_tag = select_instr->targets.xs[mid].tag;
-          if (tag == mid_tag) {
-            target = select_instr->targets.xs[mid].target;
-            break;
-          }
-          if (tag < mid_tag) {
-            hi = mid;
+        program->locs[locs++] = FbleCopyLoc(select_instr->loc);
+        *w++ = Var(select_instr->condition);
+        (w++)->u = select_instr->tagwidth;
+        for (size_t tag = 0; tag < select_instr->num_tags; ++tag) {
+          size_t target = SelectTarget(select_instr, tag);
+          FbleUnionAccessInstr* access_instr = BoundAccess(code, select_instr, tag);
+          if (access_instr == NULL) {
+            (w++)->target = words + starts[target];
+            (w++)->u = 0;
+            (w++)->u = 0;
           } else {
-            lo = mid + 1;
+            (w++)->target = words + starts[target + 1];
+            (w++)->u = access_instr->dest + 1;
+            (w++)->u = access_instr->_base.profile_sample_count;
           }
         }
-
-        pc = target;
         break;
       }
 
       case FBLE_GOTO_INSTR: {
         FbleGotoInstr* goto_instr = (FbleGotoInstr*)instr;
-        pc = goto_instr->target;
+        (w++)->target = words + starts[goto_instr->target];
         break;
       }
 
       case FBLE_FUNC_VALUE_INSTR: {
         FbleFuncValueInstr* func_value_instr = (FbleFuncValueInstr*)instr;
-        FbleValue* func_statics[func_value_instr->scope.size];
-        for (size_t i = 0; i < func_value_instr->scope.size; ++i) {
-          func_statics[i] = GET(func_value_instr->scope.xs[i]);
-        }
-
-        locals[func_value_instr->dest] = FbleNewInterpretedFuncValue(runtime, func_value_instr->code, profile_block_id + func_value_instr->profile_block_offset, func_statics);
-        pc++;
+        *exe = Executable(func_value_instr->code);
+        (w++)->u = func_value_instr->dest;
+        (w++)->p = exe++;
+        (w++)->u = func_value_instr->profile_block_offset;
+        w = EncodeVars(w, func_value_instr->scope);
         break;
       }
 
       case FBLE_CALL_INSTR: {
         FbleCallInstr* call_instr = (FbleCallInstr*)instr;
-        FbleValue* func = GET(call_instr->func);
-        FbleValue* call_args[call_instr->args.size];
-        for (size_t i = 0; i < call_instr->args.size; ++i) {
-          call_args[i] = GET(call_instr->args.xs[i]);
-        }
-
-        locals[call_instr->dest] = FbleCall(runtime, profile, func, call_instr->args.size, call_args);
-        if (locals[call_instr->dest] == NULL) {
-          return RuntimeError(runtime, call_instr->loc, profile_block_id, NULL);
-        }
-
-        pc++;
+        program->locs[locs++] = FbleCopyLoc(call_instr->loc);
+        (w++)->u = call_instr->dest;
+        *w++ = Var(call_instr->func);
+        w = EncodeVars(w, call_instr->args);
         break;
       }
 
       case FBLE_TAIL_CALL_INSTR: {
         FbleTailCallInstr* call_instr = (FbleTailCallInstr*)instr;
-        FbleValue* func = GET(call_instr->func);
-        if (func == NULL || ((uintptr_t)func & 0x3) == 0x2) {
-          return RuntimeError(runtime, call_instr->loc, profile_block_id, "called undefined function");
-        };
-
-        runtime->tail_call_argc = call_instr->args.size;
-        runtime->tail_call_buffer[0] = func;
-        for (size_t i = 0; i < call_instr->args.size; ++i) {
-          runtime->tail_call_buffer[i+1] = GET(call_instr->args.xs[i]);
-        }
-
-        return runtime->tail_call_sentinel;
+        program->locs[locs++] = FbleCopyLoc(call_instr->loc);
+        *w++ = Var(call_instr->func);
+        w = EncodeVars(w, call_instr->args);
+        break;
       }
 
       case FBLE_COPY_INSTR: {
         FbleCopyInstr* copy_instr = (FbleCopyInstr*)instr;
-        locals[copy_instr->dest] = GET(copy_instr->source);
-        pc++;
+        (w++)->u = copy_instr->dest;
+        *w++ = Var(copy_instr->source);
         break;
       }
 
       case FBLE_REC_DECL_INSTR: {
         FbleRecDeclInstr* decl_instr = (FbleRecDeclInstr*)instr;
-        locals[decl_instr->dest] = FbleDeclareRecursiveValues(runtime, decl_instr->n);
-        pc++;
+        (w++)->u = decl_instr->dest;
+        (w++)->u = decl_instr->n;
         break;
       }
 
       case FBLE_REC_DEFN_INSTR: {
         FbleRecDefnInstr* defn_instr = (FbleRecDefnInstr*)instr;
-        FbleValue* decl = locals[defn_instr->decl];
-        FbleValue* defn = locals[defn_instr->defn];
-        size_t r = FbleDefineRecursiveValues(runtime, decl, defn);
-
-        if (r != 0) {
-          return RuntimeError(runtime, defn_instr->locs.xs[r-1], profile_block_id, "vacuous value");
+        for (size_t k = 0; k < defn_instr->locs.size; ++k) {
+          program->locs[locs++] = FbleCopyLoc(defn_instr->locs.xs[k]);
         }
-
-        pc++;
+        (w++)->u = defn_instr->decl;
+        (w++)->u = defn_instr->defn;
         break;
       }
 
       case FBLE_RETURN_INSTR: {
         FbleReturnInstr* return_instr = (FbleReturnInstr*)instr;
-        return GET(return_instr->result);
+        *w++ = Var(return_instr->result);
+        break;
       }
 
       case FBLE_TYPE_INSTR: {
         FbleTypeInstr* type_instr = (FbleTypeInstr*)instr;
-        locals[type_instr->dest] = FbleGenericTypeValue;
-        pc++;
+        (w++)->u = type_instr->dest;
         break;
       }
 
       case FBLE_LIST_INSTR: {
         FbleListInstr* list_instr = (FbleListInstr*)instr;
-        size_t argc = list_instr->args.size;
-        FbleValue* list_args[argc];
-        for (size_t i = 0; i < argc; ++i) {
-          list_args[i] = GET(list_instr->args.xs[i]);
-        }
-
-        locals[list_instr->dest] = FbleNewListValue(runtime, argc, list_args);
-        pc++;
+        (w++)->u = list_instr->dest;
+        w = EncodeVars(w, list_instr->args);
         break;
       }
 
       case FBLE_LITERAL_INSTR: {
         FbleLiteralInstr* literal_instr = (FbleLiteralInstr*)instr;
-        locals[literal_instr->dest] = FbleNewLiteralValue(runtime, literal_instr->literal.size, literal_instr->literal.data);
-        pc++;
+        (w++)->u = literal_instr->dest;
+        (w++)->p = literal_instr;
         break;
       }
 
       case FBLE_FOREIGN_VALUE_INSTR: {
         FbleForeignValueInstr* foreign_instr = (FbleForeignValueInstr*)instr;
-        FbleForeign* foreign = FbleLookupForeignValue(runtime, foreign_instr->path, foreign_instr->name.name->str);
-        if (foreign == NULL) {
-          return RuntimeError(runtime, foreign_instr->name.loc, profile_block_id, "foreign value not found");
-        }
-
-        FbleValue* value = FbleNewForeignValue(runtime, profile, foreign, profile_block_id + foreign_instr->profile_block_offset);
-        locals[foreign_instr->dest] = value;
-        pc++;
+        (w++)->u = foreign_instr->dest;
+        (w++)->p = foreign_instr;
         break;
       }
 
       case FBLE_NOP_INSTR: {
-        pc++;
+        // Nothing to do beyond the profile sample.
         break;
       }
     }
   }
+  assert(w == words + num_words);
+  assert(locs == num_locs);
+  assert(exe == program->executables + num_funcs);
+  FbleFree(targets);
+  FbleFree(starts);
+  FbleFree(runs);
+
+  // The program has everything it needs from the instructions now, other
+  // than the ones it refers to directly.
+  size_t kept = 0;
+  for (size_t i = 0; i < num_instrs; ++i) {
+    if (Kept(instrs[i])) {
+      FbleFreeDebugInfo(instrs[i]->debug_info);
+      instrs[i]->debug_info = NULL;
+      program->kept[kept++] = instrs[i];
+    } else {
+      FbleFreeInstr(instrs[i]);
+    }
+  }
+  assert(kept == num_kept);
+  FbleFreeVector(code->instrs);
+  FbleInitVector(code->instrs);
+
+  code->free_decoded = &FreeProgram;
+  __atomic_store_n(&code->decoded, program, __ATOMIC_RELEASE);
+  return program;
 }
 
-// See documentation in interpret.h
-FbleValue* FbleNewInterpretedFuncValue(FbleRuntime* runtime, FbleCode* code, size_t profile_block_id, FbleValue** statics)
+/**
+ * @func[Loc] Finds a location of the instruction encoded at a given pc.
+ *  @arg[Program*][program] The program.
+ *  @arg[Word*][pc] The handler word of an encoded instruction.
+ *  @arg[size_t][k]
+ *   Which of the instruction's locations to get: the fused access for a
+ *   run of struct accesses, the value for a recursive definition, 0
+ *   otherwise.
+ *  @returns[FbleLoc] The location. Borrowed from the program.
+ *  @sideeffects None.
+ */
+static FbleLoc Loc(Program* program, Word* pc, size_t k)
 {
-  // Add an extra static to store the FbleCode for access in the interpreter.
-  FbleExecutable exe = {
-    .num_args = code->executable.num_args,
-    .num_statics = code->executable.num_statics + 1,
-    .max_call_args = code->executable.max_call_args,
-    .run = &Interpret
+  size_t offset = pc - program->words;
+  size_t lo = 0;
+  size_t hi = program->num_locs;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (program->offsets[mid] < offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  assert(lo + k < program->num_locs && program->offsets[lo + k] == offset);
+  return program->locs[lo + k];
+}
+
+/**
+ * @func[Activate] Allocates an activation for an interpreted call.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[const void**][labels]
+ *   Handler addresses indexed by tag with threaded dispatch. NULL otherwise.
+ *  @arg[Activation*][caller]
+ *   The activation to return to, or NULL to return from Interpret.
+ *  @arg[FbleFunction*][function] The interpreted function to run.
+ *  @arg[FbleValue**][args]
+ *   The args to the function, or NULL to reserve space for the args in the
+ *   activation for the caller to fill in.
+ *  @returns[Activation*] The new activation.
+ *  @sideeffects
+ *   @i Encodes the code for the function if it is not already encoded.
+ *   @item
+ *    Allocates registers for the activation that should be freed with
+ *    FbleFreeRegisters when the activation returns.
+ */
+static Activation* Activate(FbleRuntime* runtime, const void** labels, Activation* caller, FbleFunction* function, FbleValue** args)
+{
+  FbleCode* code = (FbleCode*)function->executable.data;
+  Program* program = (Program*)__atomic_load_n(&code->decoded, __ATOMIC_ACQUIRE);
+  if (program == NULL) {
+    // The code may be shared by threads. Whichever thread gets here first
+    // encodes it.
+    pthread_mutex_lock(&gEncodeLock);
+    program = (Program*)__atomic_load_n(&code->decoded, __ATOMIC_ACQUIRE);
+    if (program == NULL) {
+      program = Encode(code, labels);
+    }
+    pthread_mutex_unlock(&gEncodeLock);
+  }
+
+  size_t slots = code->num_locals + program->max_args
+    + (args == NULL ? function->executable.num_args : 0);
+  Activation* activation = FbleAllocRegisters(runtime, sizeof(Activation) + slots * sizeof(FbleValue*));
+  activation->caller = caller;
+  activation->program = program;
+  activation->function = function;
+  activation->scratch = activation->locals + code->num_locals;
+  activation->args = (args == NULL) ? activation->scratch + program->max_args : args;
+  activation->pc = NULL;
+  return activation;
+}
+
+#ifdef FBLE_THREADED_DISPATCH
+#define CASE(tag) L_##tag
+#define DISPATCH() __extension__ ({ goto *pc->label; })
+#else
+#define CASE(tag) case tag
+#define DISPATCH() goto dispatch
+#endif
+
+/**
+ * @func[NEXT] Continues execution at the given instruction.
+ *  @arg[Word*][next] The next instruction to execute.
+ *  @sideeffects
+ *   Dispatches to the handler for the next instruction.
+ */
+#define NEXT(next) { pc = (next); DISPATCH(); }
+
+/**
+ * @func[RESTORE] Switches to running the given activation.
+ *  @arg[Activation*][a] The activation to run.
+ *  @sideeffects
+ *   Sets the activation, program, locals, vars and profile_block_id local
+ *   variables of Interpret. Does not change pc.
+ */
+#define RESTORE(a) { \
+  activation = (a); \
+  program = activation->program; \
+  locals = activation->locals; \
+  vars[FBLE_STATIC_VAR] = activation->function->statics; \
+  vars[FBLE_ARG_VAR] = activation->args; \
+  vars[FBLE_LOCAL_VAR] = locals; \
+  profile_block_id = activation->function->profile_block_id; \
+}
+
+/**
+ * @func[RETURN] Returns from the current activation.
+ *  @arg[FbleValue*][value] The value to return, or NULL in case of error.
+ *  @sideeffects
+ *   Returns the value to the caller of the activation.
+ */
+#define RETURN(value) { result = (value); goto unwind; }
+
+// FbleRunFunction for running interpreted code.
+// See documentation for FbleRunFunction in fble-function.h.
+static FbleValue* Interpret(
+    FbleRuntime* runtime,
+    FbleProfileThread* profile,
+    FbleFunction* function,
+    FbleValue** args)
+{
+#ifdef FBLE_THREADED_DISPATCH
+  static const void* labels[] = {
+    [FBLE_STRUCT_VALUE_INSTR] = __extension__ &&L_FBLE_STRUCT_VALUE_INSTR,
+    [FBLE_UNION_VALUE_INSTR] = __extension__ &&L_FBLE_UNION_VALUE_INSTR,
+    [FBLE_STRUCT_ACCESS_INSTR] = __extension__ &&L_FBLE_STRUCT_ACCESS_INSTR,
+    [FBLE_UNION_ACCESS_INSTR] = __extension__ &&L_FBLE_UNION_ACCESS_INSTR,
+    [FBLE_UNION_SELECT_INSTR] = __extension__ &&L_FBLE_UNION_SELECT_INSTR,
+    [FBLE_GOTO_INSTR] = __extension__ &&L_FBLE_GOTO_INSTR,
+    [FBLE_FUNC_VALUE_INSTR] = __extension__ &&L_FBLE_FUNC_VALUE_INSTR,
+    [FBLE_CALL_INSTR] = __extension__ &&L_FBLE_CALL_INSTR,
+    [FBLE_TAIL_CALL_INSTR] = __extension__ &&L_FBLE_TAIL_CALL_INSTR,
+    [FBLE_COPY_INSTR] = __extension__ &&L_FBLE_COPY_INSTR,
+    [FBLE_REC_DECL_INSTR] = __extension__ &&L_FBLE_REC_DECL_INSTR,
+    [FBLE_REC_DEFN_INSTR] = __extension__ &&L_FBLE_REC_DEFN_INSTR,
+    [FBLE_RETURN_INSTR] = __extension__ &&L_FBLE_RETURN_INSTR,
+    [FBLE_TYPE_INSTR] = __extension__ &&L_FBLE_TYPE_INSTR,
+    [FBLE_LIST_INSTR] = __extension__ &&L_FBLE_LIST_INSTR,
+    [FBLE_LITERAL_INSTR] = __extension__ &&L_FBLE_LITERAL_INSTR,
+    [FBLE_FOREIGN_VALUE_INSTR] = __extension__ &&L_FBLE_FOREIGN_VALUE_INSTR,
+    [FBLE_NOP_INSTR] = NULL,
+    [PROFILE_SAMPLE_OP] = __extension__ &&L_PROFILE_SAMPLE_OP,
+    [STRUCT_ACCESSES_OP] = __extension__ &&L_STRUCT_ACCESSES_OP,
   };
-  FbleValue* nstatics[exe.num_statics];
-  memcpy(nstatics, statics, code->executable.num_statics * sizeof(FbleValue*));
+#else
+  static const void** labels = NULL;
+#endif
+
+  Activation* activation;
+  Program* program;
+  FbleValue** locals;
+  FbleValue** vars[3];
+  FbleBlockId profile_block_id;
+  FbleValue* result = NULL;
+
+  RESTORE(Activate(runtime, labels, NULL, function, args));
+  Word* pc = program->words;
+
+#ifdef FBLE_THREADED_DISPATCH
+  DISPATCH();
+#else
+dispatch:
+  switch (pc->u) {
+#endif
+      CASE(PROFILE_SAMPLE_OP): {
+        if (profile) {
+          FbleProfileSample(profile, pc[1].u);
+        }
+        NEXT(pc + 2);
+      }
+
+      CASE(FBLE_STRUCT_VALUE_INSTR): {
+        size_t argc = pc[2].u;
+        FbleValue** struct_args = activation->scratch;
+        for (size_t i = 0; i < argc; ++i) {
+          struct_args[i] = GET(pc[3 + i]);
+        }
+
+        locals[pc[1].u] = FbleNewStructValue(runtime, argc, struct_args);
+        NEXT(pc + 3 + argc);
+      }
+
+      CASE(FBLE_UNION_VALUE_INSTR): {
+        locals[pc[1].u] = FbleNewUnionValue(runtime, pc[2].u, pc[3].u, GET(pc[4]));
+        NEXT(pc + 5);
+      }
+
+      CASE(FBLE_STRUCT_ACCESS_INSTR): {
+        FbleValue* obj = GET(pc[2]);
+        FbleValue* value = FbleStructValueField(obj, pc[3].u, pc[4].u);
+        locals[pc[1].u] = value;
+
+        if (value == NULL) {
+          RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, "undefined struct value access"));
+        }
+
+        NEXT(pc + 5);
+      }
+
+      CASE(STRUCT_ACCESSES_OP): {
+        size_t n = pc[1].u;
+        Word* access = pc + 2;
+        for (size_t k = 0; k < n; ++k, access += 4) {
+          FbleValue* obj = GET(access[1]);
+          FbleValue* value = FbleStructValueField(obj, access[2].u, access[3].u);
+          locals[access[0].u] = value;
+
+          if (value == NULL) {
+            RETURN(RuntimeError(runtime, Loc(program, pc, k), profile_block_id, "undefined struct value access"));
+          }
+        }
+
+        NEXT(access);
+      }
+
+      CASE(FBLE_UNION_ACCESS_INSTR): {
+        FbleValue* obj = GET(pc[2]);
+        FbleValue* value = FbleUnionValueField(obj, pc[3].u, pc[4].u);
+        locals[pc[1].u] = value;
+
+        if (value == NULL) {
+          RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, "undefined union value access"));
+        }
+
+        if (value == FbleWrongUnionTag) {
+          locals[pc[1].u] = NULL;
+          RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, "union field access undefined: wrong tag"));
+        }
+
+        NEXT(pc + 5);
+      }
 
-  code->refcount++;
-  FbleValue* vcode = FbleNewNativeValue(runtime, code, &FreeCode);
-  nstatics[exe.num_statics - 1 ] = vcode;
+      CASE(FBLE_UNION_SELECT_INSTR): {
+        FbleValue* obj = GET(pc[1]);
+        size_t tagwidth = pc[2].u;
+        size_t tag = FbleUnionValueTag(obj, tagwidth);
 
-  return FbleNewFuncValue(runtime, &exe, profile_block_id, nstatics);
+        if (tag == (size_t)(-1)) {
+          RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, "undefined union value select"));
+        }
+
+        Word* branch = pc + 3 + 3 * tag;
+        if (branch[1].u != 0) {
+          if (profile && branch[2].u != 0) {
+            FbleProfileSample(profile, branch[2].u);
+          }
+          locals[branch[1].u - 1] = FbleUnionValueField(obj, tagwidth, tag);
+        }
+
+        NEXT(branch[0].target);
+      }
+
+      CASE(FBLE_GOTO_INSTR): {
+        NEXT(pc[1].target);
+      }
+
+      CASE(FBLE_FUNC_VALUE_INSTR): {
+        FbleExecutable* exe = (FbleExecutable*)pc[2].p;
+        size_t argc = pc[4].u;
+        FbleValue* func_statics[argc];
+        for (size_t i = 0; i < argc; ++i) {
+          func_statics[i] = GET(pc[5 + i]);
+        }
+
+        FbleCode* code = (FbleCode*)exe->data;
+        __atomic_add_fetch(&code->refcount, 1, __ATOMIC_RELAXED);
+        locals[pc[1].u] = FbleNewFuncValue(runtime, exe, profile_block_id + pc[3].u, func_statics);
+        NEXT(pc + 5 + argc);
+      }
+
+      CASE(FBLE_CALL_INSTR): {
+        FbleValue* func = GET(pc[2]);
+        size_t argc = pc[3].u;
+        FbleFunction* callee = FbleFuncValueFunction(func);
+        if (callee != NULL
+            && callee->executable.run == &Interpret
+            && callee->executable.num_args == argc) {
+          // Run the call in place, passing the args directly in the
+          // callee's activation.
+          if (profile) {
+            FbleProfileEnterBlock(profile, callee->profile_block_id);
+          }
+
+          FbleEnterCallFrame(runtime);
+          activation->pc = pc;
+          Activation* next = Activate(runtime, labels, activation, callee, NULL);
+          for (size_t i = 0; i < argc; ++i) {
+            next->args[i] = GET(pc[4 + i]);
+          }
+
+          RESTORE(next);
+          NEXT(program->words);
+        }
+
+        FbleValue** call_args = activation->scratch;
+        for (size_t i = 0; i < argc; ++i) {
+          call_args[i] = GET(pc[4 + i]);
+        }
+
+        // A defined callee taking exactly argc args needs none of FbleCall's
+        // partial application or unused args handling. Without profiling
+        // there's no profile block to enter either.
+        FbleValue* value = NULL;
+        if (profile == NULL && callee != NULL
+            && callee->executable.num_args == argc) {
+          value = FbleCallExact(runtime, callee, call_args);
+        } else {
+          value = FbleCall(runtime, profile, func, argc, call_args);
+        }
+
+        locals[pc[1].u] = value;
+        if (value == NULL) {
+          RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, NULL));
+        }
+
+        NEXT(pc + 4 + argc);
+      }
+
+      CASE(FBLE_TAIL_CALL_INSTR): {
+        FbleValue* func = GET(pc[1]);
+        if (func == NULL || ((uintptr_t)func & 0x3) == 0x2) {
+          RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, "called undefined function"));
+        }
+
+        size_t argc = pc[2].u;
+        runtime->tail_call_argc = argc;
+        runtime->tail_call_buffer[0] = func;
+        for (size_t i = 0; i < argc; ++i) {
+          runtime->tail_call_buffer[i+1] = GET(pc[3 + i]);
+        }
+
+        if (activation->caller == NULL) {
+          // Let our caller run the tail call.
+          FbleFreeRegisters(runtime, activation);
+          return runtime->tail_call_sentinel;
+        }
+
+        FbleFunction* callee = FbleFuncValueFunction(func);
+        if (callee != NULL
+            && callee->executable.run == &Interpret
+            && callee->executable.num_args == argc) {
+          // Run the tail call in place, reusing the frame and registers of
+          // the current activation.
+          if (profile) {
+            FbleProfileReplaceBlock(profile, callee->profile_block_id);
+          }
+
+          Activation* caller = activation->caller;
+          FbleFreeRegisters(runtime, activation);
+          FbleTailCallFrame(runtime);
+          callee = FbleFuncValueFunction(runtime->tail_call_buffer[0]);
+          Activation* next = Activate(runtime, labels, caller, callee, NULL);
+          memcpy(next->args, runtime->tail_call_buffer + 1, argc * sizeof(FbleValue*));
+
+          RESTORE(next);
+          NEXT(program->words);
+        }
+
+        Activation* caller = activation->caller;
+        FbleFreeRegisters(runtime, activation);
+        activation = caller;
+        result = FbleFinishTailCall(runtime, profile);
+        goto resume;
+      }
+
+      CASE(FBLE_COPY_INSTR): {
+        locals[pc[1].u] = GET(pc[2]);
+        NEXT(pc + 3);
+      }
+
+      CASE(FBLE_REC_DECL_INSTR): {
+        locals[pc[1].u] = FbleDeclareRecursiveValues(runtime, pc[2].u);
+        NEXT(pc + 3);
+      }
+
+      CASE(FBLE_REC_DEFN_INSTR): {
+        FbleValue* decl = locals[pc[1].u];
+        FbleValue* defn = locals[pc[2].u];
+        size_t r = FbleDefineRecursiveValues(runtime, decl, defn);
+
+        if (r != 0) {
+          RETURN(RuntimeError(runtime, Loc(program, pc, r - 1), profile_block_id, "vacuous value"));
+        }
+
+        NEXT(pc + 3);
+      }
+
+      CASE(FBLE_RETURN_INSTR): {
+        RETURN(GET(pc[1]));
+      }
+
+      CASE(FBLE_TYPE_INSTR): {
+        locals[pc[1].u] = FbleGenericTypeValue;
+        NEXT(pc + 2);
+      }
+
+      CASE(FBLE_LIST_INSTR): {
+        size_t argc = pc[2].u;
+        FbleValue** list_args = activation->scratch;
+        for (size_t i = 0; i < argc; ++i) {
+          list_args[i] = GET(pc[3 + i]);
+        }
+
+        locals[pc[1].u] = FbleNewListValue(runtime, argc, list_args);
+        NEXT(pc + 3 + argc);
+      }
+
+      CASE(FBLE_LITERAL_INSTR): {
+        FbleLiteralInstr* literal_instr = (FbleLiteralInstr*)pc[2].p;
+        locals[pc[1].u] = FbleNewLiteralValue(runtime, &literal_instr->id, literal_instr->literal.size, literal_instr->literal.data);
+        NEXT(pc + 3);
+      }
+
+      CASE(FBLE_FOREIGN_VALUE_INSTR): {
+        FbleForeignValueInstr* foreign_instr = (FbleForeignValueInstr*)pc[2].p;
+        // The code may be running on more than one thread at a time.
+        FbleForeign* foreign = __atomic_load_n(&foreign_instr->foreign, __ATOMIC_RELAXED);
+        if (foreign == NULL) {
+          foreign = FbleLookupForeignValue(runtime, foreign_instr->path, foreign_instr->name.name->str);
+          if (foreign == NULL) {
+            RETURN(RuntimeError(runtime, foreign_instr->name.loc, profile_block_id, "foreign value not found"));
+          }
+          __atomic_store_n(&foreign_instr->foreign, foreign, __ATOMIC_RELAXED);
+        }
+
+        FbleValue* value = FbleNewForeignValue(runtime, profile, foreign, profile_block_id + foreign_instr->profile_block_offset);
+        locals[pc[1].u] = value;
+        NEXT(pc + 3);
+      }
+#ifndef FBLE_THREADED_DISPATCH
+  }
+#endif
+
+unwind:
+  // Return result from the current activation.
+  {
+    Activation* caller = activation->caller;
+    FbleFreeRegisters(runtime, activation);
+    if (caller == NULL) {
+      return result;
+    }
+
+    result = FblePopFrame(runtime, result);
+    activation = caller;
+  }
+
+resume:
+  // Resume the activation after the call it was waiting on returned result
+  // and popped its frame.
+  if (profile) {
+    FbleProfileExitBlock(profile);
+  }
+
+  RESTORE(activation);
+  pc = activation->pc;
+  locals[pc[1].u] = result;
+  if (result == NULL) {
+    RETURN(RuntimeError(runtime, Loc(program, pc, 0), profile_block_id, NULL));
+  }
+
+  NEXT(pc + 4 + pc[3].u);
+}
+
+// See documentation in interpret.h
+FbleValue* FbleNewInterpretedFuncValue(FbleRuntime* runtime, FbleCode* code, size_t profile_block_id, FbleValue** statics)
+{
+  // The function value owns a reference to the code, released by the
+  // executable's on_free when the function value is freed.
+  __atomic_add_fetch(&code->refcount, 1, __ATOMIC_RELAXED);
+  FbleExecutable exe = Executable(code);
+  return FbleNewFuncValue(runtime, &exe, profile_block_id, statics);
 }
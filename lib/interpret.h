@@ -26,7 +26,10 @@
  *   A newly allocated function value.
  *
  *  @sideeffects
- *   Allocates a new function value on the runtime stack.
+ *   @i Allocates a new function value on the heap.
+ *   @item
+ *    Keeps the code alive until the function value is freed. Functions it
+ *    creates keep their own code alive the same way.
  */
 FbleValue* FbleNewInterpretedFuncValue(FbleRuntime* runtime, FbleCode* code, size_t profile_block_id, FbleValue** statics);
 
@@ -6,17 +6,97 @@
 #include <fble/fble-link.h>
 
 #include <assert.h>     // for assert
+#include <pthread.h>    // for pthread_create, pthread_mutex_lock, etc.
 #include <string.h>     // for strrchr
 
-#include <fble/fble-alloc.h>   // for FbleAlloc, etc.
-#include <fble/fble-vector.h>  // for FbleInitVector, etc.
+#include <fble/fble-alloc.h>     // for FbleAlloc, etc.
+#include <fble/fble-function.h>  // for FbleExecutable, FbleCall, etc.
+#include <fble/fble-vector.h>    // for FbleInitVector, etc.
 
 #include "code.h"       // for FbleCode
 #include "interpret.h"  // for FbleNewInterpretedFuncValue
 #include "program.h"    // for FbleModuleMap
+#include "runtime.h"    // for FbleNewWorkerRuntime, etc.
+
+// Stack size for threads evaluating modules in parallel. Module values are
+// computed by fble code that recurses on the C stack, so be generous.
+#define LINK_THREAD_STACK_SIZE (256 * 1024 * 1024)
+
+/**
+ * @struct[LinkPlan] How to compute the modules of a program in parallel.
+ *  @field[size_t][threads] The number of threads to use.
+ *  @field[FbleCode*][code]
+ *   The code for linking the program sequentially. Instruction i is the
+ *   call that computes the value of module i, which is the function in
+ *   static variable i applied to the values of other modules. The last
+ *   module is the main program module.
+ */
+typedef struct {
+  size_t threads;
+  FbleCode* code;
+} LinkPlan;
+
+/**
+ * @struct[Linker] State shared by threads computing modules in parallel.
+ *  Everything other than runtime, code, funcs, and users is protected by
+ *  lock.
+ *
+ *  @field[FbleRuntime*][runtime]
+ *   The runtime to compute module values on. Only used with lock held.
+ *  @field[FbleCode*][code] The linking code. See LinkPlan.
+ *  @field[FbleValue**][funcs] The shared module functions.
+ *  @field[FbleValue**][values]
+ *   The computed values of modules. NULL for modules not yet computed.
+ *  @field[size_t*][waiting]
+ *   For each module, the number of its dependencies not yet computed.
+ *  @field[size_t**][users]
+ *   For each module, the list of modules that depend on it, terminated by
+ *   SIZE_MAX.
+ *  @field[size_t*][ready]
+ *   Stack of modules ready to compute but not yet started.
+ *  @field[size_t][ready_size] Number of modules on the ready stack.
+ *  @field[size_t][remaining] Number of modules not yet computed.
+ *  @field[bool][failed] True if computing a module has failed.
+ *  @field[pthread_mutex_t][lock] Lock for the linker state.
+ *  @field[pthread_cond_t][signal] Signaled when the linker state changes.
+ */
+typedef struct {
+  FbleRuntime* runtime;
+  FbleCode* code;
+  FbleValue** funcs;
+  FbleValue** values;
+  size_t* waiting;
+  size_t** users;
+  size_t* ready;
+  size_t ready_size;
+  size_t remaining;
+  bool failed;
+  pthread_mutex_t lock;
+  pthread_cond_t signal;
+} Linker;
+
+/**
+ * @struct[LinkWorker] A thread computing modules in parallel.
+ *  @field[Linker*][linker] The shared linker state.
+ *  @field[FbleRuntime*][runtime] The worker runtime for the thread.
+ *  @field[pthread_t][thread] The thread.
+ *  @field[bool][started] True if the thread was started.
+ */
+typedef struct {
+  Linker* linker;
+  FbleRuntime* runtime;
+  pthread_t thread;
+  bool started;
+} LinkWorker;
 
 static size_t LinkedModule(FbleRuntime* runtime,
     FbleModuleMap* linked, FbleValueV* funcs, FbleCode* code, FbleModule* module);
+static FbleCode* LinkCode(FbleRuntime* runtime, FbleProgram* program, FbleValueV* funcs);
+static void FreeLinkPlan(void* data);
+static void* RunLinkWorker(void* data);
+static FbleValue* RunParallel(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args);
 
 /**
  * @func[LinkedModule] Get or link a module into the given code.
@@ -58,12 +138,15 @@ static size_t LinkedModule(FbleRuntime* runtime,
 
   size_t profile_block_id = FbleAddBlocksToProfile(runtime->profile, module->profile_blocks);
 
+  FbleAddModuleHash(runtime, module->hash);
+
   FbleValue* func = NULL;
   if (module->code != NULL) {
     assert(module->exe == NULL);
     func = FbleNewInterpretedFuncValue(runtime, module->code, profile_block_id, NULL);
   } else if (module->exe != NULL) {
     assert(module->code == NULL);
+    FbleAddExecutables(runtime, module->executables);
     func = FbleNewFuncValue(runtime, module->exe, profile_block_id, NULL);
   } else {
     assert(false && "Attempt to link uncompiled module");
@@ -75,8 +158,21 @@ static size_t LinkedModule(FbleRuntime* runtime,
   return index;
 }
 
-// See documentation in fble-link.h
-FbleValue* FbleLink(FbleRuntime* runtime, FbleProgram* program)
+/**
+ * @func[LinkCode] Generates code to link a program.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FbleProgram*][program] The program to link.
+ *  @arg[FbleValueV*][funcs]
+ *   Initialized vector to add the functions of the program's modules to.
+ *  @returns[FbleCode*]
+ *   Code that computes the value of the program, with the module functions
+ *   as its statics.
+ *  @sideeffects
+ *   @i Adds profiling blocks for the program to the runtime's profile.
+ *   @i Adds the module functions to @a[funcs].
+ *   @i The caller should call FbleFreeCode on the returned code when done.
+ */
+static FbleCode* LinkCode(FbleRuntime* runtime, FbleProgram* program, FbleValueV* funcs)
 {
   // Write some code to call each of module functions in turn with the
   // appropriate module arguments. The function for module i will be static
@@ -88,23 +184,251 @@ FbleValue* FbleLink(FbleRuntime* runtime, FbleProgram* program)
   FbleBlockId main_id = FbleAddBlockToProfile(runtime->profile, main_block);
 
   FbleCode* code = FbleNewCode(0, 0, 0, main_id);
-  FbleValueV funcs;
-  FbleInitVector(funcs);
   FbleModuleMap* map = FbleNewModuleMap();
-  size_t main_index = LinkedModule(runtime, map, &funcs, code, program);
+  size_t main_index = LinkedModule(runtime, map, funcs, code, program);
 
-  code->executable.num_statics = funcs.size;
-  code->num_locals = funcs.size;
+  code->executable.num_statics = funcs->size;
+  code->num_locals = funcs->size;
 
   FbleReturnInstr* return_instr = FbleAllocInstr(FbleReturnInstr, FBLE_RETURN_INSTR);
   return_instr->result.tag = FBLE_LOCAL_VAR;
   return_instr->result.index = main_index;
   FbleAppendToVector(code->instrs, &return_instr->_base);
 
+  FbleFreeModuleMap(map, NULL, NULL);
+  return code;
+}
+
+// See documentation in fble-link.h
+FbleValue* FbleLink(FbleRuntime* runtime, FbleProgram* program)
+{
+  FbleValueV funcs;
+  FbleInitVector(funcs);
+  FbleCode* code = LinkCode(runtime, program, &funcs);
+
   // Wrap that all up into an FbleFuncValue.
   FbleValue* linked = FbleNewInterpretedFuncValue(runtime, code, 0, funcs.xs);
   FbleFreeVector(funcs);
-  FbleFreeModuleMap(map, NULL, NULL);
   FbleFreeCode(code);
   return linked;
 }
+
+/**
+ * @func[FreeLinkPlan] Frees a LinkPlan.
+ *  @arg[void*][data] The LinkPlan to free.
+ *  @sideeffects
+ *   Frees the plan and releases its code.
+ */
+static void FreeLinkPlan(void* data)
+{
+  LinkPlan* plan = (LinkPlan*)data;
+  FbleFreeCode(plan->code);
+  FbleFree(plan);
+}
+
+/**
+ * @func[RunLinkWorker] Body of a thread computing modules in parallel.
+ *  @arg[void*][data] The LinkWorker for the thread.
+ *  @returns[void*] NULL.
+ *  @sideeffects
+ *   Computes module values and adopts them into the linker's runtime until
+ *   all modules are computed or computing a module fails.
+ */
+static void* RunLinkWorker(void* data)
+{
+  LinkWorker* worker = (LinkWorker*)data;
+  Linker* linker = worker->linker;
+
+  pthread_mutex_lock(&linker->lock);
+  while (true) {
+    while (linker->ready_size == 0 && linker->remaining > 0 && !linker->failed) {
+      pthread_cond_wait(&linker->signal, &linker->lock);
+    }
+
+    if (linker->ready_size == 0 || linker->failed) {
+      break;
+    }
+
+    size_t module = linker->ready[--linker->ready_size];
+    FbleCallInstr* call = (FbleCallInstr*)linker->code->instrs.xs[module];
+    FbleValue* args[call->args.size];
+    for (size_t i = 0; i < call->args.size; ++i) {
+      args[i] = linker->values[call->args.xs[i].index];
+    }
+    FbleSyncWorkerRuntime(worker->runtime, linker->runtime);
+    pthread_mutex_unlock(&linker->lock);
+
+    FblePushFrame(worker->runtime);
+    FbleValue* value = FbleApply(worker->runtime, linker->funcs[module], call->args.size, args);
+
+    pthread_mutex_lock(&linker->lock);
+    if (value == NULL) {
+      linker->failed = true;
+    } else {
+      linker->values[module] = FbleAdoptValue(linker->runtime, worker->runtime, value);
+      linker->remaining--;
+      for (size_t* user = linker->users[module]; *user != SIZE_MAX; ++user) {
+        if (--linker->waiting[*user] == 0) {
+          linker->ready[linker->ready_size++] = *user;
+        }
+      }
+    }
+    pthread_cond_broadcast(&linker->signal);
+    pthread_mutex_unlock(&linker->lock);
+
+    FblePopFrame(worker->runtime, NULL);
+    pthread_mutex_lock(&linker->lock);
+  }
+  pthread_mutex_unlock(&linker->lock);
+  return NULL;
+}
+
+/**
+ * @func[RunParallel] FbleRunFunction to compute modules in parallel.
+ *  The statics of the function are the module functions followed by a
+ *  native value holding the LinkPlan.
+ *
+ *  See documentation of FbleRunFunction in fble-function.h.
+ */
+static FbleValue* RunParallel(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args)
+{
+  size_t modules = function->executable.num_statics - 1;
+  LinkPlan* plan = (LinkPlan*)FbleNativeValueData(function->statics[modules]);
+  FbleCode* code = plan->code;
+
+  // Worker runtimes don't do profiling. Compute modules one at a time if we
+  // are profiling.
+  if (profile != NULL) {
+    FbleValue* values[modules];
+    for (size_t i = 0; i < modules; ++i) {
+      FbleCallInstr* call = (FbleCallInstr*)code->instrs.xs[i];
+      FbleValue* call_args[call->args.size];
+      for (size_t j = 0; j < call->args.size; ++j) {
+        call_args[j] = values[call->args.xs[j].index];
+      }
+      values[i] = FbleCall(runtime, profile, function->statics[i], call->args.size, call_args);
+      if (values[i] == NULL) {
+        return NULL;
+      }
+    }
+    return values[modules - 1];
+  }
+
+  Linker linker;
+  linker.runtime = runtime;
+  linker.code = code;
+  linker.funcs = FbleAllocArray(FbleValue*, modules);
+  linker.values = FbleAllocArray(FbleValue*, modules);
+  linker.waiting = FbleAllocArray(size_t, modules);
+  linker.users = FbleAllocArray(size_t*, modules);
+  linker.ready = FbleAllocArray(size_t, modules);
+  linker.ready_size = 0;
+  linker.remaining = modules;
+  linker.failed = false;
+  pthread_mutex_init(&linker.lock, NULL);
+  pthread_cond_init(&linker.signal, NULL);
+
+  size_t num_users[modules];
+  for (size_t i = 0; i < modules; ++i) {
+    linker.funcs[i] = FbleShareValue(runtime, function->statics[i]);
+    linker.values[i] = NULL;
+    num_users[i] = 0;
+  }
+
+  for (size_t i = 0; i < modules; ++i) {
+    FbleCallInstr* call = (FbleCallInstr*)code->instrs.xs[i];
+    linker.waiting[i] = call->args.size;
+    if (call->args.size == 0) {
+      linker.ready[linker.ready_size++] = i;
+    }
+    for (size_t j = 0; j < call->args.size; ++j) {
+      num_users[call->args.xs[j].index]++;
+    }
+  }
+
+  for (size_t i = 0; i < modules; ++i) {
+    linker.users[i] = FbleAllocArray(size_t, num_users[i] + 1);
+    linker.users[i][num_users[i]] = SIZE_MAX;
+    num_users[i] = 0;
+  }
+
+  for (size_t i = 0; i < modules; ++i) {
+    FbleCallInstr* call = (FbleCallInstr*)code->instrs.xs[i];
+    for (size_t j = 0; j < call->args.size; ++j) {
+      size_t dep = call->args.xs[j].index;
+      linker.users[dep][num_users[dep]++] = i;
+    }
+  }
+
+  // The worker runtimes have to be created before any values are adopted
+  // into the runtime, so create them all up front. The calling thread acts
+  // as the last of the workers.
+  size_t threads = plan->threads < modules ? plan->threads : modules;
+  LinkWorker workers[threads];
+  for (size_t i = 0; i < threads; ++i) {
+    workers[i].linker = &linker;
+    workers[i].runtime = FbleNewWorkerRuntime(runtime);
+    workers[i].started = false;
+  }
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstacksize(&attr, LINK_THREAD_STACK_SIZE);
+  for (size_t i = 0; i + 1 < threads; ++i) {
+    // If we can't start a thread, the remaining workers pick up the slack.
+    workers[i].started = (pthread_create(&workers[i].thread, &attr, &RunLinkWorker, workers + i) == 0);
+  }
+  pthread_attr_destroy(&attr);
+
+  RunLinkWorker(workers + threads - 1);
+
+  for (size_t i = 0; i < threads; ++i) {
+    if (workers[i].started) {
+      pthread_join(workers[i].thread, NULL);
+    }
+    FbleFreeRuntime(workers[i].runtime);
+  }
+
+  FbleValue* result = linker.failed ? NULL : linker.values[modules - 1];
+
+  for (size_t i = 0; i < modules; ++i) {
+    FbleFree(linker.users[i]);
+  }
+  FbleFree(linker.funcs);
+  FbleFree(linker.values);
+  FbleFree(linker.waiting);
+  FbleFree(linker.users);
+  FbleFree(linker.ready);
+  pthread_mutex_destroy(&linker.lock);
+  pthread_cond_destroy(&linker.signal);
+  return result;
+}
+
+// See documentation in fble-link.h
+FbleValue* FbleLinkParallel(FbleRuntime* runtime, FbleProgram* program, size_t threads)
+{
+  if (threads <= 1) {
+    return FbleLink(runtime, program);
+  }
+
+  FbleValueV funcs;
+  FbleInitVector(funcs);
+  FbleCode* code = LinkCode(runtime, program, &funcs);
+
+  LinkPlan* plan = FbleAlloc(LinkPlan);
+  plan->threads = threads;
+  plan->code = code;
+  FbleAppendToVector(funcs, FbleNewNativeValue(runtime, plan, &FreeLinkPlan));
+
+  FbleExecutable exe = {
+    .num_args = 0,
+    .num_statics = funcs.size,
+    .max_call_args = 0,
+    .run = &RunParallel
+  };
+  FbleValue* linked = FbleNewFuncValue(runtime, &exe, code->profile_block_id, funcs.xs);
+  FbleFreeVector(funcs);
+  return linked;
+}
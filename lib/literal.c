@@ -8,8 +8,9 @@
 #include <assert.h>   // for assert
 #include <string.h>   // for strlen, strncmp
 
-#include <fble/fble-vector.h>   // for FbleInitVector, FbleFreeVector
+#include <fble/fble-vector.h>   // for FbleInitVector, FbleAppendToVector, etc.
 
+#include "runtime.h"  // for FbleCachedValue, FbleCacheValue
 #include "tc.h"       // for FbleTagWidth
 
 // The encoding for literal values is a mini program.
@@ -190,12 +191,21 @@ FbleLiteral FbleParseLiteral(FbleTypeHeap* th, FbleType* type, const char* word)
 }
 
 // See documentation in fble-literal.h.
-FbleValue* FbleNewLiteralValue(FbleRuntime* runtime, size_t size, uint8_t* data)
+FbleValue* FbleNewLiteralValue(FbleRuntime* runtime, size_t* id, size_t size, uint8_t* data)
 {
+  FbleValue* cached = FbleCachedValue(runtime, id);
+  if (cached != NULL) {
+    return cached;
+  }
+
   uint8_t* end = data + size;
 
+  // The literal program produces letters from the end of the list to the
+  // front. Collect them all up so the list can be allocated in one go.
+  FbleValueV letters;
+  FbleInitVector(letters);
+
   FbleValue* unit = FbleNewStructValue_(runtime, 0);
-  FbleValue* list = FbleNewUnionValue(runtime, 1, 1, unit);
   FbleValue* arg = unit;
   while (data < end) {
     uint8_t header = *data++;
@@ -211,10 +221,18 @@ FbleValue* FbleNewLiteralValue(FbleRuntime* runtime, size_t size, uint8_t* data)
 
     arg = FbleNewUnionValue(runtime, tagwidth, tag, arg);
     if (last) {
-      FbleValue* cons = FbleNewStructValue_(runtime, 2, arg, list);
-      list = FbleNewUnionValue(runtime, 1, 0, cons);
+      FbleAppendToVector(letters, arg);
       arg = unit;
     }
   }
-  return list;
+
+  for (size_t i = 0; i < letters.size / 2; ++i) {
+    FbleValue* tmp = letters.xs[i];
+    letters.xs[i] = letters.xs[letters.size - i - 1];
+    letters.xs[letters.size - i - 1] = tmp;
+  }
+
+  FbleValue* list = FbleNewListValue(runtime, letters.size, letters.xs);
+  FbleFreeVector(letters);
+  return FbleCacheValue(runtime, id, list);
 }
@@ -392,6 +392,8 @@ static FbleModule* Preload(FbleModuleV* loaded, FblePreloadedModule* preloaded)
   for (size_t i = 0; i < preloaded->profile_blocks.size; ++i) {
     FbleAppendToVector(module->profile_blocks, FbleCopyName(preloaded->profile_blocks.xs[i]));
   }
+  module->executables = preloaded->executables;
+  module->hash = preloaded->hash;
   FbleAppendToVector(*loaded, module);
   return FbleCopyModule(module);
 }
@@ -477,6 +479,9 @@ static FbleModule* Load(FblePreloadedModuleV builtins, FbleSearchPath* search_pa
   module->exe = NULL;
   module->profile_blocks.size = 0;
   module->profile_blocks.xs = NULL;
+  module->executables.size = 0;
+  module->executables.xs = NULL;
+  module->hash = 0;
 
   bool error = false;
 
@@ -502,6 +507,8 @@ static FbleModule* Load(FblePreloadedModuleV builtins, FbleSearchPath* search_pa
         for (size_t j = 0; j < preloaded->profile_blocks.size; ++j) {
           FbleAppendToVector(module->profile_blocks, FbleCopyName(preloaded->profile_blocks.xs[j]));
         }
+        module->executables = preloaded->executables;
+        module->hash = preloaded->hash;
         break;
       }
     }
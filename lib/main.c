@@ -15,7 +15,7 @@
 #include <fble/fble-vector.h>       // for FbleInitVector, etc.
 
 static void PrintCompiledHeaderLine(FILE* stream, const char* tool, const char* arg0, FblePreloadedModule* preloaded);
-static FbleValue* Link(FbleRuntime* runtime, FblePreloadedModuleV builtins, FbleSearchPath* search_path, FbleModulePath* module_path, FbleStringV* build_deps);
+static FbleValue* Link(FbleRuntime* runtime, FblePreloadedModuleV builtins, FbleSearchPath* search_path, FbleModulePath* module_path, size_t threads, FbleStringV* build_deps);
 
 /**
  * @func[PrintCompiledHeaderLine] Prints an information line about a preloaded module.
@@ -64,6 +64,8 @@ static void PrintCompiledHeaderLine(FILE* stream, const char* tool, const char*
  *   The search path to use for locating .fble files.
  *  @arg[FbleModulePath*] module_path
  *   The module path for the main module to load.
+ *  @arg[size_t] threads
+ *   The number of threads to use to compute module values.
  *  @arg[FbleStringV*] build_deps
  *   Output to store list of files the load depended on. This should be a
  *   preinitialized vector, or NULL.
@@ -78,7 +80,7 @@ static void PrintCompiledHeaderLine(FILE* stream, const char* tool, const char*
  *    The user should free strings added to build_deps when no longer
  *    needed, including in the case when program loading fails.
  */
-static FbleValue* Link(FbleRuntime* runtime, FblePreloadedModuleV builtins, FbleSearchPath* search_path, FbleModulePath* module_path, FbleStringV* build_deps)
+static FbleValue* Link(FbleRuntime* runtime, FblePreloadedModuleV builtins, FbleSearchPath* search_path, FbleModulePath* module_path, size_t threads, FbleStringV* build_deps)
 {
   FbleProgram* program = FbleLoadForExecution(builtins, search_path, module_path, build_deps);
   if (program == NULL) {
@@ -90,7 +92,7 @@ static FbleValue* Link(FbleRuntime* runtime, FblePreloadedModuleV builtins, Fble
     return NULL;
   }
 
-  FbleValue* linked = FbleLink(runtime, program);
+  FbleValue* linked = FbleLinkParallel(runtime, program, threads);
   FbleFreeProgram(program);
   return linked;
 }
@@ -118,6 +120,15 @@ FbleMainStatus FbleMain(
   bool error = false;
   bool version = false;
   int profile_sample_period_int = *profile_sample_period;
+  int stack_chunk_size = 0;
+  int merge_limit = -1;
+  bool auto_merge_limit = false;
+  int gc_pace = 1;
+  bool hash_cons = false;
+  bool background_sweep = false;
+  bool runtime_stats = false;
+  int link_threads = 0;
+  const char* snapshot_file = NULL;
 
   // If the module is preloaded and there is no explicit '--' argument, we
   // assume all the arguments are for the application, not options to
@@ -140,6 +151,15 @@ FbleMainStatus FbleMain(
     if (arg_parser && arg_parser(data, argc, argv, &error)) continue;
     if (FbleParseStringArg("--profile", profile_output_file, argc, argv, &error)) continue;
     if (FbleParseIntArg("--profile-sample-period", &profile_sample_period_int, argc, argv, &error)) continue;
+    if (FbleParseIntArg("--stack-chunk-size", &stack_chunk_size, argc, argv, &error)) continue;
+    if (FbleParseIntArg("--merge-limit", &merge_limit, argc, argv, &error)) continue;
+    if (FbleParseBoolArg("--auto-merge-limit", &auto_merge_limit, argc, argv, &error)) continue;
+    if (FbleParseIntArg("--gc-pace", &gc_pace, argc, argv, &error)) continue;
+    if (FbleParseBoolArg("--hash-cons", &hash_cons, argc, argv, &error)) continue;
+    if (FbleParseBoolArg("--background-sweep", &background_sweep, argc, argv, &error)) continue;
+    if (FbleParseIntArg("--link-threads", &link_threads, argc, argv, &error)) continue;
+    if (FbleParseBoolArg("--runtime-stats", &runtime_stats, argc, argv, &error)) continue;
+    if (FbleParseStringArg("--snapshot", &snapshot_file, argc, argv, &error)) continue;
     if (FbleParseStringArg("--deps-file", &deps_file, argc, argv, &error)) continue;
     if (FbleParseStringArg("--deps-target", &deps_target, argc, argv, &error)) continue;
     if (strcmp((*argv)[0], "--") == 0) {
@@ -191,10 +211,54 @@ FbleMainStatus FbleMain(
     return FBLE_MAIN_USAGE_ERROR;
   }
 
+  if (stack_chunk_size < 0) {
+    fprintf(stderr, "--stack-chunk-size must not be negative.\n");
+    fprintf(stderr, "Try --help for usage\n");
+    FbleFreeModuleArg(module_arg);
+    return FBLE_MAIN_USAGE_ERROR;
+  }
+
+  if (merge_limit < -1) {
+    fprintf(stderr, "--merge-limit must not be negative.\n");
+    fprintf(stderr, "Try --help for usage\n");
+    FbleFreeModuleArg(module_arg);
+    return FBLE_MAIN_USAGE_ERROR;
+  }
+
+  if (gc_pace < 1) {
+    fprintf(stderr, "--gc-pace must be positive.\n");
+    fprintf(stderr, "Try --help for usage\n");
+    FbleFreeModuleArg(module_arg);
+    return FBLE_MAIN_USAGE_ERROR;
+  }
+
+  if (link_threads < 0) {
+    fprintf(stderr, "--link-threads must not be negative.\n");
+    fprintf(stderr, "Try --help for usage\n");
+    FbleFreeModuleArg(module_arg);
+    return FBLE_MAIN_USAGE_ERROR;
+  }
+
   if (module_arg.module_path == NULL) {
     module_arg.module_path = FbleCopyModulePath(preloaded->path);
   }
 
+  if (stack_chunk_size > 0) {
+    FbleSetStackChunkSize(runtime, stack_chunk_size);
+  }
+
+  if (merge_limit >= 0) {
+    FbleSetMergeLimit(runtime, merge_limit);
+  }
+  FbleSetMergeLimitTuning(runtime, auto_merge_limit);
+  FbleSetGcPace(runtime, gc_pace);
+  FbleSetHashConsing(runtime, hash_cons);
+  FbleSetBackgroundSweep(runtime, background_sweep);
+
+  if (runtime_stats) {
+    FbleSetRuntimeStatsOutput(runtime, stderr);
+  }
+
   runtime->profile->enabled = (*profile_output_file != NULL);
   if ((uint64_t)profile_sample_period_int != *profile_sample_period) {
     if (profile_sample_period_int < 0) {
@@ -212,7 +276,7 @@ FbleMainStatus FbleMain(
     FbleAppendToVector(preloaded_and_builtins, preloaded);
   }
 
-  FbleValue* linked = Link(runtime, preloaded_and_builtins, module_arg.search_path, module_arg.module_path, &deps);
+  FbleValue* linked = Link(runtime, preloaded_and_builtins, module_arg.search_path, module_arg.module_path, link_threads, &deps);
   FbleFreeVector(preloaded_and_builtins);
   FbleFreeModuleArg(module_arg);
 
@@ -243,9 +307,40 @@ FbleMainStatus FbleMain(
   }
   FbleFreeVector(deps);
 
-  FbleValue* func = FbleEval(runtime, linked);
+  // Reuse the value of the program from a snapshot if we have one. Only the
+  // runtime's profile blocks and known executables, which linking sets up,
+  // need to match.
+  FbleValue* func = NULL;
+  FILE* snapshot = snapshot_file == NULL ? NULL : fopen(snapshot_file, "rb");
+  if (snapshot != NULL) {
+    const char* snapshot_error = NULL;
+    func = FbleLoadValue(runtime, snapshot, &snapshot_error);
+    fclose(snapshot);
+    if (func == NULL) {
+      fprintf(stderr, "warning: ignoring snapshot %s: %s\n", snapshot_file, snapshot_error);
+    }
+  }
+
   if (func == NULL) {
-    return FBLE_MAIN_RUNTIME_ERROR;
+    func = FbleEval(runtime, linked);
+    if (func == NULL) {
+      return FBLE_MAIN_RUNTIME_ERROR;
+    }
+
+    if (snapshot_file != NULL) {
+      snapshot = fopen(snapshot_file, "wb");
+      if (snapshot == NULL) {
+        fprintf(stderr, "warning: unable to open %s for writing\n", snapshot_file);
+      } else {
+        const char* snapshot_error = NULL;
+        bool saved = FbleSaveValue(runtime, func, snapshot, &snapshot_error);
+        fclose(snapshot);
+        if (!saved) {
+          fprintf(stderr, "warning: unable to save snapshot %s: %s\n", snapshot_file, snapshot_error);
+          remove(snapshot_file);
+        }
+      }
+    }
   }
 
   *result = func;
@@ -10,10 +10,12 @@
  */
 
 #include <assert.h>   // for assert
+#include <pthread.h>  // for pthread_create, pthread_mutex_lock, etc.
 #include <stdarg.h>   // for va_list, va_start, va_end
 #include <stddef.h>   // for offsetof
-#include <stdlib.h>   // for NULL
-#include <string.h>   // for memcpy
+#include <stdio.h>    // for FILE, fprintf
+#include <stdlib.h>   // for NULL, malloc, free
+#include <string.h>   // for memcpy, memset
 
 #ifndef __WIN32
 #include <sys/resource.h>   // for getrlimit, setrlimit
@@ -25,6 +27,8 @@
 #include <fble/fble-function.h>  // for FbleFunction, etc.
 #include <fble/fble-vector.h>    // for FbleInitVector, etc.
 
+#include "alloc.h"          // for FbleCountAlloc, FbleCountFree
+#include "runtime.h"        // for FbleNewWorkerRuntime, etc.
 #include "unreachable.h"    // for FbleUnreachable
 
 // Notes on Memory Management
@@ -37,6 +41,15 @@
 // Packed values are stored (packed into) in a single machine word. They are
 // passed around by value. We try to use packed values wherever we can.
 //
+// A packed value is {0..., 1, data, 1}. The least significant bit marks the
+// value as packed. The data bits follow, and the most significant 1 bit
+// marks the end of the data. Using a marker bit instead of a length field
+// leaves room for up to 62 bits of data on a 64 bit machine.
+//
+// The data for a union is {arg, tag}. The data for a struct is
+// {fields, header}, where the header lists the offset of the start of each
+// field after the first, PACKED_OFFSET_WIDTH bits per offset.
+//
 // Allocated values are allocated in memory. They are passed around by
 // reference.
 //
@@ -84,15 +97,15 @@
 // keeps track of a set of marked/unmarked objects with the invariant that
 // 'unmarked' objects are reachable if and only if they are reachable from a
 // 'marked' object. Garbage collection traverses all the marked objects,
-// moving unmarked objects to marked objects, and marked objects to the
-// frame's allocated objects until there are no more marked objects. At that
-// point anything left in 'unmarked' is unreachable and can be reclaimed.
+// marking the unmarked objects they reference, until there are no more
+// marked objects left to traverse. At that point anything left unmarked is
+// unreachable and can be reclaimed.
 //
 // The idea is, the only time we can create garbage is when we return from (or
 // compact) a stack frame. At that point any object allocated on the stack
-// frame that isn't reachable from the returned value is garbage. We add the
-// returned value to the set of marked objects and everything else allocated
-// on the frame to the set of unmarked objects.
+// frame that isn't reachable from the returned value is garbage. We mark the
+// returned value and add everything allocated on the frame to the set of
+// unmarked objects.
 //
 // We collect garbage from the oldest frame of the stack first, then work our
 // way to younger frames of the stack. This gives us a chance to batch
@@ -101,8 +114,12 @@
 //
 // A GC allocated object belongs to a singly linked list of objects and is
 // tagged with a generation id ('gen'). The generation id is used to keep
-// track of which frame and alloced/marked/unmarked list the object currently
-// belongs to.
+// track of which frame the object currently belongs to and whether it has
+// been marked. Marked objects are not kept on a separate list: an object on a
+// frame's unmarked list is marked if its generation is the same as the
+// frame's generation. That way the only per-object overhead for GC is the
+// list pointer and the generation id, and marking an object never has to
+// remove it from the middle of a list.
 //
 // Frame Compaction
 // ----------------
@@ -116,28 +133,52 @@
 // happening on that frame, we say GC is interrupted. We let GC finish its
 // work and give responsibility for transferring returned objects to the
 // caller stack frame to GC when it finishes.
+//
+// Size Classes
+// ------------
+// Most GC allocated objects are small and similarly sized. Rather than go to
+// malloc for each one, small objects are carved out of large slabs of memory
+// owned by the runtime and recycled through per size class free lists. Each
+// size class is a multiple of the machine word size. Larger objects are
+// allocated individually.
+//
+// List Blocks
+// -----------
+// Lists created all at once, from list expressions and literals, are
+// allocated as a single object called a list block rather than as a separate
+// union and struct value for every element. The list block is a sequence of
+// cells. Each cell is an ordinary cons union value followed by the struct
+// value that it refers to, so the list looks the same as any other list to
+// code accessing it.
+//
+// The union value of the first cell owns the list block. It is the only part
+// of the list block with a stack or GC allocated value header. The other
+// values in the list block are 'interior' values that record the offset back
+// to their owner. Memory management of an interior value is done on its
+// owner.
 
 const static uintptr_t ONE = 1;
 const static uintptr_t PACKED_OFFSET_WIDTH = (sizeof(FbleValue*) == 8) ? 6 : 5;
 const static uintptr_t PACKED_OFFSET_MASK = (ONE << PACKED_OFFSET_WIDTH) - 1;
+const static uintptr_t PACKED_DATA_WIDTH = 8 * sizeof(FbleValue*) - 2;
+
+// Forward reference to GcAllocatedValue.
+typedef struct GcAllocatedValue GcAllocatedValue;
 
 /**
- * @struct[List] Circular, doubly linked list of values.
- *  @field[List*][next] The next element in the list.
- *  @field[List*][prev] The previous element in the list.
+ * @struct[List] Singly linked list of values.
+ *  @field[GcAllocatedValue*][head] The first element in the list.
+ *  @field[GcAllocatedValue*][tail] The last element in the list.
  */
-typedef struct List {
-  struct List* next;
-  struct List* prev;
+typedef struct {
+  GcAllocatedValue* head;
+  GcAllocatedValue* tail;
 } List;
 
-// Forward reference to GcAllocatedValue.
-typedef struct GcAllocatedValue GcAllocatedValue;
-
 static void Clear(List* list);
 static bool IsEmpty(List* list);
 static GcAllocatedValue* Get(List* list);
-static void MoveTo(List* dst, GcAllocatedValue* value);
+static void Add(List* dst, GcAllocatedValue* value);
 static void MoveAllTo(List* dst, List* src);
 
 typedef struct Frame Frame;
@@ -153,13 +194,33 @@ typedef enum {
 // uint32_t FbleValue.data field is the tag of a union and the number of
 // fields of a struct.
 
-// uint32_t FbleValue.flags field is {traversing, is_gc_alloc, value_tag}. The
-// traversing bit is used to limit recursion in RefAssigns. The is_gc_alloc
-// bit is used to indicate the value is gc allocated rather than stack
-// allocated. The value_tag bits hold the ValueTag of the value.
+// uint32_t FbleValue.flags field is {count, hash_cons, interior, block,
+// traversing, is_gc_alloc, value_tag}. The hash_cons bit marks values that
+// may be in the runtime's hash cons cache. The traversing bit marks values
+// already seen by RefsAssign. The is_gc_alloc bit is used to indicate the value is gc
+// allocated rather than stack allocated. The value_tag bits hold the ValueTag
+// of the value. The block bit marks the owner of a list block, in which case
+// count is the number of cells in the list block. The interior bit marks an
+// interior value of a list block, in which case count is the number of words
+// from the owner of the list block to the value.
 static const uint32_t FbleValueFlagTagBits = 0x3;
 static const uint32_t FbleValueFlagIsGcAllocBit = 0x4;
 static const uint32_t FbleValueFlagTraversingBit = 0x8;
+static const uint32_t FbleValueFlagBlockBit = 0x10;
+static const uint32_t FbleValueFlagInteriorBit = 0x20;
+static const uint32_t FbleValueFlagHashConsBit = 0x40;
+static const uint32_t FbleValueFlagCountShift = 7;
+
+// The number of words in a list block cell: a union value followed by a
+// struct value with two fields.
+#define LIST_CELL_WORDS ((sizeof(FbleUnionValue) + sizeof(FbleStructValue)) / sizeof(FbleValue*) + 2)
+
+// The most cells we put in a single list block. Longer lists are split into
+// multiple list blocks. A reference to any cell keeps its whole block alive,
+// and GC traverses a whole block in one step, so this bounds both the memory
+// a suffix of a list can hold on to and the work of a traversal step, to
+// about what GC_BATCH_SIZE objects cost.
+#define MAX_LIST_BLOCK_CELLS 16
 
 /**
  * @struct[NativeValue] NATIVE_VALUE
@@ -168,11 +229,14 @@ static const uint32_t FbleValueFlagTraversingBit = 0x8;
  *  @field[FbleValue][_base] FbleValue base class.
  *  @field[void*][data] User data.
  *  @field[void (*)(void*)][on_free] Destructor for user data.
+ *  @field[bool][concurrent]
+ *   True if on_free may be called from the background sweeper thread.
  */
 typedef struct {
   FbleValue _base;
   void* data;
   void (*on_free)(void* data);
+  bool concurrent;
 } NativeValue;
 
 /**
@@ -197,12 +261,12 @@ typedef struct {
 
 /**
  * @struct[GcAllocatedValue] An FbleValue allocated on the heap.
- *  @field[List][list] A list of values this value belongs to.
+ *  @field[GcAllocatedValue*][next] The next value in the list this belongs to.
  *  @field[uint64_t][gen] Generation this object is allocated in.
  *  @field[FbleValue][value] The contents of the value.
  */
 struct GcAllocatedValue {
-  List list;
+  GcAllocatedValue* next;
   uint64_t gen;
   FbleValue value;
 };
@@ -271,19 +335,38 @@ struct GcAllocatedValue {
  */
 #define NewGcValueExtra(runtime, frame, T, tag, count) ((T*) NewGcValueRaw(runtime, frame, tag, sizeof(T) + count * sizeof(FbleValue*)))
 
-// We allocate memory for the stack in 1MB chunks.
-#define CHUNK_SIZE (1024 * 1024)
+// By default we allocate memory for the stack in 1MB chunks.
+#define DEFAULT_CHUNK_SIZE (1024 * 1024)
 
-// How many bytes we can allocate on a frame before we should stop merging
-// frames. Chosen fairly arbitrarily.
-#define MERGE_LIMIT (4 * 1024)
+// The smallest stack chunk size we allow to be configured.
+#define MIN_CHUNK_SIZE (4 * 1024)
+
+// The most stack chunks we hold on to when they aren't in use. Keeping a
+// couple around avoids repeatedly allocating and freeing a chunk when the
+// stack goes back and forth across a chunk boundary, without permanently
+// holding on to all the memory from a spike in stack depth.
+#define MAX_IDLE_CHUNKS 2
+
+// By default, how many bytes we can allocate on a frame before we should stop
+// merging frames. Chosen fairly arbitrarily.
+#define DEFAULT_MERGE_LIMIT (4 * 1024)
+
+// When auto tuning the merge limit, the number of calls between adjustments
+// and the bounds on the merge limit. Merging frames avoids promoting values
+// returned from a callee to the GC heap, but merged frames can't be
+// compacted, so we don't want to merge too much.
+#define MERGE_TUNING_PERIOD 4096
+#define MIN_TUNED_MERGE_LIMIT (1 * 1024)
+#define MAX_TUNED_MERGE_LIMIT (16 * 1024)
 
 /**
  * @struct[Chunk] A chunk of allocated stack space.
  *  @field[Chunk*][next] The next chunk in the list.
+ *  @field[size_t][size] The size of the chunk in bytes, including this header.
  */
 typedef struct Chunk {
   struct Chunk* next;
+  size_t size;
 } Chunk;
 
 /**
@@ -299,18 +382,16 @@ typedef struct Chunk {
  *   than min_gen.
  *  @field[uint64_t][gen]
  *   Objects allocated before the most recent compaction on the frame have
- *   generation less than gen.
+ *   generation less than gen. Objects on the alloced list and marked
+ *   objects on the unmarked list have generation equal to gen.
  *  @field[uint64_t][max_gen]
- *   Objects in marked,unmarked have generation less than max_gen.
+ *   Objects in unmarked have generation less than max_gen.
  *  @field[List][unmarked]
  *   Potential garbage GC objects on the frame not yet seen in traversal.
  *   These are either from objects allocated to callee frames that have since
- *   returned or objects allocated on this frame prior to compaction.
- *  @field[List][marked]
- *   Potential garbage GC objects on the frame seen in traversal but not
- *   processed yet. These are either from objects allocated to callee frames
- *   that have since returned or objects allocated on this frame prior to
- *   compaction.
+ *   returned or objects allocated on this frame prior to compaction. Objects
+ *   on this list with generation equal to gen are marked: they are reachable
+ *   and have not been traversed yet.
  *  @field[List][alloced] Other GC objects allocated to this frame.
  *  @field[intptr_t][top]
  *   The top of the frame on the stack. This points to the callee frame or new
@@ -319,6 +400,12 @@ typedef struct Chunk {
  *  @field[Chunk*][chunks]
  *   Additional chunks of memory allocated for the stack for use by this and
  *   callee frames.
+ *  @field[size_t][hash_consed]
+ *   Bytes of hash consed values allocated to this frame since it was pushed
+ *   or last compacted. These count against the merge limit like stack
+ *   allocations do, otherwise a loop of merged calls could allocate hash
+ *   consed values to the frame indefinitely without giving GC a chance to
+ *   reclaim them.
  */
 struct Frame {
   struct Frame* caller;
@@ -329,13 +416,13 @@ struct Frame {
   uint64_t max_gen;
 
   List unmarked;
-  List marked;
   List alloced;
 
   intptr_t top;
   intptr_t max;
 
   Chunk* chunks;
+  size_t hash_consed;
 };
 
 static void MoveToAlloced(Frame* frame, GcAllocatedValue* value);
@@ -344,35 +431,50 @@ static void MoveToUnmarked(Frame* frame, GcAllocatedValue* value);
 
 /**
  * @struct[Gc] Information about the current set of objects undergoing GC.
+ *  GC of a frame proceeds by scanning the frame's unmarked list, traversing
+ *  marked objects as they are found, and finally sweeping any objects that
+ *  were not marked after all.
+ *
  *  @field[uint64_t][gen]
- *   The generation to move objects to when they survive GC. Guaranteed to be
- *   distinct from the generation of any object currently in GC.
+ *   The generation to move objects to when they are marked. Marked objects
+ *   survive GC. Guaranteed to be distinct from the generation of any
+ *   unmarked object currently in GC.
  *  @field[uint64_t][min_gen]
  *   An object is currently undergoing GC if its generation is in the interval
- *   [min_gen, max_gen), but not equal to gen.
+ *   [min_gen, max_gen).
  *  @field[uint64_t][max_gen]
  *   An object is currently undergoing GC if its generation is in the interval
- *   [min_gen, max_gen), but not equal to gen.
+ *   [min_gen, max_gen).
  *  @field[Frame*][frame] The frame that GC is currently running on.
  *  @field[Frame*][next]
  *   The next frame to run garbage collection on. This is the frame closest to
  *   the base of the stack with some potential garbage objects to GC. NULL to
  *   indicate that no frames have potential garbage objects to GC.
- *  @field[List][marked]
- *   Marked objects being traversed in the current GC cycle. These belong to
- *   gc->frame.
+ *  @field[FbleValueV][marked]
+ *   Stack of marked objects that have yet to be traversed in the current GC
+ *   cycle. marked.size is the number of objects on the stack.
+ *  @field[size_t][marked_capacity] Allocated capacity of the marked stack.
  *  @field[List][unmarked]
- *   Unmarked objects being traversed in the current GC cycle. These belong to
+ *   Objects yet to be scanned in the current GC cycle. These belong to
  *   gc->frame.
+ *  @field[List][pending]
+ *   Objects already scanned in the current GC cycle that were not marked at
+ *   the time. Anything still not marked after traversal is complete is
+ *   garbage.
  *  @field[bool][interrupted]
  *   True if the frame GC was working on was popped or compacted during GC.
  *   If this is the case, we'll move reachable objects to 'unmarked' instead
  *   of 'alloced'. See also 'save' field.
  *  @field[FbleValueV][save]
- *   List of objects to resurrect at the end of GC if it was interrupted.
- *   save.size is the capacity of the array, which is expanded as needed. The
- *   The list of values in save.xs is NULL terminated.
- *  @field[List][free] A list of garbage objects to be freed.
+ *   List of objects to mark on gc->frame at the end of GC if it was
+ *   interrupted. save.size is the capacity of the array, which is expanded
+ *   as needed. The list of values in save.xs is NULL terminated.
+ *  @field[size_t][pace]
+ *   The number of incremental GC steps to perform per allocation when the
+ *   heap isn't growing.
+ *  @field[size_t][live]
+ *   Estimate of the number of live GC objects, taken the last time GC ran
+ *   out of work to do.
  */
 typedef struct {
   uint64_t gen;
@@ -383,24 +485,242 @@ typedef struct {
   Frame* frame;
   Frame* next;
 
-  List marked;
+  FbleValueV marked;
+  size_t marked_capacity;
   List unmarked;
+  List pending;
 
   bool interrupted;
   FbleValueV save;
 
-  List free;
+  size_t pace;
+  size_t live;
 } Gc;
 
+// The number of objects to scan or sweep in a single incremental GC step.
+// Scanning or sweeping an object is cheap compared to traversing one, and
+// doing a few at a time lets GC keep up with the rate of allocation.
+#define GC_BATCH_SIZE 16
+
+// The default number of incremental GC steps to perform per allocation.
+#define DEFAULT_GC_PACE 1
+
+// Lower bound on the estimate of live GC objects used for GC pacing. Keeps
+// small heaps from triggering extra GC work on every allocation.
+#define MIN_GC_LIVE 1024
+
+// Upper bound on how many times the pace GC can speed up by when the heap is
+// growing. Keeps the amount of GC work per allocation bounded.
+#define MAX_GC_PACE_FACTOR 8
+
+// GC allocated objects up to this many bytes, including the GcAllocatedValue
+// header, are allocated from size classes.
+#define MAX_SIZE_CLASS_BYTES (32 * sizeof(FbleValue*))
+
+// The number of size classes. Size class i holds objects of
+// i * sizeof(FbleValue*) bytes.
+#define NUM_SIZE_CLASSES (MAX_SIZE_CLASS_BYTES / sizeof(FbleValue*) + 1)
+
+// We allocate memory for size classes in 64KB slabs.
+#define SLAB_SIZE (64 * 1024)
+
+/**
+ * @struct[Slab] A slab of memory for allocating small GC objects from.
+ *  @field[Slab*][next] The next slab in the list.
+ */
+typedef struct Slab {
+  struct Slab* next;
+} Slab;
+
+/**
+ * @struct[FreeObject] A free object in a size class.
+ *  @field[FreeObject*][next] The next free object in the size class.
+ */
+typedef struct FreeObject {
+  struct FreeObject* next;
+} FreeObject;
+
+/**
+ * @struct[Heap] Memory for small GC allocated objects.
+ *  @field[FreeObject**][free] Free objects, indexed by size class.
+ *  @field[Slab*][slabs] All slabs allocated for the heap.
+ *  @field[intptr_t][top] Next unused byte of memory in the current slab.
+ *  @field[intptr_t][max] The max bounds of the current slab.
+ */
+typedef struct {
+  FreeObject* free[NUM_SIZE_CLASSES];
+  Slab* slabs;
+  intptr_t top;
+  intptr_t max;
+} Heap;
+
+// The number of garbage objects to hand off to the background sweeper thread
+// at a time. Smaller batches are handed off at the end of each GC cycle.
+#define SWEEP_BATCH_SIZE 64
+
+/**
+ * @struct[Sweeper] Background thread for finalizing garbage native values.
+ *  When enabled, garbage native values with concurrent on_free functions are
+ *  handed off to the background thread in batches. The background thread
+ *  calls on_free on them, then hands them back to the mutator to return
+ *  their memory to the heap. The heap itself is only ever touched by the
+ *  mutator.
+ *
+ *  @field[bool][enabled] True if the background thread is running.
+ *  @field[pthread_t][thread] The background thread.
+ *  @field[List][batch]
+ *   Garbage values not yet handed off to the background thread. Accessed by
+ *   the mutator only.
+ *  @field[size_t][batch_size] The number of values in batch.
+ *  @field[pthread_mutex_t][lock] Lock for todo, done, busy, and stop.
+ *  @field[pthread_cond_t][signal]
+ *   Condition signaled when todo, busy, or stop change.
+ *  @field[List][todo] Garbage values for the background thread to finalize.
+ *  @field[List][done] Finalized values ready to be returned to the heap.
+ *  @field[bool][busy] True while the background thread is finalizing values.
+ *  @field[bool][stop] Set to tell the background thread to exit.
+ */
+typedef struct {
+  bool enabled;
+  pthread_t thread;
+
+  List batch;
+  size_t batch_size;
+
+  pthread_mutex_t lock;
+  pthread_cond_t signal;
+  List todo;
+  List done;
+  bool busy;
+  bool stop;
+} Sweeper;
+
+/**
+ * @struct[ForeignEntry] An entry in the table of registered foreign values.
+ *  @field[uint64_t][hash] Hash of the path and name of the foreign value.
+ *  @field[FbleModulePath*][path] The parsed path of the foreign value.
+ *  @field[FbleForeign*][foreign]
+ *   The registered foreign value. NULL if the entry is unused.
+ */
+typedef struct {
+  uint64_t hash;
+  FbleModulePath* path;
+  FbleForeign* foreign;
+} ForeignEntry;
+
+/**
+ * @struct[ForeignTable] Hash table of registered foreign values.
+ *  Uses open addressing with linear probing.
+ *
+ *  @field[size_t][size] Number of entries in use.
+ *  @field[size_t][capacity] Number of entries allocated. A power of 2.
+ *  @field[ForeignEntry*][xs] The entries.
+ */
+typedef struct {
+  size_t size;
+  size_t capacity;
+  ForeignEntry* xs;
+} ForeignTable;
+
+// Initial capacity of the table of registered foreign values.
+#define INITIAL_FOREIGN_CAPACITY 16
+
+/**
+ * @struct[ValueEntry] An entry in a table of values.
+ *  @field[FbleValue*][key] The value. NULL if the entry is unused.
+ *  @field[uintptr_t][data] Data associated with the value.
+ */
+typedef struct {
+  FbleValue* key;
+  uintptr_t data;
+} ValueEntry;
+
+/**
+ * @struct[ValueTable] Hash table of data associated with values.
+ *  Uses open addressing with linear probing.
+ *
+ *  @field[size_t][size] Number of entries in use.
+ *  @field[size_t][capacity] Number of entries allocated. A power of 2.
+ *  @field[ValueEntry*][xs] The entries.
+ */
+typedef struct {
+  size_t size;
+  size_t capacity;
+  ValueEntry* xs;
+} ValueTable;
+
+// Initial capacity of a table of values.
+#define INITIAL_VALUE_TABLE_CAPACITY 64
+
 /**
- * @struct[ForeignV] Vector of FbleForeign*
+ * @struct[ExecutableV] Vector of FbleExecutable.
  *  @field[size_t][size] Number of elements.
- *  @field[FbleForeign**][xs] Elements.
+ *  @field[FbleExecutable*][xs] Elements.
  */
 typedef struct {
   size_t size;
-  FbleForeign** xs;
-} ForeignV;
+  FbleExecutable* xs;
+} ExecutableV;
+
+/**
+ * @struct[SnapshotWriter] A snapshot being saved.
+ *  @field[FILE*][fout] The stream to write to.
+ *  @field[uint64_t][checksum] Checksum of the words written so far.
+ */
+typedef struct {
+  FILE* fout;
+  uint64_t checksum;
+} SnapshotWriter;
+
+/**
+ * @struct[SnapshotReader] A snapshot being loaded.
+ *  @field[FILE*][fin] The stream to read from.
+ *  @field[uint64_t][words] Number of words left to read from the stream.
+ *  @field[uint64_t][checksum] Checksum of the words read so far.
+ */
+typedef struct {
+  FILE* fin;
+  uint64_t words;
+  uint64_t checksum;
+} SnapshotReader;
+
+// Number of entries in the hash cons cache. A power of 2.
+#define HASH_CONS_ENTRIES 4096
+
+// Number of entries in the cache of literal values. A power of 2.
+#define VALUE_CACHE_ENTRIES 256
+
+// Maximum number of frames down the stack to look for the frame a cached
+// value was allocated on before giving up on it.
+#define VALUE_CACHE_DEPTH 8
+
+/**
+ * @struct[CachedValue] An entry in the cache of literal values.
+ *  The cache doesn't keep values alive. An entry is only used while the
+ *  frame it was allocated on is still on the stack and hasn't been compacted
+ *  since, because GC won't free the value until then.
+ *
+ *  @field[size_t][id] The cache id of the value. 0 if the entry is unused.
+ *  @field[bool][packed] True if the value is packed, so it's always valid.
+ *  @field[uint64_t][gen] The generation of the value when it was cached.
+ *  @field[FbleValue*][value] The cached value.
+ */
+typedef struct {
+  size_t id;
+  bool packed;
+  uint64_t gen;
+  FbleValue* value;
+} CachedValue;
+
+// Maximum number of fields of a struct value to hash cons.
+#define MAX_HASH_CONS_FIELDS 4
+
+// Magic number at the start of a snapshot saved by FbleSaveValue: "FBLESNAP"
+// in ASCII.
+#define SNAPSHOT_MAGIC 0x50414e53454c4246ULL
+
+// Version of the snapshot format. Increment when the format changes.
+#define SNAPSHOT_VERSION 4
 
 /**
  * @struct[Runtime] The full FbleRuntime
@@ -412,10 +732,48 @@ typedef struct {
  *  @field[Frame*][top]
  *   The top frame of the stack. New values are allocated here.
  *  @field[Gc][gc] Info about currently running GC.
+ *  @field[Heap][heap] Memory for small GC allocated objects.
+ *  @field[Sweeper][sweeper] Optional background sweeper thread.
  *  @field[Chunk*][chunks]
  *   Chunks of allocated stack memory not currently in use.
+ *  @field[size_t][idle_chunks] The number of chunks in 'chunks'.
+ *  @field[size_t][chunk_size] Size of new stack chunks in bytes.
+ *  @field[Chunk*][registers]
+ *   Chunks of stack memory for registers allocated with FbleAllocRegisters,
+ *   most recent first.
+ *  @field[intptr_t][registers_top]
+ *   The next free byte of registers in the first registers chunk.
+ *  @field[intptr_t][registers_max]
+ *   The end of the first registers chunk.
+ *  @field[size_t][merge_limit]
+ *   How many bytes we can allocate on a frame before we stop merging frames.
+ *  @field[bool][merge_tuning] True to auto tune the merge limit.
+ *  @field[size_t][tuning_calls] Calls since the merge limit was last tuned.
+ *  @field[size_t][tuning_promoted]
+ *   Value of stats.promoted when the merge limit was last tuned.
+ *  @field[FbleValueV][promoting]
+ *   Stack of newly GC reallocated values whose fields have yet to be GC
+ *   reallocated. promoting.size is the number of values on the stack.
+ *  @field[size_t][promoting_capacity]
+ *   Allocated capacity of the promoting stack.
  *  @field[uintptr_t][ref_id] The next available ref_id.
- *  @field[ForeignV][foreign] List of registered foreign functions.
+ *  @field[ForeignTable][foreign] Table of registered foreign functions.
+ *  @field[CachedValue*][cached]
+ *   Direct mapped cache of VALUE_CACHE_ENTRIES literal values, by cache id.
+ *  @field[FbleValue**][hash_cons]
+ *   Direct mapped cache of HASH_CONS_ENTRIES small GC allocated values to
+ *   share instead of allocating new identical values. Unused entries are
+ *   NULL. NULL if hash consing is disabled.
+ *  @field[ExecutableV][executables]
+ *   Executables that snapshots can refer to, by index. The first entry
+ *   stands for the executables of partially applied functions.
+ *  @field[uint64_t][modules]
+ *   Hash of the contents of the modules linked into the runtime, in the
+ *   order they were linked.
+ *  @field[FbleRuntimeStats][stats] Runtime statistics.
+ *  @field[FILE*][stats_output]
+ *   Where to print runtime statistics when the runtime is freed. May be
+ *   NULL.
  */
 typedef struct {
   FbleRuntime _base;
@@ -424,33 +782,108 @@ typedef struct {
   void* stack;
   Frame* top;
   Gc gc;
+  Heap heap;
+  Sweeper sweeper;
   Chunk* chunks;
+  size_t idle_chunks;
+  size_t chunk_size;
+  Chunk* registers;
+  intptr_t registers_top;
+  intptr_t registers_max;
+  size_t merge_limit;
+  bool merge_tuning;
+  size_t tuning_calls;
+  size_t tuning_promoted;
+  FbleValueV promoting;
+  size_t promoting_capacity;
   uintptr_t ref_id;
-  ForeignV foreign;
+  ForeignTable foreign;
+  CachedValue* cached;
+  FbleValue** hash_cons;
+  ExecutableV executables;
+  uint64_t modules;
+  FbleRuntimeStats stats;
+  FILE* stats_output;
 } Runtime;
 
+#ifndef __WIN32
+/**
+ * @value[gStackLimitLock] Lock for the stack limit globals.
+ *  @type[pthread_mutex_t]
+ */
+static pthread_mutex_t gStackLimitLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @value[gStackLimitUsers] Number of runtimes that raised the stack limit.
+ *  @type[size_t]
+ */
+static size_t gStackLimitUsers = 0;
+
+/**
+ * @value[gOriginalStackLimit]
+ * @ The stack limit before the first runtime raised it.
+ *  @type[struct rlimit]
+ */
+static struct rlimit gOriginalStackLimit;
+#endif // __WIN32
+
+/**
+ * @value[gLastCacheId] The most recently assigned cache id.
+ *  Cache ids are shared by all runtimes. They are hashed to pick cache
+ *  entries, so it doesn't matter that ids of freed code aren't reused.
+ *
+ *  @type[size_t]
+ */
+static size_t gLastCacheId = 0;
+
+static FbleValue* OwnerOf(FbleValue* value);
 static StackAllocatedValue* StackAllocatedValueOf(FbleValue* value);
 static GcAllocatedValue* GcAllocatedValueOf(FbleValue* value);
+static FbleUnionValue* ListCellUnion(FbleValue* owner, size_t i);
+static FbleStructValue* ListCellStruct(FbleValue* owner, size_t i);
+static size_t ListBlockCells(FbleValue* owner);
+static void LinkListBlock(FbleValue* owner, size_t n, uint32_t flags);
 
+static Chunk* AllocChunk(Runtime* runtime, size_t size);
 static void* StackAlloc(Runtime* runtime, size_t size);
+static void FreeChunks(Runtime* runtime, Chunk** chunks);
+static void ReleaseChunks(Runtime* runtime, Chunk** chunks);
+static bool ShouldMerge(Runtime* runtime);
+static void TuneMergeLimit(Runtime* runtime);
 static FbleValue* NewValueRaw(Runtime* runtime, ValueTag tag, size_t size);
 static FbleValue* NewGcValueRaw(Runtime* runtime, Frame* frame, ValueTag tag, size_t size);
-static void FreeGcValue(GcAllocatedValue* value);
+static size_t GcValueSize(FbleValue* value);
+static void* HeapAlloc(Heap* heap, size_t size);
+static void HeapFree(Heap* heap, void* ptr, size_t size);
+static void FreeGcValue(Runtime* runtime, GcAllocatedValue* value);
+static void SweepGcValue(Runtime* runtime, GcAllocatedValue* value);
+static size_t CachedValueSlot(size_t id);
+static size_t HashConsSlot(ValueTag tag, uint32_t data, size_t argc, FbleValue** args);
+static FbleValue* HashCons(Runtime* runtime, ValueTag tag, uint32_t data, size_t argc, FbleValue** args);
+static void* SweeperThread(void* data);
+static void HandOff(Runtime* runtime, bool wait);
+static bool IsOnCallerFrame(Frame* frame, FbleValue* value);
+static FbleValue* Promote(Runtime* runtime, FbleValue* value);
 static FbleValue* GcRealloc(Runtime* runtime, FbleValue* value);
 
 static FbleValue* RefValue(uintptr_t id);
 static bool IsRefValue(FbleValue* value);
 static uintptr_t RefValueId(FbleValue* value);
-static void RefAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValue** r);
+static void MarkRefAssigned(Runtime* runtime, FbleValue* value);
+static void RefAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValueV* traversed, FbleValue** r);
 static void RefsAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValue* x);
 
 static bool IsPacked(FbleValue* value);
+static uintptr_t PackedLength(FbleValue* value);
+static FbleValue* Pack(uintptr_t data, uintptr_t length);
 static bool IsAlloced(FbleValue* value);
 
 
+static void Mark(Gc* gc, GcAllocatedValue* value);
 static void MarkRef(Gc* gc, FbleValue* src, FbleValue* dst);
 static void MarkRefs(Gc* gc, FbleValue* value);
-static void IncrGc(Runtime* runtime);
+static bool IncrGc(Runtime* runtime);
+static void PaceGc(Runtime* runtime);
 static void PushFrame(Runtime* runtime, bool merge);
 static void CompactFrame(Runtime* runtime, bool merge, size_t n, FbleValue** save);
 
@@ -463,6 +896,27 @@ static FbleValue* PartialApply(Runtime* runtime, FbleFuncValue* function, size_t
 
 static FbleValue* TailCall(Runtime* runtime, FbleProfileThread* profile);
 static FbleValue* Eval(Runtime* runtime, FbleValue* func, size_t argc, FbleValue** args);
+
+static uint64_t HashString(uint64_t hash, const char* str);
+static uint64_t HashForeign(FbleModulePath* path, const char* name);
+static void InsertForeign(ForeignTable* table, ForeignEntry entry);
+
+static void RaiseStackLimit();
+static void RestoreStackLimit();
+
+static void InitValueTable(ValueTable* table);
+static ValueEntry* LookupValue(ValueTable* table, FbleValue* key);
+static void InsertValue(ValueTable* table, ValueEntry* entry, FbleValue* key, uintptr_t data);
+static FbleValue* Adopt(Runtime* runtime, Runtime* worker, ValueTable* table, FbleValue* value);
+
+static uint64_t HashWord(uint64_t hash, uint64_t word);
+static uint64_t SnapshotFingerprint(Runtime* runtime);
+static bool ExecutableIndex(Runtime* runtime, ValueTable* runs, FbleExecutable* exe, uint64_t* index);
+static bool NumberValue(ValueTable* table, FbleValueV* objects, FbleValue* value, const char** error);
+static uint64_t EncodeValue(ValueTable* table, FbleValue* value);
+static void WriteWord(SnapshotWriter* writer, uint64_t word);
+static bool ReadWord(SnapshotReader* reader, uint64_t* word);
+static bool DecodeValue(FbleValueV* objects, FbleValue** value);
 
 /**
  * @func[Clear] Initialize a list to empty.
@@ -472,8 +926,8 @@ static FbleValue* Eval(Runtime* runtime, FbleValue* func, size_t argc, FbleValue
  */
 static void Clear(List* list)
 {
-  list->next = list;
-  list->prev = list;
+  list->head = NULL;
+  list->tail = NULL;
 }
 
 /**
@@ -483,7 +937,7 @@ static void Clear(List* list)
  */
 static bool IsEmpty(List* list)
 {
-  return list->next == list;
+  return list->head == NULL;
 }
 
 /**
@@ -494,32 +948,30 @@ static bool IsEmpty(List* list)
  */
 static GcAllocatedValue* Get(List* list)
 {
-  if (list->next == list) {
-    return NULL;
+  GcAllocatedValue* got = list->head;
+  if (got != NULL) {
+    list->head = got->next;
+    if (list->head == NULL) {
+      list->tail = NULL;
+    }
   }
-
-  GcAllocatedValue* got = (GcAllocatedValue*)list->next;
-  got->list.prev->next = got->list.next;
-  got->list.next->prev = got->list.prev;
-  Clear(&got->list);
   return got;
 }
 
 /**
- * @func[MoveTo] Moves a value from one list to another.
- *  @arg[List*][dst] The list to move the value to.
- *  @arg[FbleValue*][value] The value to move.
+ * @func[Add] Adds a value to a list.
+ *  @arg[List*][dst] The list to add the value to.
+ *  @arg[FbleValue*][value] The value to add. Must not belong to any list.
  *  @sideeffects
- *   Moves the value from its current list to @a[dst].
+ *   Adds the value to @a[dst].
  */
-static void MoveTo(List* dst, GcAllocatedValue* value)
+static void Add(List* dst, GcAllocatedValue* value)
 {
-  value->list.prev->next = value->list.next;
-  value->list.next->prev = value->list.prev;
-  value->list.next = dst->next;
-  value->list.prev = dst;
-  dst->next->prev = &value->list;
-  dst->next = &value->list;
+  value->next = dst->head;
+  dst->head = value;
+  if (dst->tail == NULL) {
+    dst->tail = value;
+  }
 }
 
 /**
@@ -532,39 +984,92 @@ static void MoveTo(List* dst, GcAllocatedValue* value)
 static void MoveAllTo(List* dst, List* src)
 {
   if (!IsEmpty(src)) {
-    dst->next->prev = src->prev;
-    src->prev->next = dst->next;
-    dst->next = src->next;
-    dst->next->prev = dst;
-    src->next = src;
-    src->prev = src;
+    src->tail->next = dst->head;
+    dst->head = src->head;
+    if (dst->tail == NULL) {
+      dst->tail = src->tail;
+    }
+    Clear(src);
   }
 }
 
+/**
+ * @func[MoveToAlloced] Adds a value to a frame's alloced list.
+ *  @arg[Frame*][frame] The frame to add the value to.
+ *  @arg[GcAllocatedValue*][value]
+ *   The value to add. Must not belong to any list.
+ *  @sideeffects
+ *   Adds the value to the frame's alloced list.
+ */
 static void MoveToAlloced(Frame* frame, GcAllocatedValue* value)
 {
   assert(value->gen == frame->gen);
-  MoveTo(&frame->alloced, value);
+  Add(&frame->alloced, value);
 }
 
+/**
+ * @func[MoveToMarked] Marks a value on a frame's unmarked list.
+ *  @arg[Frame*][frame] The frame whose unmarked list the value is on.
+ *  @arg[GcAllocatedValue*][value] The value to mark.
+ *  @sideeffects
+ *   Marks the value so that GC of the frame treats it as reachable.
+ */
 static void MoveToMarked(Frame* frame, GcAllocatedValue* value)
 {
-  assert(value->gen != frame->gen);
   assert(value->gen >= frame->min_gen);
   assert(value->gen < frame->max_gen);
-  MoveTo(&frame->marked, value);
+  value->gen = frame->gen;
 }
 
+/**
+ * @func[MoveToUnmarked] Adds a value to a frame's unmarked list.
+ *  @arg[Frame*][frame] The frame to add the value to.
+ *  @arg[GcAllocatedValue*][value]
+ *   The value to add. Must not belong to any list.
+ *  @sideeffects
+ *   Adds the value to the frame's unmarked list.
+ */
 static void MoveToUnmarked(Frame* frame, GcAllocatedValue* value)
 {
   assert(value->gen != frame->gen);
   assert(value->gen >= frame->min_gen);
   assert(value->gen < frame->max_gen);
-  MoveTo(&frame->unmarked, value);
+  Add(&frame->unmarked, value);
+}
+
+/**
+ * @func[InGc] Checks whether a value is currently undergoing GC.
+ *  @arg[Gc*][gc] The current gc.
+ *  @arg[GcAllocatedValue*][value] The value to check.
+ *  @returns[bool]
+ *   True if the value is owned by the current GC cycle, false otherwise.
+ */
+static bool InGc(Gc* gc, GcAllocatedValue* value)
+{
+  return value->gen >= gc->min_gen && value->gen < gc->max_gen;
+}
+
+/**
+ * @func[OwnerOf] Gets the value that owns the memory for a value.
+ *  @arg[FbleValue*][value] The value to get the owner of.
+ *  @returns[FbleValue*]
+ *   The owner of the list block if @a[value] is an interior value of a list
+ *   block, @a[value] otherwise.
+ */
+static FbleValue* OwnerOf(FbleValue* value)
+{
+  if (IsAlloced(value) && (value->flags & FbleValueFlagInteriorBit)) {
+    FbleValue** words = (FbleValue**)value;
+    return (FbleValue*)(words - (value->flags >> FbleValueFlagCountShift));
+  }
+  return value;
 }
 
 /**
  * @func[StackAllocatedValueOf] Gets the StackAllocatedValue for this value.
+ *  For an interior value of a list block, gets the StackAllocatedValue of the
+ *  owner of the list block.
+ *
  *  @arg[FbleValue*][value] The value to get the StackAllocatedValue* of.
  *  @returns[StackAllocatedValue*] The StackAllocatedValue* for this value.
  *  @sideeffects
@@ -572,13 +1077,16 @@ static void MoveToUnmarked(Frame* frame, GcAllocatedValue* value)
  */
 static StackAllocatedValue* StackAllocatedValueOf(FbleValue* value)
 {
-  intptr_t ptr = (intptr_t)value;
+  intptr_t ptr = (intptr_t)OwnerOf(value);
   ptr -= offsetof(StackAllocatedValue, value);
   return (StackAllocatedValue*)ptr;
 }
 
 /**
  * @func[GcAllocatedValueOf] Gets the GcAllocatedValue for this value.
+ *  For an interior value of a list block, gets the GcAllocatedValue of the
+ *  owner of the list block.
+ *
  *  @arg[FbleValue*][value] The value to get the GcAllocatedValue* of.
  *  @returns[GcAllocatedValue*] The GcAllocatedValue* for this value.
  *  @sideeffects
@@ -586,11 +1094,109 @@ static StackAllocatedValue* StackAllocatedValueOf(FbleValue* value)
  */
 static GcAllocatedValue* GcAllocatedValueOf(FbleValue* value)
 {
-  intptr_t ptr = (intptr_t)value;
+  intptr_t ptr = (intptr_t)OwnerOf(value);
   ptr -= offsetof(GcAllocatedValue, value);
   return (GcAllocatedValue*)ptr;
 }
 
+/**
+ * @func[ListCellUnion] Gets the union value of a list block cell.
+ *  @arg[FbleValue*][owner] The owner of the list block.
+ *  @arg[size_t][i] The index of the cell.
+ *  @returns[FbleUnionValue*] The union value of the ith cell.
+ */
+static FbleUnionValue* ListCellUnion(FbleValue* owner, size_t i)
+{
+  FbleValue** words = (FbleValue**)owner;
+  return (FbleUnionValue*)(words + i * LIST_CELL_WORDS);
+}
+
+/**
+ * @func[ListCellStruct] Gets the struct value of a list block cell.
+ *  @arg[FbleValue*][owner] The owner of the list block.
+ *  @arg[size_t][i] The index of the cell.
+ *  @returns[FbleStructValue*] The struct value of the ith cell.
+ */
+static FbleStructValue* ListCellStruct(FbleValue* owner, size_t i)
+{
+  return (FbleStructValue*)(ListCellUnion(owner, i) + 1);
+}
+
+/**
+ * @func[ListBlockCells] Gets the number of cells in a list block.
+ *  @arg[FbleValue*][owner] The owner of the list block.
+ *  @returns[size_t] The number of cells in the list block.
+ */
+static size_t ListBlockCells(FbleValue* owner)
+{
+  assert(owner->flags & FbleValueFlagBlockBit);
+  return owner->flags >> FbleValueFlagCountShift;
+}
+
+/**
+ * @func[LinkListBlock] Sets up the values of a list block.
+ *  The element of each cell and the tail of the last cell are left as is.
+ *
+ *  @arg[FbleValue*][owner] Memory for the list block.
+ *  @arg[size_t][n] The number of cells in the list block.
+ *  @arg[uint32_t][flags]
+ *   Additional flags to set on all the values of the list block.
+ *  @sideeffects
+ *   Sets the flags, tags, and interior references of values in the list
+ *   block.
+ */
+static void LinkListBlock(FbleValue* owner, size_t n, uint32_t flags)
+{
+  assert(n > 0 && n <= MAX_LIST_BLOCK_CELLS);
+  for (size_t i = 0; i < n; ++i) {
+    FbleUnionValue* cons = ListCellUnion(owner, i);
+    FbleStructValue* pair = ListCellStruct(owner, i);
+    uint32_t offset = (uint32_t)((FbleValue**)cons - (FbleValue**)owner);
+
+    cons->_base.data = 0;
+    cons->_base.flags = (i == 0)
+      ? (UNION_VALUE | flags | FbleValueFlagBlockBit | (n << FbleValueFlagCountShift))
+      : (UNION_VALUE | flags | FbleValueFlagInteriorBit | (offset << FbleValueFlagCountShift));
+    cons->arg = &pair->_base;
+
+    offset = (uint32_t)((FbleValue**)pair - (FbleValue**)owner);
+    pair->_base.data = 2;
+    pair->_base.flags = STRUCT_VALUE | flags | FbleValueFlagInteriorBit | (offset << FbleValueFlagCountShift);
+    if (i + 1 < n) {
+      pair->fields[1] = &ListCellUnion(owner, i + 1)->_base;
+    }
+  }
+}
+
+/**
+ * @func[AllocChunk] Gets a new stack chunk.
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @arg[size_t][size] The number of bytes the chunk needs room for.
+ *  @returns[Chunk*] A chunk with room for at least size bytes.
+ *  @sideeffects
+ *   Reuses an idle chunk or allocates a new one. The chunk should be
+ *   released with ReleaseChunks when no longer needed.
+ */
+static Chunk* AllocChunk(Runtime* runtime, size_t size)
+{
+  Chunk* chunk = runtime->chunks;
+  if (chunk != NULL && chunk->size >= sizeof(Chunk) + size) {
+    runtime->chunks = chunk->next;
+    runtime->idle_chunks--;
+    runtime->stats.stack_idle_bytes -= chunk->size;
+    return chunk;
+  }
+
+  size_t chunk_size = runtime->chunk_size;
+  if (chunk_size < sizeof(Chunk) + size) {
+    chunk_size = sizeof(Chunk) + size;
+  }
+  chunk = (Chunk*)FbleAllocRaw(chunk_size);
+  chunk->size = chunk_size;
+  runtime->stats.stack_bytes += chunk_size;
+  return chunk;
+}
+
 /**
  * @func[StackAlloc] Allocates memory on the stack.
  *  @arg[Runtime*][runtime] The runtime context.
@@ -603,17 +1209,11 @@ static void* StackAlloc(Runtime* runtime, size_t size)
 {
   Frame* frame = runtime->top;
   if (frame->max < frame->top + size) {
-    Chunk* chunk = runtime->chunks;
-    if (chunk == NULL) {
-      chunk = (Chunk*)FbleAllocRaw(CHUNK_SIZE);
-    } else {
-      runtime->chunks = chunk->next;
-    }
-
+    Chunk* chunk = AllocChunk(runtime, size);
     chunk->next = frame->chunks;
     frame->chunks = chunk;
     frame->top = size + (intptr_t)(chunk + 1);
-    frame->max = CHUNK_SIZE + (intptr_t)chunk;
+    frame->max = chunk->size + (intptr_t)chunk;
   }
 
   void* result = (void*)frame->top;
@@ -621,6 +1221,107 @@ static void* StackAlloc(Runtime* runtime, size_t size)
   return result;
 }
 
+/**
+ * @func[FreeChunks] Frees a list of stack chunks.
+ *  @arg[Runtime*][runtime] The runtime the chunks belong to.
+ *  @arg[Chunk**][chunks] The list of chunks to free.
+ *  @sideeffects
+ *   Frees the chunks and sets the list to NULL.
+ */
+static void FreeChunks(Runtime* runtime, Chunk** chunks)
+{
+  for (Chunk* chunk = *chunks; chunk != NULL; chunk = *chunks) {
+    *chunks = chunk->next;
+    runtime->stats.stack_bytes -= chunk->size;
+    FbleFree(chunk);
+  }
+}
+
+/**
+ * @func[ReleaseChunks] Releases stack chunks no longer in use.
+ *  Holds on to up to MAX_IDLE_CHUNKS idle chunks for reuse. Frees the rest.
+ *
+ *  @arg[Runtime*][runtime] The runtime the chunks belong to.
+ *  @arg[Chunk**][chunks] The list of chunks to release.
+ *  @sideeffects
+ *   Moves chunks to the runtime's idle chunks or frees them, and sets the
+ *   list to NULL.
+ */
+static void ReleaseChunks(Runtime* runtime, Chunk** chunks)
+{
+  for (Chunk* chunk = *chunks; chunk != NULL; chunk = *chunks) {
+    *chunks = chunk->next;
+    if (runtime->idle_chunks < MAX_IDLE_CHUNKS) {
+      chunk->next = runtime->chunks;
+      runtime->chunks = chunk;
+      runtime->idle_chunks++;
+      runtime->stats.stack_idle_bytes += chunk->size;
+    } else {
+      runtime->stats.stack_bytes -= chunk->size;
+      FbleFree(chunk);
+    }
+  }
+}
+
+/**
+ * @func[ShouldMerge] Decides whether to merge a callee frame into the top frame.
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @returns[bool] True if the callee frame should be merged.
+ *  @sideeffects
+ *   @i Tunes the merge limit if merge limit tuning is enabled.
+ *   @i Counts merges in the runtime stats.
+ */
+static bool ShouldMerge(Runtime* runtime)
+{
+  if (runtime->merge_tuning) {
+    TuneMergeLimit(runtime);
+  }
+
+  bool merge = runtime->top->caller != NULL
+    && runtime->top->max == runtime->top->caller->max
+    && (size_t)(runtime->top->top - runtime->top->caller->top) + runtime->top->hash_consed < runtime->merge_limit;
+  if (merge) {
+    runtime->stats.merges++;
+  }
+  return merge;
+}
+
+/**
+ * @func[TuneMergeLimit] Adjusts the merge limit based on promotion rate.
+ *  Every MERGE_TUNING_PERIOD calls, doubles the merge limit if more than one
+ *  value was promoted to the GC heap for every four calls, or halves the
+ *  merge limit if fewer than one value was promoted for every 64 calls.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @sideeffects
+ *   Updates the runtime merge limit.
+ */
+static void TuneMergeLimit(Runtime* runtime)
+{
+  runtime->tuning_calls++;
+  if (runtime->tuning_calls < MERGE_TUNING_PERIOD) {
+    return;
+  }
+
+  size_t promoted = runtime->stats.promoted - runtime->tuning_promoted;
+  if (promoted > MERGE_TUNING_PERIOD / 4) {
+    runtime->merge_limit *= 2;
+    if (runtime->merge_limit < MIN_TUNED_MERGE_LIMIT) {
+      runtime->merge_limit = MIN_TUNED_MERGE_LIMIT;
+    } else if (runtime->merge_limit > MAX_TUNED_MERGE_LIMIT) {
+      runtime->merge_limit = MAX_TUNED_MERGE_LIMIT;
+    }
+  } else if (promoted < MERGE_TUNING_PERIOD / 64) {
+    runtime->merge_limit /= 2;
+    if (runtime->merge_limit < MIN_TUNED_MERGE_LIMIT) {
+      runtime->merge_limit = MIN_TUNED_MERGE_LIMIT;
+    }
+  }
+
+  runtime->tuning_calls = 0;
+  runtime->tuning_promoted = runtime->stats.promoted;
+}
+
 /**
  * @func[NewValueRaw] Allocates a new value on the stack.
  *  @arg[Runtime*][runtime] The runtime context.
@@ -634,6 +1335,7 @@ static FbleValue* NewValueRaw(Runtime* runtime, ValueTag tag, size_t size)
   StackAllocatedValue* value = StackAlloc(runtime, size + offsetof(StackAllocatedValue, value));
   value->gcframe = ((uintptr_t)runtime->top) ^ ONE;
   value->value.flags = tag;
+  runtime->stats.stack_allocs++;
   return &value->value;
 }
 
@@ -649,49 +1351,397 @@ static FbleValue* NewValueRaw(Runtime* runtime, ValueTag tag, size_t size)
  */
 static FbleValue* NewGcValueRaw(Runtime* runtime, Frame* frame, ValueTag tag, size_t size)
 {
-  IncrGc(runtime);
+  PaceGc(runtime);
+  runtime->stats.gc_allocs++;
+  runtime->stats.gc_bytes += size + offsetof(GcAllocatedValue, value);
+  if (runtime->stats.gc_bytes > runtime->stats.max_gc_bytes) {
+    runtime->stats.max_gc_bytes = runtime->stats.gc_bytes;
+  }
 
-  GcAllocatedValue* value = (GcAllocatedValue*)FbleAllocRaw(size + offsetof(GcAllocatedValue, value));
+  GcAllocatedValue* value = (GcAllocatedValue*)HeapAlloc(&runtime->heap, size + offsetof(GcAllocatedValue, value));
   value->value.flags = tag | FbleValueFlagIsGcAllocBit;
   value->gen = frame->gen;
-
-  Clear(&value->list);
   MoveToAlloced(frame, value);
   return &value->value;
 }
 
 /**
- * @func[FreeGcValue] Frees a GC allocated value.
- *  @arg[GcAllocatedValue*][value] The value to free. May be NULL.
- *  @sideeffects
- *   Frees any resources outside of the heap that this value holds on to.
+ * @func[GcValueSize] Computes the allocated size of a GC value.
+ *  @arg[FbleValue*][value] The GC allocated value.
+ *  @returns[size_t]
+ *   The number of bytes allocated for the value, including the
+ *   GcAllocatedValue header.
  */
-static void FreeGcValue(GcAllocatedValue* value)
+static size_t GcValueSize(FbleValue* value)
 {
-  if (value != NULL) {
-    if ((value->value.flags & FbleValueFlagTagBits) == NATIVE_VALUE) {
-      NativeValue* v = (NativeValue*)&value->value;
-      if (v->on_free != NULL) {
-        v->on_free(v->data);
+  size_t size = offsetof(GcAllocatedValue, value);
+  switch ((ValueTag)(value->flags & FbleValueFlagTagBits)) {
+    case STRUCT_VALUE: {
+      return size + sizeof(FbleStructValue) + value->data * sizeof(FbleValue*);
+    }
+
+    case UNION_VALUE: {
+      if (value->flags & FbleValueFlagBlockBit) {
+        return size + ListBlockCells(value) * LIST_CELL_WORDS * sizeof(FbleValue*);
       }
+      return size + sizeof(FbleUnionValue);
+    }
+
+    case FUNC_VALUE: {
+      FbleFuncValue* v = (FbleFuncValue*)value;
+      return size + sizeof(FbleFuncValue) + v->function.executable.num_statics * sizeof(FbleValue*);
+    }
+
+    case NATIVE_VALUE: {
+      return size + sizeof(NativeValue);
     }
-    FbleFree(value);
   }
+
+  FbleUnreachable("should never get here");
+  return 0;
 }
 
 /**
- * @func[GcRealloc] Reallocate a value onto the heap.
- *  @arg[Runtime*][runtime] The runtime context.
- *  @arg[FbleValue*][value] The value to allocate.
- *  @returns[FbleValue*] A gc allocated value equivalent to @a[value].
+ * @func[HeapAlloc] Allocates memory for a GC object.
+ *  @arg[Heap*][heap] The heap to allocate from.
+ *  @arg[size_t][size] The number of bytes to allocate.
+ *  @returns[void*] Pointer to the allocated memory.
  *  @sideeffects
- *   @i Allocates GC values on the heap.
- *   @i Records mapping from original value to GC value on the stack.
+ *   Allocates memory that should be freed using HeapFree with the same size
+ *   when no longer needed.
  */
-static FbleValue* GcRealloc(Runtime* runtime, FbleValue* value)
+static void* HeapAlloc(Heap* heap, size_t size)
 {
-  // Packed values and NULL need not be allocated at all.
-  if (!IsAlloced(value)) {
+  if (size > MAX_SIZE_CLASS_BYTES) {
+    return FbleAllocRaw(size);
+  }
+
+  size_t class = (size + sizeof(FbleValue*) - 1) / sizeof(FbleValue*);
+  size = class * sizeof(FbleValue*);
+  FbleCountAlloc(size);
+
+  FreeObject* object = heap->free[class];
+  if (object != NULL) {
+    heap->free[class] = object->next;
+    return object;
+  }
+
+  if (heap->max < heap->top + size) {
+    Slab* slab = malloc(SLAB_SIZE);
+    slab->next = heap->slabs;
+    heap->slabs = slab;
+    heap->top = (intptr_t)(slab + 1);
+    heap->max = SLAB_SIZE + (intptr_t)slab;
+  }
+
+  void* result = (void*)heap->top;
+  heap->top += size;
+  return result;
+}
+
+/**
+ * @func[HeapFree] Frees memory for a GC object.
+ *  @arg[Heap*][heap] The heap the memory was allocated from.
+ *  @arg[void*][ptr] The memory to free.
+ *  @arg[size_t][size] The size passed to HeapAlloc for the memory.
+ *  @sideeffects
+ *   Frees the memory for reuse by later calls to HeapAlloc.
+ */
+static void HeapFree(Heap* heap, void* ptr, size_t size)
+{
+  if (size > MAX_SIZE_CLASS_BYTES) {
+    FbleFree(ptr);
+    return;
+  }
+
+  size_t class = (size + sizeof(FbleValue*) - 1) / sizeof(FbleValue*);
+  FbleCountFree(class * sizeof(FbleValue*));
+
+  FreeObject* object = (FreeObject*)ptr;
+  object->next = heap->free[class];
+  heap->free[class] = object;
+}
+
+/**
+ * @func[FreeGcValue] Frees a GC allocated value.
+ *  @arg[Runtime*][runtime] The runtime the value was allocated on.
+ *  @arg[GcAllocatedValue*][value] The value to free. May be NULL.
+ *  @sideeffects
+ *   Frees any resources outside of the heap that this value holds on to.
+ */
+static void FreeGcValue(Runtime* runtime, GcAllocatedValue* value)
+{
+  if (value != NULL) {
+    if ((value->value.flags & FbleValueFlagTagBits) == NATIVE_VALUE) {
+      NativeValue* v = (NativeValue*)&value->value;
+      if (v->on_free != NULL) {
+        v->on_free(v->data);
+      }
+    }
+
+    if ((value->value.flags & FbleValueFlagTagBits) == FUNC_VALUE) {
+      FbleExecutable* exe = &((FbleFuncValue*)&value->value)->function.executable;
+      if (exe->on_free != NULL) {
+        exe->on_free(exe->data);
+      }
+    }
+
+    size_t size = GcValueSize(&value->value);
+    runtime->stats.gc_bytes -= size;
+    HeapFree(&runtime->heap, value, size);
+  }
+}
+
+/**
+ * @func[SweepGcValue] Frees a garbage GC allocated value.
+ *  @arg[Runtime*][runtime] The runtime the value was allocated on.
+ *  @arg[GcAllocatedValue*][value] The value to free.
+ *  @sideeffects
+ *   Frees the value, or hands it off to the background sweeper thread to
+ *   free if that's enabled and allowed for the value.
+ */
+static void SweepGcValue(Runtime* runtime, GcAllocatedValue* value)
+{
+  if (runtime->hash_cons != NULL && (value->value.flags & FbleValueFlagHashConsBit)) {
+    FbleValue* v = &value->value;
+    ValueTag tag = (ValueTag)(v->flags & FbleValueFlagTagBits);
+    size_t slot = (tag == STRUCT_VALUE)
+      ? HashConsSlot(tag, v->data, v->data, ((FbleStructValue*)v)->fields)
+      : HashConsSlot(tag, v->data, 1, &((FbleUnionValue*)v)->arg);
+    if (runtime->hash_cons[slot] == v) {
+      runtime->hash_cons[slot] = NULL;
+    }
+  }
+
+  Sweeper* sweeper = &runtime->sweeper;
+  if (sweeper->enabled
+      && (value->value.flags & FbleValueFlagTagBits) == NATIVE_VALUE
+      && ((NativeValue*)&value->value)->on_free != NULL
+      && ((NativeValue*)&value->value)->concurrent) {
+    Add(&sweeper->batch, value);
+    sweeper->batch_size++;
+    if (sweeper->batch_size == SWEEP_BATCH_SIZE) {
+      HandOff(runtime, false);
+    }
+    return;
+  }
+
+  FreeGcValue(runtime, value);
+}
+
+/**
+ * @func[CachedValueSlot] Picks the literal value cache entry for an id.
+ *  @arg[size_t][id] The cache id of the value.
+ *  @returns[size_t] The index of the entry in the literal value cache.
+ */
+static size_t CachedValueSlot(size_t id)
+{
+  uint64_t hash = (uint64_t)id * 0x9E3779B97F4A7C15ULL;
+  return (size_t)(hash >> 32) & (VALUE_CACHE_ENTRIES - 1);
+}
+
+/**
+ * @func[HashConsSlot] Picks the hash cons cache entry for a value.
+ *  @arg[ValueTag][tag] STRUCT_VALUE or UNION_VALUE.
+ *  @arg[uint32_t][data] The FbleValue.data field of the value.
+ *  @arg[size_t][argc] The number of fields of the value.
+ *  @arg[FbleValue**][args] The fields of the value.
+ *  @returns[size_t] The index of the entry in the hash cons cache.
+ */
+static size_t HashConsSlot(ValueTag tag, uint32_t data, size_t argc, FbleValue** args)
+{
+  uint64_t hash = (((uint64_t)data << 2) | tag) * 0x9E3779B97F4A7C15ULL;
+  for (size_t i = 0; i < argc; ++i) {
+    hash = (hash ^ (uint64_t)(uintptr_t)args[i]) * 0x9E3779B97F4A7C15ULL;
+  }
+  return (size_t)(hash >> 32) & (HASH_CONS_ENTRIES - 1);
+}
+
+/**
+ * @func[HashCons] Allocates a small struct or union value, sharing if possible.
+ *  Only values whose fields are all packed or GC allocated are hash consed.
+ *  The cache only hands out values owned by the top frame, because those
+ *  outlive any use the top frame or its callees can make of them.
+ *
+ *  @arg[Runtime*][runtime] The runtime, with hash consing enabled.
+ *  @arg[ValueTag][tag] STRUCT_VALUE or UNION_VALUE.
+ *  @arg[uint32_t][data] The FbleValue.data field of the value.
+ *  @arg[size_t][argc]
+ *   The number of fields of the value. Must be 1 for a union value.
+ *  @arg[FbleValue**][args] The fields of the value.
+ *  @returns[FbleValue*]
+ *   An existing GC allocated value with the given fields, a new GC allocated
+ *   value with the given fields, or NULL if the value can't be hash consed.
+ *  @sideeffects
+ *   May GC allocate a new value on the top frame and add it to the hash cons
+ *   cache. Updates hash cons stats.
+ */
+static FbleValue* HashCons(Runtime* runtime, ValueTag tag, uint32_t data, size_t argc, FbleValue** args)
+{
+  for (size_t i = 0; i < argc; ++i) {
+    if (!IsPacked(args[i])
+        && !(IsAlloced(args[i]) && (args[i]->flags & FbleValueFlagIsGcAllocBit))) {
+      return NULL;
+    }
+  }
+
+  size_t slot = HashConsSlot(tag, data, argc, args);
+  FbleValue* entry = runtime->hash_cons[slot];
+  if (entry != NULL
+      && GcAllocatedValueOf(entry)->gen == runtime->top->gen
+      && (ValueTag)(entry->flags & FbleValueFlagTagBits) == tag
+      && entry->data == data) {
+    FbleValue** fields = (tag == STRUCT_VALUE)
+      ? ((FbleStructValue*)entry)->fields
+      : &((FbleUnionValue*)entry)->arg;
+    bool same = true;
+    for (size_t i = 0; same && i < argc; ++i) {
+      same = (fields[i] == args[i]);
+    }
+
+    if (same) {
+      runtime->stats.hash_cons_hits++;
+      return entry;
+    }
+  }
+
+  FbleValue* value = NULL;
+  if (tag == STRUCT_VALUE) {
+    FbleStructValue* v = (FbleStructValue*)NewGcValueRaw(runtime, runtime->top,
+        STRUCT_VALUE, sizeof(FbleStructValue) + argc * sizeof(FbleValue*));
+    memcpy(v->fields, args, argc * sizeof(FbleValue*));
+    value = &v->_base;
+  } else {
+    FbleUnionValue* v = (FbleUnionValue*)NewGcValueRaw(runtime, runtime->top,
+        UNION_VALUE, sizeof(FbleUnionValue));
+    v->arg = args[0];
+    value = &v->_base;
+  }
+  value->data = data;
+  value->flags |= FbleValueFlagHashConsBit;
+  runtime->top->hash_consed += GcValueSize(value);
+  runtime->hash_cons[slot] = value;
+  runtime->stats.hash_cons_misses++;
+  return value;
+}
+
+/**
+ * @func[SweeperThread] Body of the background sweeper thread.
+ *  @arg[void*][data] The Sweeper to run.
+ *  @returns[void*] NULL.
+ *  @sideeffects
+ *   Calls on_free on values handed off to the sweeper until told to stop.
+ */
+static void* SweeperThread(void* data)
+{
+  Sweeper* sweeper = (Sweeper*)data;
+
+  pthread_mutex_lock(&sweeper->lock);
+  while (true) {
+    while (IsEmpty(&sweeper->todo) && !sweeper->stop) {
+      pthread_cond_wait(&sweeper->signal, &sweeper->lock);
+    }
+
+    if (IsEmpty(&sweeper->todo)) {
+      break;
+    }
+
+    List work;
+    Clear(&work);
+    MoveAllTo(&work, &sweeper->todo);
+    sweeper->busy = true;
+    pthread_mutex_unlock(&sweeper->lock);
+
+    for (GcAllocatedValue* value = work.head; value != NULL; value = value->next) {
+      NativeValue* v = (NativeValue*)&value->value;
+      v->on_free(v->data);
+      v->on_free = NULL;
+    }
+
+    pthread_mutex_lock(&sweeper->lock);
+    MoveAllTo(&sweeper->done, &work);
+    sweeper->busy = false;
+    pthread_cond_broadcast(&sweeper->signal);
+  }
+  pthread_mutex_unlock(&sweeper->lock);
+  return NULL;
+}
+
+/**
+ * @func[HandOff] Hands off garbage values to the background sweeper thread.
+ *  @arg[Runtime*][runtime] The runtime.
+ *  @arg[bool][wait]
+ *   If true, wait for the background thread to finish with everything
+ *   handed off so far.
+ *  @sideeffects
+ *   @i Hands off the current batch of values to the background thread.
+ *   @i Frees values the background thread is done with.
+ */
+static void HandOff(Runtime* runtime, bool wait)
+{
+  Sweeper* sweeper = &runtime->sweeper;
+
+  List done;
+  Clear(&done);
+
+  pthread_mutex_lock(&sweeper->lock);
+  if (!IsEmpty(&sweeper->batch)) {
+    MoveAllTo(&sweeper->todo, &sweeper->batch);
+    sweeper->batch_size = 0;
+    pthread_cond_broadcast(&sweeper->signal);
+  }
+
+  while (wait && (sweeper->busy || !IsEmpty(&sweeper->todo))) {
+    pthread_cond_wait(&sweeper->signal, &sweeper->lock);
+  }
+  MoveAllTo(&done, &sweeper->done);
+  pthread_mutex_unlock(&sweeper->lock);
+
+  for (GcAllocatedValue* value = Get(&done); value != NULL; value = Get(&done)) {
+    FreeGcValue(runtime, value);
+  }
+}
+
+/**
+ * @func[IsOnCallerFrame] Tests whether a value is stack allocated to a caller.
+ *  Values on a caller's frame outlive the given frame as is, so there is no
+ *  need to GC reallocate them when the given frame is popped or compacted.
+ *
+ *  @arg[Frame*][frame] The frame to test.
+ *  @arg[FbleValue*][value] The value to test.
+ *  @returns[bool]
+ *   True if the value is stack allocated to some caller of the given frame
+ *   and has not been GC reallocated.
+ */
+static bool IsOnCallerFrame(Frame* frame, FbleValue* value)
+{
+  if (!IsAlloced(value) || (value->flags & FbleValueFlagIsGcAllocBit)) {
+    return false;
+  }
+
+  StackAllocatedValue* svalue = StackAllocatedValueOf(value);
+  return (svalue->gcframe & ONE) != 0
+    && svalue->gcframe != (((uintptr_t)frame) ^ ONE);
+}
+
+/**
+ * @func[Promote] Shallow reallocation of a value onto the heap.
+ *  Fields of the reallocated value refer to the same values as the original
+ *  value. They need to be reallocated in turn before the reallocated value
+ *  can be used.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @arg[FbleValue*][value] The value to allocate.
+ *  @returns[FbleValue*] A gc allocated value equivalent to @a[value].
+ *  @sideeffects
+ *   @i Allocates a GC value on the heap if needed.
+ *   @i Records mapping from original value to GC value on the stack.
+ *   @i Pushes newly allocated GC values onto runtime->promoting.
+ */
+static FbleValue* Promote(Runtime* runtime, FbleValue* value)
+{
+  // Packed values and NULL need not be allocated at all.
+  if (!IsAlloced(value)) {
     return value;
   }
 
@@ -700,6 +1750,14 @@ static FbleValue* GcRealloc(Runtime* runtime, FbleValue* value)
     return value;
   }
 
+  // Interior values of a list block move along with the rest of the list
+  // block.
+  if (value->flags & FbleValueFlagInteriorBit) {
+    FbleValue* owner = OwnerOf(value);
+    FbleValue** nowner = (FbleValue**)Promote(runtime, owner);
+    return (FbleValue*)(nowner + ((FbleValue**)value - (FbleValue**)owner));
+  }
+
   // If the value has already been GC allocated, return the associated GC
   // allocated value.
   StackAllocatedValue* svalue = StackAllocatedValueOf(value);
@@ -708,40 +1766,46 @@ static FbleValue* GcRealloc(Runtime* runtime, FbleValue* value)
   }
 
   Frame* frame = (Frame*)(svalue->gcframe ^ ONE);
+  runtime->stats.promoted++;
+
+  FbleValue* nvalue = NULL;
   switch ((ValueTag)(value->flags & FbleValueFlagTagBits)) {
     case STRUCT_VALUE: {
       FbleStructValue* sv = (FbleStructValue*)value;
       FbleStructValue* nv = NewGcValueExtra(runtime, frame, FbleStructValue, STRUCT_VALUE, value->data);
       nv->_base.data = sv->_base.data;
-      svalue->gcframe = (uintptr_t)&nv->_base;
-      
-      nv->_base.data = sv->_base.data;
-      for (size_t i = 0; i < sv->_base.data; ++i) {
-        nv->fields[i] = GcRealloc(runtime, sv->fields[i]);
-      }
-      return &nv->_base;
+      memcpy(nv->fields, sv->fields, sv->_base.data * sizeof(FbleValue*));
+      nvalue = &nv->_base;
+      break;
     }
 
     case UNION_VALUE: {
+      if (value->flags & FbleValueFlagBlockBit) {
+        size_t n = ListBlockCells(value);
+        size_t size = n * LIST_CELL_WORDS * sizeof(FbleValue*);
+        nvalue = NewGcValueRaw(runtime, frame, UNION_VALUE, size);
+        memcpy(nvalue, value, size);
+        LinkListBlock(nvalue, n, FbleValueFlagIsGcAllocBit);
+        break;
+      }
+
       FbleUnionValue* uv = (FbleUnionValue*)value;
       FbleUnionValue* nv = NewGcValue(runtime, frame, FbleUnionValue, UNION_VALUE);
-      svalue->gcframe = (uintptr_t)&nv->_base;
       nv->_base.data = uv->_base.data;
-      nv->arg = GcRealloc(runtime, uv->arg);
-      return &nv->_base;
+      nv->arg = uv->arg;
+      nvalue = &nv->_base;
+      break;
     }
 
     case FUNC_VALUE: {
       FbleFuncValue* fv = (FbleFuncValue*)value;
       FbleFuncValue* nv = NewGcValueExtra(runtime, frame, FbleFuncValue, FUNC_VALUE, fv->function.executable.num_statics);
-      svalue->gcframe = (uintptr_t)&nv->_base;
       memcpy(&nv->function.executable, &fv->function.executable, sizeof(FbleExecutable));
       nv->function.profile_block_id = fv->function.profile_block_id;
       nv->function.statics = nv->statics;
-      for (size_t i = 0; i < nv->function.executable.num_statics; ++i) {
-        nv->statics[i] = GcRealloc(runtime, fv->statics[i]);
-      }
-      return &nv->_base;
+      memcpy(nv->statics, fv->statics, fv->function.executable.num_statics * sizeof(FbleValue*));
+      nvalue = &nv->_base;
+      break;
     }
 
     case NATIVE_VALUE: {
@@ -750,8 +1814,74 @@ static FbleValue* GcRealloc(Runtime* runtime, FbleValue* value)
     }
   }
 
-  FbleUnreachable("should never get here");
-  return NULL;
+  svalue->gcframe = (uintptr_t)nvalue;
+
+  if (runtime->promoting.size == runtime->promoting_capacity) {
+    runtime->promoting_capacity *= 2;
+    runtime->promoting.xs = FbleReAllocArray(FbleValue*, runtime->promoting.xs, runtime->promoting_capacity);
+  }
+  runtime->promoting.xs[runtime->promoting.size++] = nvalue;
+  return nvalue;
+}
+
+/**
+ * @func[GcRealloc] Reallocate a value onto the heap.
+ *  Uses an explicit work list rather than recursion, so that promoting long
+ *  chains of values, such as lists, doesn't use up the C stack.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @arg[FbleValue*][value] The value to allocate.
+ *  @returns[FbleValue*] A gc allocated value equivalent to @a[value].
+ *  @sideeffects
+ *   @i Allocates GC values on the heap.
+ *   @i Records mapping from original value to GC value on the stack.
+ */
+static FbleValue* GcRealloc(Runtime* runtime, FbleValue* value)
+{
+  value = Promote(runtime, value);
+  while (runtime->promoting.size > 0) {
+    FbleValue* nvalue = runtime->promoting.xs[--runtime->promoting.size];
+    switch ((ValueTag)(nvalue->flags & FbleValueFlagTagBits)) {
+      case STRUCT_VALUE: {
+        FbleStructValue* nv = (FbleStructValue*)nvalue;
+        for (size_t i = 0; i < nv->_base.data; ++i) {
+          nv->fields[i] = Promote(runtime, nv->fields[i]);
+        }
+        break;
+      }
+
+      case UNION_VALUE: {
+        if (nvalue->flags & FbleValueFlagBlockBit) {
+          size_t n = ListBlockCells(nvalue);
+          for (size_t i = 0; i < n; ++i) {
+            FbleStructValue* pair = ListCellStruct(nvalue, i);
+            pair->fields[0] = Promote(runtime, pair->fields[0]);
+          }
+          FbleStructValue* last = ListCellStruct(nvalue, n - 1);
+          last->fields[1] = Promote(runtime, last->fields[1]);
+          break;
+        }
+
+        FbleUnionValue* nv = (FbleUnionValue*)nvalue;
+        nv->arg = Promote(runtime, nv->arg);
+        break;
+      }
+
+      case FUNC_VALUE: {
+        FbleFuncValue* nv = (FbleFuncValue*)nvalue;
+        for (size_t i = 0; i < nv->function.executable.num_statics; ++i) {
+          nv->statics[i] = Promote(runtime, nv->statics[i]);
+        }
+        break;
+      }
+
+      case NATIVE_VALUE: {
+        FbleUnreachable("native value should already be GC allocated.");
+        break;
+      }
+    }
+  }
+  return value;
 }
 
 /**
@@ -789,19 +1919,47 @@ static uintptr_t RefValueId(FbleValue* value)
   return data >> 2;
 }
 
+/**
+ * @func[MarkRefAssigned] Marks a value a ref assignment points to.
+ *  Ref assignment changes the references of objects that may already have
+ *  been marked and traversed by the current GC cycle. Mark the assigned
+ *  value if it is undergoing GC so the cycle doesn't miss the new reference.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @arg[FbleValue*][value] The value assigned.
+ *  @sideeffects
+ *   Marks the value if it is undergoing GC and not already marked.
+ */
+static void MarkRefAssigned(Runtime* runtime, FbleValue* value)
+{
+  if (!IsAlloced(value) || !(value->flags & FbleValueFlagIsGcAllocBit)) {
+    return;
+  }
+
+  Gc* gc = &runtime->gc;
+  GcAllocatedValue* gvalue = GcAllocatedValueOf(value);
+  if (InGc(gc, gvalue) && gvalue->gen != gc->gen) {
+    Mark(gc, gvalue);
+  }
+}
+
 /**
  * @func[RefAssign] Update a reference value assignment.
  *  @arg[Runtime*][runtime] The runtime context.
  *  @arg[uintptr_t][refs] The id of the first of the refs.
  *  @arg[FbleValue**][values] The values to be assigned.
+ *  @arg[FbleValueV*][traversed] Values seen so far by RefsAssign.
  *  @arg[FbleValue**][x] Pointer to value to check assignment on.
  *  @sideeffects
  *   @i Updates refs assignments to the given reference as appropriate.
  *   @item
+ *    Marks the value as traversing and adds it to traversed if assignments
+ *    need to be done inside the value.
+ *   @item
  *    Behavior is undefined if the number of values does not match the number
  *    of currently allocated ref ids >= refs.
  */
-static void RefAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValue** r)
+static void RefAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValueV* traversed, FbleValue** r)
 {
   FbleValue* x = *r;
 
@@ -810,32 +1968,17 @@ static void RefAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, Fble
     uintptr_t id = RefValueId(x);
     if (id >= refs) {
       *r = values[id - refs];
-      return;
+      MarkRefAssigned(runtime, *r);
     }
+    return;
   }
 
-  // Do substitution inside this value.
-  RefsAssign(runtime, refs, values, x);
-}
-
-/**
- * @func[RefsAssign] Perform ref value assignments on x.
- *  @arg[Runtime*][runtime] The runtime context.
- *  @arg[uintptr_t][refs] The id of the first of the refs.
- *  @arg[FbleValue**][values] The values to be assigned.
- *  @arg[FbleValue*][x] The value to do the assignments in.
- *  @sideeffects
- *   Replaces all references to ref values in x with their corresponding
- *   values.
- */
-static void RefsAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValue* x)
-{
   // Nothing to do for packed values or NULL.
   if (!IsAlloced(x)) {
     return;
   }
 
-  // Nothing to do for values currently being traversed.
+  // Nothing to do for values we've already seen.
   if (x->flags & FbleValueFlagTraversingBit) {
     return;
   }
@@ -850,35 +1993,64 @@ static void RefsAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, Fbl
   }
 
   x->flags ^= FbleValueFlagTraversingBit;
-  switch ((ValueTag)(x->flags & FbleValueFlagTagBits)) {
-    case STRUCT_VALUE: {
-      FbleStructValue* sv = (FbleStructValue*)x;
-      for (size_t i = 0; i < x->data; ++i) {
-        RefAssign(runtime, refs, values, sv->fields + i);
+  FbleAppendToVector(*traversed, x);
+}
+
+/**
+ * @func[RefsAssign] Perform ref value assignments on x.
+ *  Uses an explicit work list rather than recursion, so that the depth of x
+ *  is limited by available heap memory rather than the C stack.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @arg[uintptr_t][refs] The id of the first of the refs.
+ *  @arg[FbleValue**][values] The values to be assigned.
+ *  @arg[FbleValue*][x] The value to do the assignments in.
+ *  @sideeffects
+ *   Replaces all references to ref values in x with their corresponding
+ *   values.
+ */
+static void RefsAssign(Runtime* runtime, uintptr_t refs, FbleValue** values, FbleValue* x)
+{
+  FbleValueV traversed;
+  FbleInitVector(traversed);
+  RefAssign(runtime, refs, values, &traversed, &x);
+
+  for (size_t t = 0; t < traversed.size; ++t) {
+    FbleValue* v = traversed.xs[t];
+    switch ((ValueTag)(v->flags & FbleValueFlagTagBits)) {
+      case STRUCT_VALUE: {
+        FbleStructValue* sv = (FbleStructValue*)v;
+        for (size_t i = 0; i < v->data; ++i) {
+          RefAssign(runtime, refs, values, &traversed, sv->fields + i);
+        }
+        break;
       }
-      break;
-    }
 
-    case UNION_VALUE: {
-      FbleUnionValue* uv = (FbleUnionValue*)x;
-      RefAssign(runtime, refs, values, &uv->arg);
-      break;
-    }
+      case UNION_VALUE: {
+        FbleUnionValue* uv = (FbleUnionValue*)v;
+        RefAssign(runtime, refs, values, &traversed, &uv->arg);
+        break;
+      }
 
-    case FUNC_VALUE: {
-      FbleFuncValue* fv = (FbleFuncValue*)x;
-      for (size_t i = 0; i < fv->function.executable.num_statics; ++i) {
-        RefAssign(runtime, refs, values, fv->statics + i);
+      case FUNC_VALUE: {
+        FbleFuncValue* fv = (FbleFuncValue*)v;
+        for (size_t i = 0; i < fv->function.executable.num_statics; ++i) {
+          RefAssign(runtime, refs, values, &traversed, fv->statics + i);
+        }
+        break;
       }
-      break;
-    }
 
-    case NATIVE_VALUE: {
-      // Nothing to do.
-      break;
+      case NATIVE_VALUE: {
+        // Nothing to do.
+        break;
+      }
     }
   }
-  x->flags ^= FbleValueFlagTraversingBit;
+
+  for (size_t t = 0; t < traversed.size; ++t) {
+    traversed.xs[t]->flags ^= FbleValueFlagTraversingBit;
+  }
+  FbleFreeVector(traversed);
 }
 
 /**
@@ -893,6 +2065,33 @@ static bool IsPacked(FbleValue* value)
   return (((uintptr_t)value) & 0x1) == 0x1;
 }
 
+
+/**
+ * @func[PackedLength] Gets the number of data bits of a packed value.
+ *  @arg[FbleValue*][value] The packed value.
+ *  @returns[uintptr_t] The number of data bits in the packed value.
+ */
+static uintptr_t PackedLength(FbleValue* value)
+{
+  // The highest set bit marks the end of the data, which starts at bit 1.
+  return 8 * sizeof(unsigned long long) - 2 - __builtin_clzll((uintptr_t)value);
+}
+
+/**
+ * @func[Pack] Makes a packed value.
+ *  @arg[uintptr_t][data] The data bits of the value.
+ *  @arg[uintptr_t][length]
+ *   The number of data bits. Must not be more than PACKED_DATA_WIDTH.
+ *  @returns[FbleValue*] The packed value.
+ */
+static FbleValue* Pack(uintptr_t data, uintptr_t length)
+{
+  assert(length <= PACKED_DATA_WIDTH);
+  data &= (ONE << length) - 1;
+  data |= (ONE << length);
+  return (FbleValue*)((data << 1) | 1);
+}
+
 /**
  * @func[IsAlloced] Tests whether a value is unpacked and not NULL.
  *  @arg[FbleValue*][value] The value to test.
@@ -904,22 +2103,41 @@ static bool IsAlloced(FbleValue* value)
 }
 
 /**
- * @func[MarkRef] Marks a GC value referenced from another value.
+ * @func[Mark] Marks a value undergoing GC.
  *  @arg[Gc*][gc] The current Gc.
- *  @arg[FbleValue*][src] The source of the reference.
- *  @arg[FbleValue*][dst] The target of the reference. Must not be NULL.
+ *  @arg[GcAllocatedValue*][value] The value to mark.
  *
  *  @sideeffects
- *   If value is non-NULL, moves the object to the runtime->marked list.
+ *   Marks the value and pushes it onto the stack of marked values to
+ *   traverse.
  */
-static void MarkRef(Gc* gc, FbleValue* src, FbleValue* dst)
+static void Mark(Gc* gc, GcAllocatedValue* value)
+{
+  value->gen = gc->gen;
+  if (gc->marked.size == gc->marked_capacity) {
+    gc->marked_capacity *= 2;
+    gc->marked.xs = FbleReAllocArray(FbleValue*, gc->marked.xs, gc->marked_capacity);
+  }
+  gc->marked.xs[gc->marked.size++] = &value->value;
+}
+
+/**
+ * @func[MarkRef] Marks a GC value referenced from another value.
+ *  @arg[Gc*][gc] The current Gc.
+ *  @arg[FbleValue*][src] The source of the reference.
+ *  @arg[FbleValue*][dst] The target of the reference. Must not be NULL.
+ *
+ *  @sideeffects
+ *   If value is non-NULL and undergoing GC, marks the object.
+ */
+static void MarkRef(Gc* gc, FbleValue* src, FbleValue* dst)
 {
   GcAllocatedValue* gdst = GcAllocatedValueOf(dst);
-  if (IsAlloced(dst)
-      && gdst->gen >= gc->min_gen
-      && gdst->gen != gc->gen) {
-    assert(gdst->gen < gc->max_gen);
-    MoveTo(&gc->marked, gdst);
+  // Values saved by compacting a frame with interrupted GC move to the
+  // frame's new generation, past the objects undergoing GC that may still
+  // refer to them. They are reachable already, so leave them be.
+  if (IsAlloced(dst) && InGc(gc, gdst) && gdst->gen != gc->gen) {
+    Mark(gc, gdst);
   }
 }
 
@@ -942,6 +2160,15 @@ static void MarkRefs(Gc* gc, FbleValue* value)
     }
 
     case UNION_VALUE: {
+      if (value->flags & FbleValueFlagBlockBit) {
+        size_t n = ListBlockCells(value);
+        for (size_t i = 0; i < n; ++i) {
+          MarkRef(gc, value, ListCellStruct(value, i)->fields[0]);
+        }
+        MarkRef(gc, value, ListCellStruct(value, n - 1)->fields[1]);
+        break;
+      }
+
       FbleUnionValue* uv = (FbleUnionValue*)value;
       MarkRef(gc, value, uv->arg);
       break;
@@ -964,57 +2191,137 @@ static void MarkRefs(Gc* gc, FbleValue* value)
 /**
  * @func[IncrGc] Performs an incremental GC.
  *  @arg[Runtime*][runtime] The runtime context.
+ *  @returns[bool] False if there was no GC work left to do, true otherwise.
  *  @sideeffects
  *   Performs a constant amount of GC work on the runtime.
  */
-static void IncrGc(Runtime* runtime)
+static bool IncrGc(Runtime* runtime)
 {
   Gc* gc = &runtime->gc;
+  runtime->stats.gc_steps++;
+
+  // Traverse a marked object on the heap.
+  if (gc->marked.size > 0) {
+    FbleValue* marked = gc->marked.xs[--gc->marked.size];
+    MarkRefs(gc, marked);
+    runtime->stats.gc_traversed++;
+    return true;
+  }
 
-  // Free a couple objects on the free list.
-  FreeGcValue(Get(&gc->free));
-  FreeGcValue(Get(&gc->free));
+  // Scan a few objects. Objects found to be marked already are traversed
+  // now, which counts for the rest of the work this time around.
+  if (!IsEmpty(&gc->unmarked)) {
+    for (size_t i = 0; i < GC_BATCH_SIZE; ++i) {
+      GcAllocatedValue* scanned = Get(&gc->unmarked);
+      if (scanned == NULL) {
+        return true;
+      }
 
-  // Traverse an object on the heap.
-  GcAllocatedValue* marked = Get(&gc->marked);
-  if (marked != NULL) {
-    marked->gen = gc->gen;
-    MarkRefs(gc, &marked->value);
+      runtime->stats.gc_visited++;
+      if (scanned->gen != gc->gen) {
+        Add(&gc->pending, scanned);
+        continue;
+      }
 
-    if (gc->interrupted) {
-      // GC was interrupted during pop frame or compact, so this object should
-      // be moved to 'unmarked'.
-      MoveToUnmarked(gc->frame, marked);
-    } else {
-      MoveToAlloced(gc->frame, marked);
+      MarkRefs(gc, &scanned->value);
+      runtime->stats.gc_traversed++;
+      if (gc->interrupted) {
+        // GC was interrupted during pop frame or compact, so this object
+        // should be moved to 'unmarked'.
+        MoveToUnmarked(gc->frame, scanned);
+      } else {
+        MoveToAlloced(gc->frame, scanned);
+      }
+      return true;
     }
-    return;
+    return true;
   }
 
-  // Anything left unmarked is unreachable.
-  MoveAllTo(&gc->free, &gc->unmarked);
+  // Sweep a few objects. Everything has been scanned and traversed at this
+  // point, so anything left unmarked is unreachable.
+  if (!IsEmpty(&gc->pending)) {
+    for (size_t i = 0; i < GC_BATCH_SIZE; ++i) {
+      GcAllocatedValue* swept = Get(&gc->pending);
+      if (swept == NULL) {
+        return true;
+      }
+
+      runtime->stats.gc_visited++;
+      if (swept->gen != gc->gen) {
+        SweepGcValue(runtime, swept);
+        runtime->stats.gc_frees++;
+      } else if (gc->interrupted) {
+        MoveToUnmarked(gc->frame, swept);
+      } else {
+        MoveToAlloced(gc->frame, swept);
+      }
+    }
+    return true;
+  }
 
   // Resurrect anything that needs saving due to interrupted GC.
   for (size_t i = 0; gc->save.xs[i] != NULL; ++i) {
     MoveToMarked(gc->frame, GcAllocatedValueOf(gc->save.xs[i]));
   }
+  gc->save.xs[0] = NULL;
+
+  // Hand off any partial batch of garbage from this cycle rather than
+  // holding on to it until enough garbage turns up in later cycles.
+  if (runtime->sweeper.batch_size > 0) {
+    HandOff(runtime, false);
+  }
 
   // Set up next gc
-  if (gc->next != NULL) {
-    gc->frame = gc->next;
-    if (gc->frame == runtime->top) {
-      gc->next = NULL;
-    } else {
-      gc->next = ((Frame*)gc->frame->top) - 1;
-    }
+  if (gc->next == NULL) {
+    return false;
+  }
+
+  gc->frame = gc->next;
+  if (gc->frame == runtime->top) {
+    gc->next = NULL;
+  } else {
+    gc->next = ((Frame*)gc->frame->top) - 1;
+  }
+
+  gc->min_gen = gc->frame->min_gen;
+  gc->gen = gc->frame->gen;
+  gc->max_gen = gc->frame->max_gen;
+  MoveAllTo(&gc->unmarked, &gc->frame->unmarked);
+  gc->interrupted = false;
+  runtime->stats.gc_cycles++;
+  return true;
+}
+
+/**
+ * @func[PaceGc] Performs incremental GC for an allocation.
+ *  The amount of GC work done is gc->pace steps while the number of GC
+ *  objects stays within twice the estimated live set. When the heap grows
+ *  beyond that, because garbage is being allocated faster than it is
+ *  reclaimed, the amount of work is scaled up in proportion to the growth, up
+ *  to MAX_GC_PACE_FACTOR times the pace. No work is done once GC runs out of
+ *  things to do.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @sideeffects
+ *   Performs a bounded amount of GC work on the runtime.
+ */
+static void PaceGc(Runtime* runtime)
+{
+  Gc* gc = &runtime->gc;
+  size_t objects = runtime->stats.gc_allocs - runtime->stats.gc_frees;
 
-    gc->min_gen = gc->frame->min_gen;
-    gc->gen = gc->frame->gen;
-    gc->max_gen = gc->frame->max_gen;
-    MoveAllTo(&gc->marked, &gc->frame->marked);
-    MoveAllTo(&gc->unmarked, &gc->frame->unmarked);
-    gc->interrupted = false;
-    gc->save.xs[0] = NULL;
+  size_t factor = objects / (2 * gc->live);
+  if (factor < 1) {
+    factor = 1;
+  } else if (factor > MAX_GC_PACE_FACTOR) {
+    factor = MAX_GC_PACE_FACTOR;
+  }
+
+  for (size_t i = 0; i < factor * gc->pace; ++i) {
+    if (!IncrGc(runtime)) {
+      gc->live = objects < MIN_GC_LIVE ? MIN_GC_LIVE : objects;
+      return;
+    }
   }
 }
 
@@ -1026,6 +2333,7 @@ FbleRuntime* FbleNewRuntime()
   assert((ONE << PACKED_OFFSET_WIDTH) == 8 * sizeof(FbleValue*));
 
   Runtime* runtime = FbleAlloc(Runtime);
+  RaiseStackLimit();
 
   runtime->tail_call_capacity = 1;
   runtime->_base.tail_call_sentinel = (FbleValue*)0x2;
@@ -1033,39 +2341,90 @@ FbleRuntime* FbleNewRuntime()
   runtime->_base.tail_call_argc = 0;
   runtime->_base.profile = FbleNewProfile();
 
-  runtime->stack = FbleAllocRaw(CHUNK_SIZE);
+  runtime->chunk_size = DEFAULT_CHUNK_SIZE;
+  runtime->merge_limit = DEFAULT_MERGE_LIMIT;
+  runtime->merge_tuning = false;
+  runtime->tuning_calls = 0;
+  runtime->tuning_promoted = 0;
+
+  runtime->stack = FbleAllocRaw(runtime->chunk_size);
 
   runtime->top = (Frame*)runtime->stack;
 
   runtime->top->caller = NULL;
   runtime->top->merges = 0;
+  runtime->top->hash_consed = 0;
   runtime->top->min_gen = 0;
   runtime->top->gen = 0;
   runtime->top->max_gen = 1;
   Clear(&runtime->top->unmarked);
-  Clear(&runtime->top->marked);
   Clear(&runtime->top->alloced);
   runtime->top->top = (intptr_t)(runtime->top + 1);
-  runtime->top->max = CHUNK_SIZE + (intptr_t)runtime->stack;
-  runtime->chunks = NULL;
+  runtime->top->max = runtime->chunk_size + (intptr_t)runtime->stack;
+  runtime->top->chunks = NULL;
 
   runtime->gc.min_gen = runtime->top->min_gen;
   runtime->gc.gen = runtime->top->gen;
   runtime->gc.max_gen = runtime->top->max_gen;
   runtime->gc.frame = runtime->top;
   runtime->gc.next = NULL;
-  Clear(&runtime->gc.marked);
+  runtime->gc.marked.size = 0;
+  runtime->gc.marked_capacity = 8;
+  runtime->gc.marked.xs = FbleAllocArray(FbleValue*, runtime->gc.marked_capacity);
+
+  runtime->promoting.size = 0;
+  runtime->promoting_capacity = 8;
+  runtime->promoting.xs = FbleAllocArray(FbleValue*, runtime->promoting_capacity);
   Clear(&runtime->gc.unmarked);
-  Clear(&runtime->gc.free);
+  Clear(&runtime->gc.pending);
   runtime->gc.interrupted = false;
   runtime->gc.save.size = 2;
   runtime->gc.save.xs = FbleAllocArray(FbleValue*, runtime->gc.save.size);
   runtime->gc.save.xs[0] = NULL;
+  runtime->gc.pace = DEFAULT_GC_PACE;
+  runtime->gc.live = MIN_GC_LIVE;
+
+  for (size_t i = 0; i < NUM_SIZE_CLASSES; ++i) {
+    runtime->heap.free[i] = NULL;
+  }
+  runtime->heap.slabs = NULL;
+  runtime->heap.top = 0;
+  runtime->heap.max = 0;
 
   runtime->chunks = NULL;
+  runtime->idle_chunks = 0;
+  runtime->registers = NULL;
+  runtime->registers_top = 0;
+  runtime->registers_max = 0;
   runtime->ref_id = 1;
 
-  FbleInitVector(runtime->foreign);
+  runtime->foreign.size = 0;
+  runtime->foreign.capacity = INITIAL_FOREIGN_CAPACITY;
+  runtime->foreign.xs = FbleAllocArray(ForeignEntry, runtime->foreign.capacity);
+  memset(runtime->foreign.xs, 0, runtime->foreign.capacity * sizeof(ForeignEntry));
+
+  runtime->cached = FbleAllocArray(CachedValue, VALUE_CACHE_ENTRIES);
+  memset(runtime->cached, 0, VALUE_CACHE_ENTRIES * sizeof(CachedValue));
+  runtime->hash_cons = NULL;
+
+  FbleExecutable partial_apply = {
+    .num_args = 0,
+    .num_statics = 0,
+    .max_call_args = 0,
+    .run = &PartialApplyImpl,
+    .data = NULL
+  };
+  FbleInitVector(runtime->executables);
+  FbleAppendToVector(runtime->executables, partial_apply);
+  runtime->modules = 0xcbf29ce484222325;
+
+  runtime->sweeper.enabled = false;
+  Clear(&runtime->sweeper.batch);
+  runtime->sweeper.batch_size = 0;
+
+  memset(&runtime->stats, 0, sizeof(FbleRuntimeStats));
+  runtime->stats.stack_bytes = runtime->chunk_size;
+  runtime->stats_output = NULL;
 
   return &runtime->_base;
 }
@@ -1074,38 +2433,52 @@ FbleRuntime* FbleNewRuntime()
 void FbleFreeRuntime(FbleRuntime* runtime_)
 {
   Runtime* runtime = (Runtime*)runtime_;
+  FbleSetBackgroundSweep(runtime_, false);
+
+  if (runtime->stats_output != NULL) {
+    FblePrintRuntimeStats(runtime->stats_output, runtime_);
+  }
 
   List values;
   Clear(&values);
   for (Frame* frame = runtime->top; frame != NULL; frame = frame->caller) {
     MoveAllTo(&values, &frame->unmarked);
-    MoveAllTo(&values, &frame->marked);
     MoveAllTo(&values, &frame->alloced);
 
-    for (Chunk* chunk = frame->chunks; chunk != NULL; chunk = frame->chunks) {
-      frame->chunks = chunk->next;
-      FbleFree(chunk);
-    }
+    FreeChunks(runtime, &frame->chunks);
   }
-  MoveAllTo(&values, &runtime->gc.free);
-  MoveAllTo(&values, &runtime->gc.marked);
   MoveAllTo(&values, &runtime->gc.unmarked);
+  MoveAllTo(&values, &runtime->gc.pending);
+  FbleFree(runtime->gc.marked.xs);
+  FbleFree(runtime->promoting.xs);
   FbleFree(runtime->gc.save.xs);
 
   FbleFree(runtime->stack);
-  for (Chunk* chunk = runtime->chunks; chunk != NULL; chunk = runtime->chunks) {
-    runtime->chunks = chunk->next;
-    FbleFree(chunk);
-  }
+  FreeChunks(runtime, &runtime->registers);
+  FreeChunks(runtime, &runtime->chunks);
 
   for (GcAllocatedValue* value = Get(&values); value != NULL; value = Get(&values)) {
-    FreeGcValue(value);
+    FreeGcValue(runtime, value);
+  }
+
+  for (Slab* slab = runtime->heap.slabs; slab != NULL; slab = runtime->heap.slabs) {
+    runtime->heap.slabs = slab->next;
+    free(slab);
   }
 
   FbleFreeProfile(runtime->_base.profile);
   FbleFree(runtime->_base.tail_call_buffer);
+  for (size_t i = 0; i < runtime->foreign.capacity; ++i) {
+    if (runtime->foreign.xs[i].foreign != NULL) {
+      FbleFreeModulePath(runtime->foreign.xs[i].path);
+    }
+  }
   FbleFree(runtime->foreign.xs);
+  FbleFree(runtime->cached);
+  FbleFree(runtime->hash_cons);
+  FbleFreeVector(runtime->executables);
   FbleFree(runtime);
+  RestoreStackLimit();
 }
 
 // See documentation of FblePushFrame in fble-runtime.h
@@ -1120,7 +2493,6 @@ static void PushFrame(Runtime* runtime, bool merge)
   Frame* callee = (Frame*)StackAlloc(runtime, sizeof(Frame));
   callee->caller = runtime->top;
   Clear(&callee->unmarked);
-  Clear(&callee->marked);
   Clear(&callee->alloced);
   callee->merges = 0;
   callee->min_gen = runtime->top->max_gen;
@@ -1129,6 +2501,7 @@ static void PushFrame(Runtime* runtime, bool merge)
   callee->top = (intptr_t)(callee + 1);
   callee->max = runtime->top->max;
   callee->chunks = NULL;
+  callee->hash_consed = 0;
 
   // If a program runs for a really long time (like over 100 years), it's
   // possible we could overflow the GC gen value and GC would break. Hopefully
@@ -1155,46 +2528,45 @@ FbleValue* FblePopFrame(FbleRuntime* runtime_, FbleValue* value)
     return value;
   }
 
-  value = GcRealloc(runtime, value);
+  if (!IsOnCallerFrame(top, value)) {
+    value = GcRealloc(runtime, value);
+  }
 
   runtime->top = runtime->top->caller;
 
   runtime->top->max_gen = top->max_gen;
   MoveAllTo(&runtime->top->unmarked, &top->unmarked);
-  MoveAllTo(&runtime->top->unmarked, &top->marked);
   MoveAllTo(&runtime->top->unmarked, &top->alloced);
 
   GcAllocatedValue* gvalue = GcAllocatedValueOf(value);
-  if (IsAlloced(value) && gvalue->gen >= top->min_gen) {
-    MoveToMarked(runtime->top, gvalue);
-  }
+  bool owned = IsAlloced(value)
+    && (value->flags & FbleValueFlagIsGcAllocBit)
+    && gvalue->gen >= top->min_gen;
 
   if (runtime->gc.frame == top) {
     // We are popping the frame currently being GC'd.
     runtime->gc.interrupted = true;
     runtime->gc.frame = runtime->top;
+    runtime->gc.save.xs[0] = NULL;
 
     // If the value we are returning is currently undergoing GC, keep it there
     // until GC has a chance to finish.
-    if (IsAlloced(value)
-        && gvalue->gen >= runtime->gc.min_gen
-        && gvalue->gen != runtime->gc.gen
-        && gvalue->gen < runtime->gc.max_gen) {
-      MoveTo(&runtime->gc.marked, gvalue);
+    if (owned && InGc(&runtime->gc, gvalue)) {
+      if (gvalue->gen != runtime->gc.gen) {
+        Mark(&runtime->gc, gvalue);
+      }
       runtime->gc.save.xs[0] = value;
       runtime->gc.save.xs[1] = NULL;
-    } else {
-      runtime->gc.save.xs[0] = NULL;
+      owned = false;
     }
   }
 
-  while (top->chunks != NULL) {
-    Chunk* chunk = top->chunks;
-    top->chunks = chunk->next;
-    chunk->next = runtime->chunks;
-    runtime->chunks = chunk;
+  if (owned) {
+    MoveToMarked(runtime->top, gvalue);
   }
 
+  ReleaseChunks(runtime, &top->chunks);
+
   if (runtime->gc.next == NULL || runtime->gc.next == top) {
     runtime->gc.next = runtime->top;
   }
@@ -1232,7 +2604,9 @@ static void CompactFrame(Runtime* runtime, bool merge, size_t n, FbleValue** sav
   }
 
   for (size_t i = 0; i < n; ++i) {
-    save[i] = GcRealloc(runtime, save[i]);
+    if (!IsOnCallerFrame(runtime->top, save[i])) {
+      save[i] = GcRealloc(runtime, save[i]);
+    }
   }
 
   runtime->top->gen = runtime->top->max_gen;
@@ -1245,46 +2619,43 @@ static void CompactFrame(Runtime* runtime, bool merge, size_t n, FbleValue** sav
 
   runtime->top->top = (intptr_t)(runtime->top + 1);
   runtime->top->max = runtime->top->caller->max;
-  while (runtime->top->chunks != NULL) {
-    Chunk* chunk = runtime->top->chunks;
-    runtime->top->chunks = chunk->next;
-    chunk->next = runtime->chunks;
-    runtime->chunks = chunk;
-  }
+  runtime->top->hash_consed = 0;
+  ReleaseChunks(runtime, &runtime->top->chunks);
 
-  MoveAllTo(&runtime->top->unmarked, &runtime->top->marked);
   MoveAllTo(&runtime->top->unmarked, &runtime->top->alloced);
 
-  for (size_t i = 0; i < n; ++i) {
-    GcAllocatedValue* gsave = GcAllocatedValueOf(save[i]);
-    if (IsAlloced(save[i]) && gsave->gen >= runtime->top->min_gen) {
-      MoveToMarked(runtime->top, gsave);
-    }
-  }
-
-  if (runtime->gc.frame == runtime->top) {
+  bool interrupted = runtime->gc.frame == runtime->top;
+  if (interrupted) {
     // We are compacting the frame currently being GC'd.
     runtime->gc.interrupted = true;
 
-    // If any values we are saving are currently undergoing GC, keep them
-    // there until GC has a chance to finish.
     if (runtime->gc.save.size < n + 1) {
       runtime->gc.save.size = n + 1;
       runtime->gc.save.xs = FbleReAllocArray(FbleValue*, runtime->gc.save.xs, n + 1);
     }
+  }
 
-    size_t s = 0;
-    for (size_t i = 0; i < n; ++i) {
-      GcAllocatedValue* gsave = GcAllocatedValueOf(save[i]);
-      if (IsAlloced(save[i])
-          && gsave->gen >= runtime->gc.min_gen
-          && gsave->gen != runtime->gc.gen
-          && gsave->gen < runtime->gc.max_gen) {
-        MoveTo(&runtime->gc.marked, gsave);
+  size_t s = 0;
+  for (size_t i = 0; i < n; ++i) {
+    GcAllocatedValue* gsave = GcAllocatedValueOf(save[i]);
+    if (IsAlloced(save[i])
+        && (save[i]->flags & FbleValueFlagIsGcAllocBit)
+        && gsave->gen >= runtime->top->min_gen) {
+      if (interrupted && InGc(&runtime->gc, gsave)) {
+        // If any values we are saving are currently undergoing GC, keep them
+        // there until GC has a chance to finish.
+        if (gsave->gen != runtime->gc.gen) {
+          Mark(&runtime->gc, gsave);
+        }
         runtime->gc.save.xs[s] = save[i];
         s++;
+      } else {
+        MoveToMarked(runtime->top, gsave);
       }
     }
+  }
+
+  if (interrupted) {
     runtime->gc.save.xs[s] = NULL;
   }
 
@@ -1298,8 +2669,8 @@ static void CompactFrame(Runtime* runtime, bool merge, size_t n, FbleValue** sav
 // Note: the packed value for a generic type matches the packed value of a
 // zero-argument struct value, so that it can be packed along with union and
 // struct values.
-FbleValue* FbleGenericTypeValue = (FbleValue*)1;
-
+FbleValue* FbleGenericTypeValue = (FbleValue*)3;
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleNewStructValue(FbleRuntime* runtime, size_t argc, FbleValue** args)
 {
@@ -1309,33 +2680,37 @@ FbleValue* FbleNewStructValue(FbleRuntime* runtime, size_t argc, FbleValue** arg
   uintptr_t header = 0;  // Struct header listing offsets for the fields.
   uintptr_t data = 0;    // Field data following the struct header.
 
-  for (size_t i = 0; i < argc; ++i) {
+  bool packable = header_length <= PACKED_DATA_WIDTH;
+  for (size_t i = 0; packable && i < argc; ++i) {
     FbleValue* arg = args[i];
-    if (IsPacked(arg)) {
-      uintptr_t adata = (uintptr_t)arg;
-      adata >>= 1;
-      uintptr_t alength = adata & PACKED_OFFSET_MASK;
-      adata >>= PACKED_OFFSET_WIDTH;
-      data |= (adata << length);
-      length += alength;
-      header |= (length << (i * PACKED_OFFSET_WIDTH));
-    } else {
-      length += 8 * sizeof(FbleValue*);
+    if (!IsPacked(arg)) {
+      packable = false;
       break;
     }
+
+    uintptr_t alength = PackedLength(arg);
+    if (header_length + length + alength > PACKED_DATA_WIDTH) {
+      packable = false;
+      break;
+    }
+
+    uintptr_t adata = (((uintptr_t)arg) >> 1) & ((ONE << alength) - 1);
+    data |= (adata << length);
+    length += alength;
+    if (i + 1 < argc) {
+      header |= (length << (i * PACKED_OFFSET_WIDTH));
+    }
   }
 
-  length += header_length;
+  if (packable) {
+    return Pack((data << header_length) | header, header_length + length);
+  }
 
-  if (length + PACKED_OFFSET_WIDTH + 1 <= 8 * sizeof(FbleValue*)) {
-    header &= ((ONE << header_length) - 1); // Drop last field offset from header.
-    data <<= header_length;
-    data |= header;
-    data <<= PACKED_OFFSET_WIDTH;
-    data |= length;
-    data <<= 1;
-    data |= 1;
-    return (FbleValue*)data;
+  if (((Runtime*)runtime)->hash_cons != NULL && argc <= MAX_HASH_CONS_FIELDS) {
+    FbleValue* value = HashCons((Runtime*)runtime, STRUCT_VALUE, argc, argc, args);
+    if (value != NULL) {
+      return value;
+    }
   }
 
   FbleStructValue* value = NewValueExtra((Runtime*)runtime, FbleStructValue, STRUCT_VALUE, argc);
@@ -1348,7 +2723,7 @@ FbleValue* FbleNewStructValue(FbleRuntime* runtime, size_t argc, FbleValue** arg
 
   return &value->_base;
 }
-
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleNewStructValue_(FbleRuntime* runtime, size_t argc, ...)
 {
@@ -1361,7 +2736,7 @@ FbleValue* FbleNewStructValue_(FbleRuntime* runtime, size_t argc, ...)
   va_end(ap);
   return FbleNewStructValue(runtime, argc, args);
 }
-
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleStructValueField(FbleValue* object, size_t fieldc, size_t field)
 {
@@ -1370,26 +2745,14 @@ FbleValue* FbleStructValueField(FbleValue* object, size_t fieldc, size_t field)
   }
 
   if (IsPacked(object)) {
-    uintptr_t data = (uintptr_t)object;
-    data >>= 1;
-
-    uintptr_t length = data & PACKED_OFFSET_MASK;
-    data >>= PACKED_OFFSET_WIDTH;
+    uintptr_t length = PackedLength(object);
+    uintptr_t data = ((uintptr_t)object) >> 1;
 
     uintptr_t header_length = (fieldc == 0) ? 0 : (PACKED_OFFSET_WIDTH * (fieldc - 1));
     uintptr_t offset = (field == 0) ? 0 : ((data >> (PACKED_OFFSET_WIDTH * (field - 1))) & PACKED_OFFSET_MASK);
     uintptr_t end = (field + 1 == fieldc) ? (length - header_length) : ((data >> (PACKED_OFFSET_WIDTH * field)) & PACKED_OFFSET_MASK);
-    data >>= header_length;
-
-    length = end - offset;
-    data >>= offset;
-    data &= (ONE << length) - 1;
-
-    data <<= PACKED_OFFSET_WIDTH;
-    data |= length;
-    data <<= 1;
-    data |= 1;
-    return (FbleValue*)data;
+    data >>= header_length + offset;
+    return Pack(data, end - offset);
   }
 
   assert((object->flags & FbleValueFlagTagBits) == STRUCT_VALUE);
@@ -1397,26 +2760,24 @@ FbleValue* FbleStructValueField(FbleValue* object, size_t fieldc, size_t field)
   assert(field < value->_base.data);
   return value->fields[field];
 }
-
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleNewUnionValue(FbleRuntime* runtime, size_t tagwidth, size_t tag, FbleValue* arg)
 {
-  if (IsPacked(arg)) {
-    uintptr_t data = (uintptr_t)arg;
-    data >>= 1;
-
-    uintptr_t length = data & PACKED_OFFSET_MASK;
-    data >>= PACKED_OFFSET_WIDTH;
+  if (IsPacked(arg) && PackedLength(arg) + tagwidth <= PACKED_DATA_WIDTH) {
+    // {0..., 1, arg, 1} ==> {0..., 1, arg, tag, 1}
+    uintptr_t data = ((uintptr_t)arg) >> 1;
+    data <<= tagwidth;
+    data |= (uintptr_t)tag;
+    data <<= 1;
+    data |= 1;
+    return (FbleValue*)data;
+  }
 
-    length += tagwidth;
-    if (length + PACKED_OFFSET_WIDTH + 1 <= 8 * sizeof(FbleValue*)) {
-      data <<= tagwidth;
-      data |= (uintptr_t)tag;
-      data <<= PACKED_OFFSET_WIDTH;
-      data |= length;
-      data <<= 1;
-      data |= 1;
-      return (FbleValue*)data;
+  if (((Runtime*)runtime)->hash_cons != NULL) {
+    FbleValue* value = HashCons((Runtime*)runtime, UNION_VALUE, tag, 1, &arg);
+    if (value != NULL) {
+      return value;
     }
   }
 
@@ -1432,7 +2793,7 @@ FbleValue* FbleNewEnumValue(FbleRuntime* runtime, size_t tagwidth, size_t tag)
   FbleValue* result = FbleNewUnionValue(runtime, tagwidth, tag, unit);
   return result;
 }
-
+
 // See documentation in fble-runtime.h.
 size_t FbleUnionValueTag(FbleValue* object, size_t tagwidth)
 {
@@ -1442,7 +2803,7 @@ size_t FbleUnionValueTag(FbleValue* object, size_t tagwidth)
 
   if (IsPacked(object)) {
     uintptr_t data = (uintptr_t)object;
-    data >>= (1 + PACKED_OFFSET_WIDTH);
+    data >>= 1;
     data &= (ONE << tagwidth) - 1;
     return data;
   }
@@ -1451,7 +2812,7 @@ size_t FbleUnionValueTag(FbleValue* object, size_t tagwidth)
   FbleUnionValue* value = (FbleUnionValue*)object;
   return value->_base.data;
 }
-
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleUnionValueArg(FbleValue* object, size_t tagwidth)
 {
@@ -1460,17 +2821,9 @@ FbleValue* FbleUnionValueArg(FbleValue* object, size_t tagwidth)
   }
 
   if (IsPacked(object)) {
+    // {0..., 1, arg, tag, 1} ==> {0..., 1, arg, 1}
     uintptr_t data = (uintptr_t)object;
-    data >>= 1;
-
-    uintptr_t length = data & PACKED_OFFSET_MASK;
-    length -= tagwidth;
-
-    data >>= (PACKED_OFFSET_WIDTH + tagwidth);
-
-    data <<= PACKED_OFFSET_WIDTH;
-    data |= length;
-    data <<= 1;
+    data >>= tagwidth;
     data |= 1;
     return (FbleValue*)data;
   }
@@ -1479,7 +2832,7 @@ FbleValue* FbleUnionValueArg(FbleValue* object, size_t tagwidth)
   FbleUnionValue* value = (FbleUnionValue*)object;
   return value->arg;
 }
-
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleUnionValueField(FbleValue* object, size_t tagwidth, size_t field)
 {
@@ -1489,22 +2842,12 @@ FbleValue* FbleUnionValueField(FbleValue* object, size_t tagwidth, size_t field)
 
   if (IsPacked(object)) {
     uintptr_t data = (uintptr_t)object;
-    data >>= 1;
-
-    uintptr_t length = data & PACKED_OFFSET_MASK;
-    length -= tagwidth;
-
-    data >>= PACKED_OFFSET_WIDTH;
-
-    uintptr_t tag = data & ((ONE << tagwidth) - 1);
+    uintptr_t tag = (data >> 1) & ((ONE << tagwidth) - 1);
     if (tag != field) {
       return FbleWrongUnionTag;
     }
 
     data >>= tagwidth;
-    data <<= PACKED_OFFSET_WIDTH;
-    data |= length;
-    data <<= 1;
     data |= 1;
     return (FbleValue*)data;
   }
@@ -1513,7 +2856,7 @@ FbleValue* FbleUnionValueField(FbleValue* object, size_t tagwidth, size_t field)
   FbleUnionValue* value = (FbleUnionValue*)object;
   return (value->_base.data == field) ? value->arg : FbleWrongUnionTag;
 }
-
+
 /**
  * @func[EnsureTailCallArgsSpace] Makes sure enough space is allocated.
  *  Resizes runtime->tail_call_buffer as needed to have sufficient space,
@@ -1616,9 +2959,7 @@ static FbleValue* TailCall(Runtime* runtime, FbleProfileThread* profile)
       FbleProfileReplaceBlock(profile, func->function.profile_block_id);
     }
 
-    bool should_merge = runtime->top->caller != NULL
-      && runtime->top->max == runtime->top->caller->max
-      && runtime->top->top - runtime->top->caller->top < MERGE_LIMIT;
+    bool should_merge = ShouldMerge(runtime);
     CompactFrame(runtime, should_merge, 1 + argc, runtime->_base.tail_call_buffer);
 
     func = (FbleFuncValue*)runtime->_base.tail_call_buffer[0];
@@ -1670,33 +3011,61 @@ static FbleValue* TailCall(Runtime* runtime, FbleProfileThread* profile)
  */
 static FbleValue* Eval(Runtime* runtime, FbleValue* func, size_t argc, FbleValue** args)
 {
-#ifndef __WIN32
-  // The fble spec requires we don't put an arbitrarily low limit on the stack
-  // size. Fix that here.
-  struct rlimit original_stack_limit;
-  if (getrlimit(RLIMIT_STACK, &original_stack_limit) != 0) {
-    assert(false && "getrlimit failed");
-  }
-
-  struct rlimit new_stack_limit = original_stack_limit;
-  new_stack_limit.rlim_cur = new_stack_limit.rlim_max;
-  if (setrlimit(RLIMIT_STACK, &new_stack_limit) != 0) {
-    assert(false && "setrlimit failed");
-  }
-#endif // __WIN32
-
   FbleProfileThread* profile_thread = FbleNewProfileThread(runtime->_base.profile);
   FbleValue* result = FbleCall(&runtime->_base, profile_thread, func, argc, args);
   FbleFreeProfileThread(profile_thread);
+  return result;
+}
+
+/**
+ * @func[RaiseStackLimit] Raises the stack limit for use by a runtime.
+ *  The fble spec requires we don't put an arbitrarily low limit on the stack
+ *  size. GcRealloc and RefsAssign don't depend on the C stack, but non-tail
+ *  calls made by fble functions still do.
+ *
+ *  This used to be done around every call to FbleApply. Doing it once for
+ *  the lifetime of the runtime saves three system calls per FbleApply.
+ *
+ *  @sideeffects
+ *   Raises the soft stack limit to the hard stack limit if this is the only
+ *   runtime. Call RestoreStackLimit when the runtime is freed.
+ */
+static void RaiseStackLimit()
+{
+#ifndef __WIN32
+  pthread_mutex_lock(&gStackLimitLock);
+  if (gStackLimitUsers++ == 0) {
+    if (getrlimit(RLIMIT_STACK, &gOriginalStackLimit) != 0) {
+      assert(false && "getrlimit failed");
+    }
 
+    struct rlimit new_stack_limit = gOriginalStackLimit;
+    new_stack_limit.rlim_cur = new_stack_limit.rlim_max;
+    if (setrlimit(RLIMIT_STACK, &new_stack_limit) != 0) {
+      assert(false && "setrlimit failed");
+    }
+  }
+  pthread_mutex_unlock(&gStackLimitLock);
+#endif // __WIN32
+}
+
+/**
+ * @func[RestoreStackLimit] Restores the stack limit after use by a runtime.
+ *  @sideeffects
+ *   Restores the stack limit to what it was before the first call to
+ *   RaiseStackLimit if there are no other runtimes left.
+ */
+static void RestoreStackLimit()
+{
 #ifndef __WIN32
-  // Restore the stack limit to what it was before.
-  if (setrlimit(RLIMIT_STACK, &original_stack_limit) != 0) {
-    assert(false && "setrlimit failed");
+  pthread_mutex_lock(&gStackLimitLock);
+  if (--gStackLimitUsers == 0) {
+    if (setrlimit(RLIMIT_STACK, &gOriginalStackLimit) != 0) {
+      assert(false && "setrlimit failed");
+    }
   }
+  pthread_mutex_unlock(&gStackLimitLock);
 #endif // __WIN32
-
-  return result;
 }
 
 // See documentation in fble-function.h
@@ -1723,9 +3092,7 @@ FbleValue* FbleCall(FbleRuntime* runtime_, FbleProfileThread* profile, FbleValue
   size_t num_unused = argc - executable->num_args;
   FbleValue** unused = args + executable->num_args;
 
-  bool should_merge = runtime->top->caller != NULL
-    && runtime->top->max == runtime->top->caller->max
-    && runtime->top->top - runtime->top->caller->top < MERGE_LIMIT;
+  bool should_merge = ShouldMerge(runtime);
   PushFrame(runtime, should_merge);
   FbleValue* result = executable->run(&runtime->_base, profile, func, args);
 
@@ -1748,6 +3115,87 @@ FbleValue* FbleCall(FbleRuntime* runtime_, FbleProfileThread* profile, FbleValue
   return result;
 }
 
+// See documentation in runtime.h.
+void FbleEnterCallFrame(FbleRuntime* runtime_)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  bool should_merge = ShouldMerge(runtime);
+  PushFrame(runtime, should_merge);
+}
+
+// See documentation in runtime.h.
+void FbleTailCallFrame(FbleRuntime* runtime_)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  bool should_merge = ShouldMerge(runtime);
+  CompactFrame(runtime, should_merge, 1 + runtime->_base.tail_call_argc, runtime->_base.tail_call_buffer);
+}
+
+// See documentation in runtime.h.
+FbleValue* FbleFinishTailCall(FbleRuntime* runtime, FbleProfileThread* profile)
+{
+  return TailCall((Runtime*)runtime, profile);
+}
+
+// See documentation in runtime.h.
+void* FbleAllocRegisters(FbleRuntime* runtime_, size_t size)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  if (runtime->registers_max < runtime->registers_top + (intptr_t)size) {
+    Chunk* chunk = AllocChunk(runtime, size);
+    chunk->next = runtime->registers;
+    runtime->registers = chunk;
+    runtime->registers_top = (intptr_t)(chunk + 1);
+    runtime->registers_max = chunk->size + (intptr_t)chunk;
+  }
+
+  void* result = (void*)runtime->registers_top;
+  runtime->registers_top += size;
+  return result;
+}
+
+// See documentation in runtime.h.
+void FbleFreeRegisters(FbleRuntime* runtime_, void* registers)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  intptr_t top = (intptr_t)registers;
+
+  // Release any newer chunks the registers were not allocated from.
+  while (top < (intptr_t)(runtime->registers + 1) || top >= runtime->registers_max) {
+    Chunk* chunk = runtime->registers;
+    runtime->registers = chunk->next;
+    chunk->next = NULL;
+    ReleaseChunks(runtime, &chunk);
+
+    assert(runtime->registers != NULL && "registers freed out of order");
+    runtime->registers_max = runtime->registers->size + (intptr_t)runtime->registers;
+  }
+  runtime->registers_top = top;
+}
+
+// See documentation in runtime.h.
+FbleFunction* FbleFuncValueFunction(FbleValue* value)
+{
+  if (value == NULL || IsRefValue(value)) {
+    return NULL;
+  }
+  return &((FbleFuncValue*)value)->function;
+}
+
+// See documentation in runtime.h.
+FbleValue* FbleCallExact(FbleRuntime* runtime_, FbleFunction* function, FbleValue** args)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+
+  bool should_merge = ShouldMerge(runtime);
+  PushFrame(runtime, should_merge);
+  FbleValue* result = function->executable.run(&runtime->_base, NULL, function, args);
+  if (result == runtime->_base.tail_call_sentinel) {
+    return TailCall(runtime, NULL);
+  }
+  return FblePopFrame(&runtime->_base, result);
+}
+
 // See documentation in fble-runtime.h.
 FbleValue* FbleEval(FbleRuntime* runtime, FbleValue* program)
 {
@@ -1768,6 +3216,21 @@ FbleValue* FbleNewFuncValue(FbleRuntime* runtime_, FbleExecutable* executable, s
   Runtime* runtime = (Runtime*)runtime_;
   EnsureTailCallArgsSpace(runtime, executable->max_call_args);
 
+  if (executable->on_free != NULL) {
+    // Stack values are never freed one by one, so a function value that
+    // owns its executable's data goes on the heap right away, like a native
+    // value. Its statics move to the heap along with it.
+    FbleFuncValue* v = NewGcValueExtra(runtime, runtime->top, FbleFuncValue, FUNC_VALUE, executable->num_statics);
+    v->function.profile_block_id = profile_block_id;
+    memcpy(&v->function.executable, executable, sizeof(FbleExecutable));
+    v->function.statics = v->statics;
+    memset(v->statics, 0, executable->num_statics * sizeof(FbleValue*));
+    for (size_t i = 0; i < executable->num_statics; ++i) {
+      v->statics[i] = GcRealloc(runtime, statics[i]);
+    }
+    return &v->_base;
+  }
+
   FbleFuncValue* v = NewValueExtra(runtime, FbleFuncValue, FUNC_VALUE, executable->num_statics);
   v->function.profile_block_id = profile_block_id;
   memcpy(&v->function.executable, executable, sizeof(FbleExecutable));
@@ -1777,63 +3240,190 @@ FbleValue* FbleNewFuncValue(FbleRuntime* runtime_, FbleExecutable* executable, s
   }
   return &v->_base;
 }
-
-// See documentation in fble-runtime.h
-void FbleRegisterForeignValue(FbleRuntime* runtime_, FbleForeign* foreign)
+
+// See documentation in runtime.h.
+void FbleAddExecutables(FbleRuntime* runtime_, FbleExecutableV executables)
 {
   Runtime* runtime = (Runtime*)runtime_;
-  FbleAppendToVector(runtime->foreign, foreign);
+  for (size_t i = 0; i < executables.size; ++i) {
+    FbleAppendToVector(runtime->executables, *executables.xs[i]);
+  }
 }
 
-// See documentation in fble-runtime.h.
-FbleForeign* FbleLookupForeignValue(FbleRuntime* runtime_, FbleModulePath* path, const char* name)
+// See documentation in runtime.h.
+void FbleAddModuleHash(FbleRuntime* runtime_, uint64_t hash)
 {
   Runtime* runtime = (Runtime*)runtime_;
-  for (size_t i = 0; i < runtime->foreign.size; ++i) {
-    FbleForeign* foreign = runtime->foreign.xs[i];
-    if (strcmp(name, foreign->name) == 0) {
-      // TODO: It's silly to have to allocate temporary module paths for every
-      // module we want to check against. Figure out a better way.
-      FbleModulePath* foreign_path = FbleParseModulePath(foreign->path);
-      bool paths_match = foreign_path != NULL && FbleModulePathsEqual(path, foreign_path);
-      FbleFreeModulePath(foreign_path);
-      if (paths_match) {
-        return foreign;
-      }
-    }
-  }
-  return NULL;
+  runtime->modules = HashWord(runtime->modules, hash);
 }
 
-// See documentation in fble-runtime.h.
-FbleValue* FbleNewForeignValue(FbleRuntime* runtime, FbleProfileThread* profile, FbleForeign* foreign, size_t profile_block_id)
+/**
+ * @func[HashString] Adds a string to a hash.
+ *  Uses the FNV-1a hash function.
+ *
+ *  @arg[uint64_t][hash] The hash so far.
+ *  @arg[const char*][str] The string to add to the hash.
+ *  @returns[uint64_t] The updated hash.
+ */
+static uint64_t HashString(uint64_t hash, const char* str)
 {
-  FbleExecutable exe = {
-    .num_args = foreign->num_args,
-    .num_statics = 0,
-    .max_call_args = foreign->max_call_args,
-    .run = foreign->run
-  };
-  FbleValue* func = FbleNewFuncValue(runtime, &exe, profile_block_id, NULL);
-
-  if (foreign->num_args == 0) {
-    return FbleCall(runtime, profile, func, 0, NULL);
+  for (const char* c = str; *c != '\0'; ++c) {
+    hash = (hash ^ (unsigned char)*c) * 0x100000001b3;
   }
-  return func;
+  return hash;
 }
 
-// See documentation in fble-runtime.h.
-FbleValue* FbleNewListValue(FbleRuntime* runtime, size_t argc, FbleValue** args)
+/**
+ * @func[HashForeign] Computes the hash of a foreign value's path and name.
+ *  @arg[FbleModulePath*][path] The module path of the foreign value.
+ *  @arg[const char*][name] The name of the foreign value.
+ *  @returns[uint64_t] The hash of the path and name.
+ */
+static uint64_t HashForeign(FbleModulePath* path, const char* name)
 {
-  FbleValue* unit = FbleNewStructValue_(runtime, 0);
-  FbleValue* tail = FbleNewUnionValue(runtime, 1, 1, unit);
-  for (size_t i = 0; i < argc; ++i) {
-    FbleValue* arg = args[argc - i - 1];
-    FbleValue* cons = FbleNewStructValue_(runtime, 2, arg, tail);
-
-    tail = FbleNewUnionValue(runtime, 1, 0, cons);
+  uint64_t hash = 0xcbf29ce484222325;
+  for (size_t i = 0; i < path->path.size; ++i) {
+    hash = HashString(hash, path->path.xs[i].name->str);
+    hash = HashString(hash, "/");
   }
-  return tail;
+  hash = HashString(hash, "%");
+  return HashString(hash, name);
+}
+
+/**
+ * @func[InsertForeign] Inserts an entry into a foreign table.
+ *  @arg[ForeignTable*][table] The table to insert into.
+ *  @arg[ForeignEntry][entry] The entry to insert.
+ *  @sideeffects
+ *   Adds the entry to the table, taking ownership of entry.path. The table
+ *   must have room for the entry.
+ */
+static void InsertForeign(ForeignTable* table, ForeignEntry entry)
+{
+  size_t mask = table->capacity - 1;
+  size_t i = entry.hash & mask;
+  while (table->xs[i].foreign != NULL) {
+    i = (i + 1) & mask;
+  }
+  table->xs[i] = entry;
+  table->size++;
+}
+
+// See documentation in fble-runtime.h
+void FbleRegisterForeignValue(FbleRuntime* runtime_, FbleForeign* foreign)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+
+  FbleModulePath* path = FbleParseModulePath(foreign->path);
+  if (path == NULL) {
+    // There's no way to look up a foreign value without a valid path.
+    return;
+  }
+
+  // If there are multiple registrations for the same foreign value, the
+  // first one wins.
+  if (FbleLookupForeignValue(runtime_, path, foreign->name) != NULL) {
+    FbleFreeModulePath(path);
+    return;
+  }
+
+  // Keep the table at most half full.
+  ForeignTable* table = &runtime->foreign;
+  if (2 * (table->size + 1) > table->capacity) {
+    ForeignTable old = *table;
+    table->size = 0;
+    table->capacity = 2 * old.capacity;
+    table->xs = FbleAllocArray(ForeignEntry, table->capacity);
+    memset(table->xs, 0, table->capacity * sizeof(ForeignEntry));
+    for (size_t i = 0; i < old.capacity; ++i) {
+      if (old.xs[i].foreign != NULL) {
+        InsertForeign(table, old.xs[i]);
+      }
+    }
+    FbleFree(old.xs);
+  }
+
+  ForeignEntry entry = {
+    .hash = HashForeign(path, foreign->name),
+    .path = path,
+    .foreign = foreign
+  };
+  InsertForeign(table, entry);
+
+  FbleExecutable exe = {
+    .num_args = foreign->num_args,
+    .num_statics = 0,
+    .max_call_args = foreign->max_call_args,
+    .run = foreign->run,
+    .data = NULL
+  };
+  FbleAppendToVector(runtime->executables, exe);
+}
+
+// See documentation in fble-runtime.h.
+FbleForeign* FbleLookupForeignValue(FbleRuntime* runtime_, FbleModulePath* path, const char* name)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  ForeignTable* table = &runtime->foreign;
+  uint64_t hash = HashForeign(path, name);
+  size_t mask = table->capacity - 1;
+  for (size_t i = hash & mask; table->xs[i].foreign != NULL; i = (i + 1) & mask) {
+    ForeignEntry* entry = table->xs + i;
+    if (entry->hash == hash
+        && strcmp(name, entry->foreign->name) == 0
+        && FbleModulePathsEqual(path, entry->path)) {
+      return entry->foreign;
+    }
+  }
+  return NULL;
+}
+
+// See documentation in fble-runtime.h.
+FbleValue* FbleNewForeignValue(FbleRuntime* runtime, FbleProfileThread* profile, FbleForeign* foreign, size_t profile_block_id)
+{
+  FbleExecutable exe = {
+    .num_args = foreign->num_args,
+    .num_statics = 0,
+    .max_call_args = foreign->max_call_args,
+    .run = foreign->run
+  };
+  FbleValue* func = FbleNewFuncValue(runtime, &exe, profile_block_id, NULL);
+
+  if (foreign->num_args == 0) {
+    return FbleCall(runtime, profile, func, 0, NULL);
+  }
+  return func;
+}
+
+// See documentation in fble-runtime.h.
+FbleValue* FbleNewListValue(FbleRuntime* runtime, size_t argc, FbleValue** args)
+{
+  FbleValue* unit = FbleNewStructValue_(runtime, 0);
+  FbleValue* tail = FbleNewUnionValue(runtime, 1, 1, unit);
+
+  // Pack as much of the end of the list as fits in a packed value.
+  while (argc > 0
+      && IsPacked(args[argc - 1])
+      && PackedLength(args[argc - 1]) + PackedLength(tail) + PACKED_OFFSET_WIDTH + 1 <= PACKED_DATA_WIDTH) {
+    FbleValue* cons = FbleNewStructValue_(runtime, 2, args[argc - 1], tail);
+    tail = FbleNewUnionValue(runtime, 1, 0, cons);
+    argc--;
+  }
+
+  // Allocate the rest of the list in list blocks.
+  while (argc > 0) {
+    size_t n = argc < MAX_LIST_BLOCK_CELLS ? argc : MAX_LIST_BLOCK_CELLS;
+    argc -= n;
+
+    FbleValue* block = NewValueRaw((Runtime*)runtime, UNION_VALUE, n * LIST_CELL_WORDS * sizeof(FbleValue*));
+    for (size_t i = 0; i < n; ++i) {
+      ListCellStruct(block, i)->fields[0] = args[argc + i];
+    }
+    ListCellStruct(block, n - 1)->fields[1] = tail;
+    LinkListBlock(block, n, 0);
+    tail = block;
+  }
+  return tail;
 }
 
 // See documentation in fble-runtime.h.
@@ -1907,6 +3497,7 @@ size_t FbleDefineRecursiveValues(FbleRuntime* runtime_, FbleValue* decl, FbleVal
   // Write back the final assignments.
   for (size_t i = 0; i < n; ++i) {
     refs[i] = values[i];
+    MarkRefAssigned(runtime, values[i]);
   }
   return 0;
 }
@@ -1920,10 +3511,20 @@ FbleValue* FbleNewNativeValue(FbleRuntime* runtime_,
   NativeValue* value = NewGcValue(runtime, runtime->top, NativeValue, NATIVE_VALUE);
   value->data = data;
   value->on_free = on_free;
+  value->concurrent = false;
   return &value->_base;
 }
 
 // See documentation in fble-runtime.h
+FbleValue* FbleNewConcurrentNativeValue(FbleRuntime* runtime,
+    void* data, void (*on_free)(void* data))
+{
+  FbleValue* value = FbleNewNativeValue(runtime, data, on_free);
+  ((NativeValue*)value)->concurrent = true;
+  return value;
+}
+
+// See documentation in fble-runtime.h
 void* FbleNativeValueData(FbleValue* value)
 {
   assert((value->flags & FbleValueFlagTagBits) == NATIVE_VALUE);
@@ -1955,8 +3556,996 @@ void FbleFullGc(FbleRuntime* runtime_)
   Runtime* runtime = (Runtime*)runtime_;
 
   while (!(runtime->gc.next == NULL
-      && IsEmpty(&runtime->gc.frame->marked)
+      && runtime->gc.marked.size == 0
+      && IsEmpty(&runtime->gc.unmarked)
+      && IsEmpty(&runtime->gc.pending)
       && IsEmpty(&runtime->gc.frame->unmarked))) {
     IncrGc(runtime);
   }
+
+  if (runtime->sweeper.enabled) {
+    HandOff(runtime, true);
+  }
+}
+
+// See documentation in fble-runtime.h
+void FbleSetGcPace(FbleRuntime* runtime_, size_t pace)
+{
+  assert(pace > 0 && "GC pace must be positive");
+  Runtime* runtime = (Runtime*)runtime_;
+  runtime->gc.pace = pace;
+}
+
+// See documentation in fble-runtime.h
+void FbleSetBackgroundSweep(FbleRuntime* runtime_, bool enabled)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  Sweeper* sweeper = &runtime->sweeper;
+  if (enabled == sweeper->enabled) {
+    return;
+  }
+
+  if (enabled) {
+    assert(runtime->stats.gc_allocs == 0
+        && "Background sweeping must be enabled before allocating values");
+    pthread_mutex_init(&sweeper->lock, NULL);
+    pthread_cond_init(&sweeper->signal, NULL);
+    Clear(&sweeper->todo);
+    Clear(&sweeper->done);
+    sweeper->busy = false;
+    sweeper->stop = false;
+    if (pthread_create(&sweeper->thread, NULL, &SweeperThread, sweeper) != 0) {
+      pthread_cond_destroy(&sweeper->signal);
+      pthread_mutex_destroy(&sweeper->lock);
+      return;
+    }
+    sweeper->enabled = true;
+    return;
+  }
+
+  HandOff(runtime, true);
+
+  pthread_mutex_lock(&sweeper->lock);
+  sweeper->stop = true;
+  pthread_cond_broadcast(&sweeper->signal);
+  pthread_mutex_unlock(&sweeper->lock);
+  pthread_join(sweeper->thread, NULL);
+
+  pthread_cond_destroy(&sweeper->signal);
+  pthread_mutex_destroy(&sweeper->lock);
+  sweeper->enabled = false;
+}
+
+// See documentation in fble-runtime.h
+void FbleSetStackChunkSize(FbleRuntime* runtime_, size_t size)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  runtime->chunk_size = size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : size;
+
+  // Free unused chunks so they get reallocated at the new size.
+  FreeChunks(runtime, &runtime->chunks);
+  runtime->idle_chunks = 0;
+  runtime->stats.stack_idle_bytes = 0;
+}
+
+// See documentation in fble-runtime.h
+void FbleSetMergeLimit(FbleRuntime* runtime_, size_t limit)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  runtime->merge_limit = limit;
+}
+
+// See documentation in fble-runtime.h
+void FbleSetMergeLimitTuning(FbleRuntime* runtime_, bool enabled)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  runtime->merge_tuning = enabled;
+  runtime->tuning_calls = 0;
+  runtime->tuning_promoted = runtime->stats.promoted;
+}
+
+// See documentation in fble-runtime.h
+void FbleSetHashConsing(FbleRuntime* runtime_, bool enabled)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  if (enabled && runtime->hash_cons == NULL) {
+    runtime->hash_cons = FbleAllocArray(FbleValue*, HASH_CONS_ENTRIES);
+    memset(runtime->hash_cons, 0, HASH_CONS_ENTRIES * sizeof(FbleValue*));
+  } else if (!enabled && runtime->hash_cons != NULL) {
+    FbleFree(runtime->hash_cons);
+    runtime->hash_cons = NULL;
+  }
+}
+
+// See documentation in fble-runtime.h
+FbleRuntimeStats FbleGetRuntimeStats(FbleRuntime* runtime_)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  return runtime->stats;
+}
+
+// See documentation in fble-runtime.h
+void FblePrintRuntimeStats(FILE* fout, FbleRuntime* runtime)
+{
+  FbleRuntimeStats stats = FbleGetRuntimeStats(runtime);
+  fprintf(fout, "Runtime Stats:\n");
+  fprintf(fout, "  stack allocs:     %zu\n", stats.stack_allocs);
+  fprintf(fout, "  promoted:         %zu\n", stats.promoted);
+  fprintf(fout, "  merges:           %zu\n", stats.merges);
+  fprintf(fout, "  gc allocs:        %zu\n", stats.gc_allocs);
+  fprintf(fout, "  gc frees:         %zu\n", stats.gc_frees);
+  fprintf(fout, "  gc steps:         %zu\n", stats.gc_steps);
+  fprintf(fout, "  gc traversed:     %zu\n", stats.gc_traversed);
+  fprintf(fout, "  gc visited:       %zu\n", stats.gc_visited);
+  fprintf(fout, "  gc cycles:        %zu\n", stats.gc_cycles);
+  fprintf(fout, "  gc bytes:         %zu\n", stats.gc_bytes);
+  fprintf(fout, "  max gc bytes:     %zu\n", stats.max_gc_bytes);
+  fprintf(fout, "  stack bytes:      %zu\n", stats.stack_bytes);
+  fprintf(fout, "  stack idle bytes: %zu\n", stats.stack_idle_bytes);
+  fprintf(fout, "  hash cons hits:   %zu\n", stats.hash_cons_hits);
+  fprintf(fout, "  hash cons misses: %zu\n", stats.hash_cons_misses);
+}
+
+// See documentation in fble-runtime.h
+void FbleSetRuntimeStatsOutput(FbleRuntime* runtime_, FILE* fout)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  runtime->stats_output = fout;
+}
+
+// See documentation in runtime.h.
+FbleRuntime* FbleNewWorkerRuntime(FbleRuntime* parent_)
+{
+  Runtime* parent = (Runtime*)parent_;
+  Runtime* worker = (Runtime*)FbleNewRuntime();
+
+  // The worker needs the names of profiling blocks to report runtime
+  // errors, but doesn't do any profiling. Skip over the root block, which
+  // the worker profile already has.
+  worker->_base.profile->enabled = false;
+  FbleNameV blocks = {
+    .size = parent->_base.profile->blocks.size - 1,
+    .xs = parent->_base.profile->blocks.xs + 1
+  };
+  FbleAddBlocksToProfile(worker->_base.profile, blocks);
+
+  worker->chunk_size = parent->chunk_size;
+  worker->merge_limit = parent->merge_limit;
+  worker->merge_tuning = parent->merge_tuning;
+  worker->gc.pace = parent->gc.pace;
+  FbleSetHashConsing(&worker->_base, parent->hash_cons != NULL);
+  FbleSetBackgroundSweep(&worker->_base, parent->sweeper.enabled);
+
+  // Start the worker at generations newer than anything allocated on the
+  // parent so far. That way the worker treats all of the parent's values as
+  // belonging to older frames and never modifies them, and FbleAdoptValue
+  // can tell which values belong to the worker.
+  Frame* base = worker->top;
+  base->min_gen = parent->top->max_gen;
+  base->gen = base->min_gen;
+  base->max_gen = base->gen + 1;
+  worker->gc.min_gen = base->min_gen;
+  worker->gc.gen = base->gen;
+  worker->gc.max_gen = base->max_gen;
+
+  FbleFree(worker->foreign.xs);
+  worker->foreign.size = parent->foreign.size;
+  worker->foreign.capacity = parent->foreign.capacity;
+  worker->foreign.xs = FbleAllocArray(ForeignEntry, worker->foreign.capacity);
+  for (size_t i = 0; i < parent->foreign.capacity; ++i) {
+    worker->foreign.xs[i] = parent->foreign.xs[i];
+    if (parent->foreign.xs[i].foreign != NULL) {
+      worker->foreign.xs[i].path = FbleCopyModulePath(parent->foreign.xs[i].path);
+    }
+  }
+
+  FbleSyncWorkerRuntime(&worker->_base, parent_);
+  return &worker->_base;
+}
+
+// See documentation in runtime.h.
+void FbleSyncWorkerRuntime(FbleRuntime* worker, FbleRuntime* parent)
+{
+  EnsureTailCallArgsSpace((Runtime*)worker, (((Runtime*)parent)->tail_call_capacity + 1) / 2);
+}
+
+// See documentation in runtime.h.
+FbleValue* FbleShareValue(FbleRuntime* runtime, FbleValue* value)
+{
+  return GcRealloc((Runtime*)runtime, value);
+}
+
+/**
+ * @func[InitValueTable] Initializes an empty table of values.
+ *  @arg[ValueTable*][table] The table to initialize.
+ *  @sideeffects
+ *   Allocates memory for the table that should be freed with FbleFree of
+ *   table->xs when no longer needed.
+ */
+static void InitValueTable(ValueTable* table)
+{
+  table->size = 0;
+  table->capacity = INITIAL_VALUE_TABLE_CAPACITY;
+  table->xs = FbleAllocArray(ValueEntry, table->capacity);
+  memset(table->xs, 0, table->capacity * sizeof(ValueEntry));
+}
+
+/**
+ * @func[LookupValue] Looks up a value in a table of values.
+ *  @arg[ValueTable*][table] The table to look in.
+ *  @arg[FbleValue*][key] The value to look up.
+ *  @returns[ValueEntry*]
+ *   The entry for @a[key], or the unused entry where it belongs if it is not
+ *   in the table.
+ *  @sideeffects
+ *   None.
+ */
+static ValueEntry* LookupValue(ValueTable* table, FbleValue* key)
+{
+  uint64_t hash = (uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ULL;
+  size_t i = (size_t)(hash >> 32) & (table->capacity - 1);
+  while (table->xs[i].key != NULL && table->xs[i].key != key) {
+    i = (i + 1) & (table->capacity - 1);
+  }
+  return table->xs + i;
+}
+
+/**
+ * @func[InsertValue] Adds a value to a table of values.
+ *  @arg[ValueTable*][table] The table to add the value to.
+ *  @arg[ValueEntry*][entry]
+ *   The unused entry returned by LookupValue for @a[key].
+ *  @arg[FbleValue*][key] The value to add.
+ *  @arg[uintptr_t][data] The data to associate with the value.
+ *  @sideeffects
+ *   Adds the value to the table, invalidating any entry pointers into the
+ *   table.
+ */
+static void InsertValue(ValueTable* table, ValueEntry* entry, FbleValue* key, uintptr_t data)
+{
+  entry->key = key;
+  entry->data = data;
+  table->size++;
+
+  // Keep the table at most half full.
+  if (2 * table->size > table->capacity) {
+    ValueTable old = *table;
+    table->capacity = 2 * old.capacity;
+    table->xs = FbleAllocArray(ValueEntry, table->capacity);
+    memset(table->xs, 0, table->capacity * sizeof(ValueEntry));
+    for (size_t i = 0; i < old.capacity; ++i) {
+      if (old.xs[i].key != NULL) {
+        *LookupValue(table, old.xs[i].key) = old.xs[i];
+      }
+    }
+    FbleFree(old.xs);
+  }
+}
+
+/**
+ * @func[Adopt] Shallow copies a worker value to the parent runtime.
+ *  @arg[Runtime*][runtime] The parent runtime.
+ *  @arg[Runtime*][worker] The worker runtime.
+ *  @arg[ValueTable*][table]
+ *   Map from worker value to the parent's copy for values adopted so far.
+ *  @arg[FbleValue*][value] The value to adopt. Must be GC allocated.
+ *  @returns[FbleValue*] The parent's copy of the value.
+ *  @sideeffects
+ *   @i Allocates a GC value on the top frame of the parent runtime.
+ *   @i Adds the value to @a[table].
+ *   @item
+ *    Pushes the new value onto the promoting stack of the parent runtime if
+ *    its fields have yet to be adopted.
+ *   @i Transfers ownership of native data to the parent runtime.
+ */
+static FbleValue* Adopt(Runtime* runtime, Runtime* worker, ValueTable* table, FbleValue* value)
+{
+  // Packed values and NULL need not be allocated at all.
+  if (!IsAlloced(value)) {
+    return value;
+  }
+
+  // Values that don't belong to the worker are used as is.
+  assert(value->flags & FbleValueFlagIsGcAllocBit);
+  if (GcAllocatedValueOf(value)->gen < ((Frame*)worker->stack)->min_gen) {
+    return value;
+  }
+
+  ValueEntry* entry = LookupValue(table, value);
+  if (entry->key != NULL) {
+    return (FbleValue*)entry->data;
+  }
+
+  Frame* frame = runtime->top;
+  FbleValue* nvalue = NULL;
+  switch ((ValueTag)(value->flags & FbleValueFlagTagBits)) {
+    case STRUCT_VALUE: {
+      FbleStructValue* sv = (FbleStructValue*)value;
+      FbleStructValue* nv = NewGcValueExtra(runtime, frame, FbleStructValue, STRUCT_VALUE, value->data);
+      nv->_base.data = sv->_base.data;
+      memcpy(nv->fields, sv->fields, sv->_base.data * sizeof(FbleValue*));
+      nvalue = &nv->_base;
+      break;
+    }
+
+    case UNION_VALUE: {
+      FbleUnionValue* uv = (FbleUnionValue*)value;
+      FbleUnionValue* nv = NewGcValue(runtime, frame, FbleUnionValue, UNION_VALUE);
+      nv->_base.data = uv->_base.data;
+      nv->arg = uv->arg;
+      nvalue = &nv->_base;
+      break;
+    }
+
+    case FUNC_VALUE: {
+      FbleFuncValue* fv = (FbleFuncValue*)value;
+      EnsureTailCallArgsSpace(runtime, fv->function.executable.max_call_args);
+      FbleFuncValue* nv = NewGcValueExtra(runtime, frame, FbleFuncValue, FUNC_VALUE, fv->function.executable.num_statics);
+      memcpy(&nv->function.executable, &fv->function.executable, sizeof(FbleExecutable));
+      nv->function.profile_block_id = fv->function.profile_block_id;
+      nv->function.statics = nv->statics;
+      memcpy(nv->statics, fv->statics, fv->function.executable.num_statics * sizeof(FbleValue*));
+      fv->function.executable.on_free = NULL;
+      nvalue = &nv->_base;
+      break;
+    }
+
+    case NATIVE_VALUE: {
+      NativeValue* v = (NativeValue*)value;
+      NativeValue* nv = NewGcValue(runtime, frame, NativeValue, NATIVE_VALUE);
+      nv->data = v->data;
+      nv->on_free = v->on_free;
+      nv->concurrent = v->concurrent;
+      v->on_free = NULL;
+      nvalue = &nv->_base;
+      break;
+    }
+  }
+
+  InsertValue(table, entry, value, (uintptr_t)nvalue);
+
+  if ((value->flags & FbleValueFlagTagBits) != NATIVE_VALUE) {
+    if (runtime->promoting.size == runtime->promoting_capacity) {
+      runtime->promoting_capacity *= 2;
+      runtime->promoting.xs = FbleReAllocArray(FbleValue*, runtime->promoting.xs, runtime->promoting_capacity);
+    }
+    runtime->promoting.xs[runtime->promoting.size++] = nvalue;
+  }
+  return nvalue;
+}
+
+// See documentation in runtime.h.
+FbleValue* FbleAdoptValue(FbleRuntime* runtime_, FbleRuntime* worker_, FbleValue* value)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  Runtime* worker = (Runtime*)worker_;
+
+  // Make sure every part of the value that belongs to the worker is GC
+  // allocated, so we don't have to worry about the worker's stack.
+  value = GcRealloc(worker, value);
+
+  // Other workers may be reading the parent's values while we allocate. GC
+  // marks values it traverses, so hold off on GC work until we're done.
+  size_t pace = runtime->gc.pace;
+  runtime->gc.pace = 0;
+
+  ValueTable table;
+  InitValueTable(&table);
+
+  FbleValue* result = Adopt(runtime, worker, &table, value);
+  while (runtime->promoting.size > 0) {
+    FbleValue* nvalue = runtime->promoting.xs[--runtime->promoting.size];
+    switch ((ValueTag)(nvalue->flags & FbleValueFlagTagBits)) {
+      case STRUCT_VALUE: {
+        FbleStructValue* nv = (FbleStructValue*)nvalue;
+        for (size_t i = 0; i < nv->_base.data; ++i) {
+          nv->fields[i] = Adopt(runtime, worker, &table, nv->fields[i]);
+        }
+        break;
+      }
+
+      case UNION_VALUE: {
+        FbleUnionValue* nv = (FbleUnionValue*)nvalue;
+        nv->arg = Adopt(runtime, worker, &table, nv->arg);
+        break;
+      }
+
+      case FUNC_VALUE: {
+        FbleFuncValue* nv = (FbleFuncValue*)nvalue;
+        for (size_t i = 0; i < nv->function.executable.num_statics; ++i) {
+          nv->statics[i] = Adopt(runtime, worker, &table, nv->statics[i]);
+        }
+        break;
+      }
+
+      case NATIVE_VALUE: {
+        FbleUnreachable("native values have no fields to adopt.");
+        break;
+      }
+    }
+  }
+
+  FbleFree(table.xs);
+  runtime->gc.pace = pace;
+  return result;
+}
+
+// See documentation in runtime.h.
+FbleValue* FbleCachedValue(FbleRuntime* runtime_, size_t* id)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  size_t i = __atomic_load_n(id, __ATOMIC_RELAXED);
+  if (i == 0) {
+    return NULL;
+  }
+
+  CachedValue* entry = runtime->cached + CachedValueSlot(i);
+  if (entry->id != i) {
+    return NULL;
+  }
+
+  if (entry->packed) {
+    return entry->value;
+  }
+
+  // Generations increase up the stack, and a frame's gen changes when it's
+  // compacted. If the value still has the gen of the frame it was allocated
+  // on, that frame hasn't been compacted or popped, so the value is alive.
+  Frame* frame = runtime->top;
+  for (size_t d = 0; d < VALUE_CACHE_DEPTH && frame != NULL; ++d) {
+    if (entry->gen == frame->gen) {
+      return entry->value;
+    }
+
+    if (entry->gen >= frame->min_gen) {
+      break;
+    }
+    frame = frame->caller;
+  }
+  return NULL;
+}
+
+// See documentation in runtime.h.
+FbleValue* FbleCacheValue(FbleRuntime* runtime_, size_t* id, FbleValue* value)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+
+  // The same slot may be shared by runtimes on different threads. Whoever
+  // gets there first assigns the id.
+  size_t i = __atomic_load_n(id, __ATOMIC_RELAXED);
+  if (i == 0) {
+    size_t nid = __atomic_add_fetch(&gLastCacheId, 1, __ATOMIC_RELAXED);
+    if (__atomic_compare_exchange_n(id, &i, nid, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      i = nid;
+    }
+  }
+
+  // Cached values must be GC allocated for the gen check to work. Stack
+  // allocated values are freed when their frame is popped regardless.
+  FbleValue* result = GcRealloc(runtime, value);
+
+  CachedValue* entry = runtime->cached + CachedValueSlot(i);
+  entry->id = i;
+  entry->value = result;
+  entry->packed = !IsAlloced(result);
+  entry->gen = entry->packed ? 0 : GcAllocatedValueOf(result)->gen;
+  return result;
+}
+
+/**
+ * @func[HashWord] Adds a word to a hash.
+ *  Uses the FNV-1a hash function, a byte at a time.
+ *
+ *  @arg[uint64_t][hash] The hash so far.
+ *  @arg[uint64_t][word] The word to add to the hash.
+ *  @returns[uint64_t] The updated hash.
+ */
+static uint64_t HashWord(uint64_t hash, uint64_t word)
+{
+  for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+    hash = (hash ^ (word & 0xFF)) * 0x100000001b3;
+    word >>= 8;
+  }
+  return hash;
+}
+
+/**
+ * @func[SnapshotFingerprint] Identifies what a snapshot is compatible with.
+ *  Snapshots refer to profile blocks by id and to executables by index, so
+ *  they are only valid for runtimes with the same profile blocks and known
+ *  executables. They hold the value of a particular program, so they are
+ *  also only valid for runtimes with the same modules linked in.
+ *
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @returns[uint64_t]
+ *   A fingerprint of the runtime's profile blocks, known executables and
+ *   linked modules.
+ */
+static uint64_t SnapshotFingerprint(Runtime* runtime)
+{
+  uint64_t hash = runtime->modules;
+  hash = HashWord(hash, sizeof(FbleValue*));
+
+  uintptr_t code = (uintptr_t)&FbleNewRuntime;
+  for (size_t i = 0; i < runtime->executables.size; ++i) {
+    FbleExecutable* exe = runtime->executables.xs + i;
+    hash = HashWord(hash, exe->num_args);
+    hash = HashWord(hash, exe->num_statics);
+    hash = HashWord(hash, exe->max_call_args);
+    hash = HashWord(hash, (uintptr_t)exe->run - code);
+  }
+
+  FbleNameV* blocks = &runtime->_base.profile->blocks;
+  for (size_t i = 0; i < blocks->size; ++i) {
+    hash = HashString(hash, blocks->xs[i].name->str);
+    hash = HashString(hash, "@");
+    hash = HashString(hash, blocks->xs[i].loc.source->str);
+    hash = HashWord(hash, blocks->xs[i].loc.line);
+    hash = HashWord(hash, blocks->xs[i].loc.col);
+  }
+  return hash;
+}
+
+/**
+ * @func[ExecutableIndex] Finds the index of a known executable.
+ *  @arg[Runtime*][runtime] The runtime context.
+ *  @arg[ValueTable*][runs]
+ *   Map from run function, cast to FbleValue*, to the index of the first
+ *   known executable with that run function.
+ *  @arg[FbleExecutable*][exe] The executable to look up.
+ *  @arg[uint64_t*][index] Output for the index of the executable.
+ *  @returns[bool] True if the executable is known, false otherwise.
+ *  @sideeffects
+ *   Sets @a[index] to the index of the executable if it is known.
+ */
+static bool ExecutableIndex(Runtime* runtime, ValueTable* runs, FbleExecutable* exe, uint64_t* index)
+{
+  ValueEntry* entry = LookupValue(runs, (FbleValue*)(uintptr_t)exe->run);
+  if (entry->key == NULL) {
+    return false;
+  }
+
+  // Partially applied functions differ in their number of args and statics,
+  // which are saved with the function.
+  if (entry->data == 0) {
+    *index = 0;
+    return true;
+  }
+
+  for (size_t i = entry->data; i < runtime->executables.size; ++i) {
+    FbleExecutable* known = runtime->executables.xs + i;
+    if (known->run == exe->run
+        && known->num_args == exe->num_args
+        && known->num_statics == exe->num_statics
+        && known->max_call_args == exe->max_call_args) {
+      *index = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * @func[NumberValue] Assigns an object number to a value being saved.
+ *  @arg[ValueTable*][table] Map from value to object number.
+ *  @arg[FbleValueV*][objects] Values in order of object number.
+ *  @arg[FbleValue*][value] The value to number. Must be GC allocated.
+ *  @arg[const char**][error] Output for why the value can't be saved.
+ *  @returns[bool] False if the value can't be saved, true otherwise.
+ *  @sideeffects
+ *   @i Adds the value to @a[table] and @a[objects] if it needs a number.
+ *   @i Sets @a[error] if the value can't be saved.
+ */
+static bool NumberValue(ValueTable* table, FbleValueV* objects, FbleValue* value, const char** error)
+{
+  if (IsRefValue(value)) {
+    *error = "unable to save vacuous value";
+    return false;
+  }
+
+  if (!IsAlloced(value)) {
+    return true;
+  }
+
+  if ((value->flags & FbleValueFlagTagBits) == NATIVE_VALUE) {
+    *error = "unable to save native value";
+    return false;
+  }
+
+  if ((value->flags & FbleValueFlagTagBits) == FUNC_VALUE
+      && ((FbleFuncValue*)value)->function.executable.data != NULL) {
+    // The data isn't something we know how to save.
+    *error = "unable to save interpreted function";
+    return false;
+  }
+
+  ValueEntry* entry = LookupValue(table, value);
+  if (entry->key == NULL) {
+    InsertValue(table, entry, value, objects->size);
+    FbleAppendToVector(*objects, value);
+  }
+  return true;
+}
+
+/**
+ * @func[EncodeValue] Encodes a reference to a value being saved.
+ *  NULL is encoded as 0 and packed values as themselves, which always have
+ *  the least significant bit set. Object number i is encoded as (i+1) << 1.
+ *
+ *  @arg[ValueTable*][table] Map from value to object number.
+ *  @arg[FbleValue*][value] The value to encode. Must already be numbered.
+ *  @returns[uint64_t] The encoded reference.
+ *  @sideeffects None.
+ */
+static uint64_t EncodeValue(ValueTable* table, FbleValue* value)
+{
+  if (!IsAlloced(value)) {
+    return (uintptr_t)value;
+  }
+
+  ValueEntry* entry = LookupValue(table, value);
+  assert(entry->key != NULL);
+  return (entry->data + 1) << 1;
+}
+
+/**
+ * @func[WriteWord] Writes a word to a snapshot.
+ *  @arg[SnapshotWriter*][writer] The snapshot to write to.
+ *  @arg[uint64_t][word] The word to write.
+ *  @sideeffects
+ *   Writes the word to the snapshot in native byte order and adds it to the
+ *   snapshot's checksum.
+ */
+static void WriteWord(SnapshotWriter* writer, uint64_t word)
+{
+  fwrite(&word, sizeof(uint64_t), 1, writer->fout);
+  writer->checksum = HashWord(writer->checksum, word);
+}
+
+/**
+ * @func[ReadWord] Reads a word from a snapshot.
+ *  @arg[SnapshotReader*][reader] The snapshot to read from.
+ *  @arg[uint64_t*][word] Output for the word read.
+ *  @returns[bool] True on success, false on end of file or error.
+ *  @sideeffects
+ *   Reads a word from the snapshot in native byte order and adds it to the
+ *   snapshot's checksum.
+ */
+static bool ReadWord(SnapshotReader* reader, uint64_t* word)
+{
+  if (reader->words == 0 || fread(word, sizeof(uint64_t), 1, reader->fin) != 1) {
+    return false;
+  }
+  reader->words--;
+  reader->checksum = HashWord(reader->checksum, *word);
+  return true;
+}
+
+/**
+ * @func[DecodeValue] Decodes a reference to a value being loaded.
+ *  @arg[FbleValueV*][objects] The objects of the snapshot.
+ *  @arg[FbleValue**][value]
+ *   The encoded reference, which is replaced with the decoded value.
+ *  @returns[bool]
+ *   True on success. False if the reference is invalid, in which case
+ *   @a[value] is set to NULL.
+ *  @sideeffects
+ *   Replaces the encoded reference in @a[value] with the decoded value.
+ */
+static bool DecodeValue(FbleValueV* objects, FbleValue** value)
+{
+  uint64_t word = (uintptr_t)*value;
+  if (word == 0 || (word & 0x1) == 0x1) {
+    return true;
+  }
+
+  uint64_t index = (word >> 1) - 1;
+  if (index < objects->size) {
+    *value = objects->xs[index];
+    return true;
+  }
+
+  *value = NULL;
+  return false;
+}
+
+// See documentation in fble-runtime.h.
+bool FbleSaveValue(FbleRuntime* runtime_, FbleValue* value, FILE* fout, const char** error)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+  value = GcRealloc(runtime, value);
+
+  // Map each run function to the first known executable that uses it.
+  ValueTable runs;
+  InitValueTable(&runs);
+  for (size_t i = 0; i < runtime->executables.size; ++i) {
+    FbleValue* run = (FbleValue*)(uintptr_t)runtime->executables.xs[i].run;
+    ValueEntry* entry = LookupValue(&runs, run);
+    if (entry->key == NULL) {
+      InsertValue(&runs, entry, run, i);
+    }
+  }
+
+  // Number every object reachable from the value, in the order we write
+  // them out.
+  ValueTable table;
+  InitValueTable(&table);
+  FbleValueV objects;
+  FbleInitVector(objects);
+  bool ok = NumberValue(&table, &objects, value, error);
+  for (size_t i = 0; ok && i < objects.size; ++i) {
+    FbleValue* object = objects.xs[i];
+    switch ((ValueTag)(object->flags & FbleValueFlagTagBits)) {
+      case STRUCT_VALUE: {
+        FbleStructValue* sv = (FbleStructValue*)object;
+        for (size_t j = 0; ok && j < sv->_base.data; ++j) {
+          ok = NumberValue(&table, &objects, sv->fields[j], error);
+        }
+        break;
+      }
+
+      case UNION_VALUE: {
+        FbleUnionValue* uv = (FbleUnionValue*)object;
+        ok = NumberValue(&table, &objects, uv->arg, error);
+        break;
+      }
+
+      case FUNC_VALUE: {
+        FbleFuncValue* fv = (FbleFuncValue*)object;
+        uint64_t index = 0;
+        if (!ExecutableIndex(runtime, &runs, &fv->function.executable, &index)) {
+          *error = "unable to save function with unknown executable";
+          ok = false;
+        }
+        for (size_t j = 0; ok && j < fv->function.executable.num_statics; ++j) {
+          ok = NumberValue(&table, &objects, fv->statics[j], error);
+        }
+        break;
+      }
+
+      case NATIVE_VALUE: {
+        FbleUnreachable("native values are not numbered");
+        break;
+      }
+    }
+  }
+
+  if (ok) {
+    SnapshotWriter writer = { .fout = fout, .checksum = 0xcbf29ce484222325 };
+    WriteWord(&writer, SNAPSHOT_MAGIC);
+    WriteWord(&writer, SNAPSHOT_VERSION);
+    WriteWord(&writer, SnapshotFingerprint(runtime));
+    WriteWord(&writer, objects.size);
+    WriteWord(&writer, EncodeValue(&table, value));
+
+    for (size_t i = 0; i < objects.size; ++i) {
+      FbleValue* object = objects.xs[i];
+      WriteWord(&writer, object->flags & FbleValueFlagTagBits);
+      WriteWord(&writer, object->data);
+      switch ((ValueTag)(object->flags & FbleValueFlagTagBits)) {
+        case STRUCT_VALUE: {
+          FbleStructValue* sv = (FbleStructValue*)object;
+          for (size_t j = 0; j < sv->_base.data; ++j) {
+            WriteWord(&writer, EncodeValue(&table, sv->fields[j]));
+          }
+          break;
+        }
+
+        case UNION_VALUE: {
+          FbleUnionValue* uv = (FbleUnionValue*)object;
+          WriteWord(&writer, EncodeValue(&table, uv->arg));
+          break;
+        }
+
+        case FUNC_VALUE: {
+          FbleFuncValue* fv = (FbleFuncValue*)object;
+          FbleExecutable* exe = &fv->function.executable;
+          uint64_t index = 0;
+          ExecutableIndex(runtime, &runs, exe, &index);
+          WriteWord(&writer, index);
+          WriteWord(&writer, exe->num_args);
+          WriteWord(&writer, exe->num_statics);
+          WriteWord(&writer, fv->function.profile_block_id);
+          for (size_t j = 0; j < exe->num_statics; ++j) {
+            WriteWord(&writer, EncodeValue(&table, fv->statics[j]));
+          }
+          break;
+        }
+
+        case NATIVE_VALUE: {
+          FbleUnreachable("native values are not saved");
+          break;
+        }
+      }
+    }
+
+    // Finish with a checksum of everything before it.
+    WriteWord(&writer, writer.checksum);
+  }
+
+  FbleFree(runs.xs);
+  FbleFree(table.xs);
+  FbleFreeVector(objects);
+  return ok;
+}
+
+// See documentation in fble-runtime.h.
+FbleValue* FbleLoadValue(FbleRuntime* runtime_, FILE* fin, const char** error)
+{
+  Runtime* runtime = (Runtime*)runtime_;
+
+  // Check how much is left in the snapshot up front, so we never allocate
+  // more for an object than the snapshot could hold.
+  SnapshotReader reader = { .fin = fin, .words = 0, .checksum = 0xcbf29ce484222325 };
+  long start = ftell(fin);
+  if (start < 0 || fseek(fin, 0, SEEK_END) != 0) {
+    *error = "unable to seek in snapshot";
+    return NULL;
+  }
+  long end = ftell(fin);
+  if (end < start || fseek(fin, start, SEEK_SET) != 0) {
+    *error = "unable to seek in snapshot";
+    return NULL;
+  }
+  reader.words = (uint64_t)(end - start) / sizeof(uint64_t);
+
+  uint64_t magic = 0;
+  uint64_t version = 0;
+  uint64_t fingerprint = 0;
+  uint64_t num_objects = 0;
+  uint64_t root = 0;
+  if (!ReadWord(&reader, &magic) || magic != SNAPSHOT_MAGIC
+      || !ReadWord(&reader, &version) || version != SNAPSHOT_VERSION) {
+    *error = "not a snapshot";
+    return NULL;
+  }
+
+  if (!ReadWord(&reader, &fingerprint) || fingerprint != SnapshotFingerprint(runtime)) {
+    *error = "snapshot is for a different program";
+    return NULL;
+  }
+
+  // Every object takes at least two words: its tag and data.
+  if (!ReadWord(&reader, &num_objects) || !ReadWord(&reader, &root)
+      || num_objects > reader.words / 2) {
+    *error = "truncated snapshot";
+    return NULL;
+  }
+
+  // Partially applied functions in the snapshot apply known functions, so
+  // take no more args than the known executables do.
+  size_t max_args = 0;
+  for (size_t i = 0; i < runtime->executables.size; ++i) {
+    if (runtime->executables.xs[i].num_args > max_args) {
+      max_args = runtime->executables.xs[i].num_args;
+    }
+  }
+
+  // First allocate all the objects, leaving encoded references in their
+  // fields. The new objects are on the top frame's alloced list, where GC
+  // won't look at their fields until we've decoded them.
+  FbleValueV objects;
+  FbleInitVector(objects);
+  bool ok = true;
+  for (uint64_t i = 0; ok && i < num_objects; ++i) {
+    uint64_t tag = 0;
+    uint64_t data = 0;
+    ok = ReadWord(&reader, &tag) && ReadWord(&reader, &data) && data <= UINT32_MAX;
+
+    FbleValue* object = NULL;
+    if (ok && tag == STRUCT_VALUE && data <= reader.words) {
+      FbleStructValue* sv = NewGcValueExtra(runtime, runtime->top, FbleStructValue, STRUCT_VALUE, data);
+      sv->_base.data = data;
+      for (size_t j = 0; j < data; ++j) {
+        uint64_t field = 0;
+        ok = ok && ReadWord(&reader, &field);
+        sv->fields[j] = (FbleValue*)(uintptr_t)field;
+      }
+      object = &sv->_base;
+    } else if (ok && tag == UNION_VALUE) {
+      FbleUnionValue* uv = NewGcValue(runtime, runtime->top, FbleUnionValue, UNION_VALUE);
+      uv->_base.data = data;
+      uint64_t arg = 0;
+      ok = ReadWord(&reader, &arg);
+      uv->arg = (FbleValue*)(uintptr_t)arg;
+      object = &uv->_base;
+    } else if (ok && tag == FUNC_VALUE) {
+      uint64_t index = 0;
+      uint64_t num_args = 0;
+      uint64_t num_statics = 0;
+      uint64_t profile_block_id = 0;
+      ok = ReadWord(&reader, &index)
+        && ReadWord(&reader, &num_args)
+        && ReadWord(&reader, &num_statics)
+        && ReadWord(&reader, &profile_block_id)
+        && index < runtime->executables.size
+        && num_statics <= reader.words
+        && profile_block_id < runtime->_base.profile->blocks.size;
+
+      FbleExecutable exe = runtime->executables.xs[ok ? index : 0];
+      if (ok && index == 0) {
+        // A partially applied function. The first static is the function
+        // being applied, the rest are the args applied to it so far.
+        ok = num_args > 0 && num_statics > 0
+          && num_args + num_statics - 1 <= max_args;
+        exe.num_args = num_args;
+        exe.num_statics = num_statics;
+        exe.max_call_args = num_args + num_statics - 1;
+      } else if (ok) {
+        ok = num_args == exe.num_args && num_statics == exe.num_statics;
+      }
+
+      if (ok) {
+        EnsureTailCallArgsSpace(runtime, exe.max_call_args);
+        FbleFuncValue* fv = NewGcValueExtra(runtime, runtime->top, FbleFuncValue, FUNC_VALUE, exe.num_statics);
+        memcpy(&fv->function.executable, &exe, sizeof(FbleExecutable));
+        fv->function.profile_block_id = profile_block_id;
+        fv->function.statics = fv->statics;
+        for (size_t j = 0; j < exe.num_statics; ++j) {
+          uint64_t field = 0;
+          ok = ok && ReadWord(&reader, &field);
+          fv->statics[j] = (FbleValue*)(uintptr_t)field;
+        }
+        object = &fv->_base;
+      }
+    } else {
+      ok = false;
+    }
+
+    if (object != NULL) {
+      FbleAppendToVector(objects, object);
+    }
+  }
+
+  // Decode the references in the fields of the objects. If anything went
+  // wrong, make sure to decode all the fields anyway so GC doesn't trip over
+  // them later.
+  for (size_t i = 0; i < objects.size; ++i) {
+    FbleValue* object = objects.xs[i];
+    switch ((ValueTag)(object->flags & FbleValueFlagTagBits)) {
+      case STRUCT_VALUE: {
+        FbleStructValue* sv = (FbleStructValue*)object;
+        for (size_t j = 0; j < sv->_base.data; ++j) {
+          ok = DecodeValue(&objects, sv->fields + j) && ok;
+        }
+        break;
+      }
+
+      case UNION_VALUE: {
+        FbleUnionValue* uv = (FbleUnionValue*)object;
+        ok = DecodeValue(&objects, &uv->arg) && ok;
+        break;
+      }
+
+      case FUNC_VALUE: {
+        FbleFuncValue* fv = (FbleFuncValue*)object;
+        for (size_t j = 0; j < fv->function.executable.num_statics; ++j) {
+          ok = DecodeValue(&objects, fv->statics + j) && ok;
+        }
+        break;
+      }
+
+      case NATIVE_VALUE: {
+        FbleUnreachable("native values are not loaded");
+        break;
+      }
+    }
+  }
+
+  FbleValue* value = (FbleValue*)(uintptr_t)root;
+  ok = DecodeValue(&objects, &value) && ok;
+  FbleFreeVector(objects);
+
+  // Catch corruption the structural checks above miss, which could
+  // otherwise trip up the program using the value.
+  uint64_t expected = reader.checksum;
+  uint64_t checksum = 0;
+  ok = ok && ReadWord(&reader, &checksum) && checksum == expected
+    && reader.words == 0;
+
+  if (!ok) {
+    *error = "corrupt snapshot";
+    return NULL;
+  }
+  return value;
 }
@@ -0,0 +1,242 @@
+/**
+ * @file runtime.h
+ *  Internal runtime routines.
+ *
+ *  For evaluating fble code on more than one thread. A worker runtime
+ *  evaluates functions of its parent runtime on a different thread, and the
+ *  results are adopted back into the parent runtime.
+ *
+ *  For caching values that are the same every time they are computed, such
+ *  as literals, for the life of a runtime.
+ *
+ *  For fast calls from call sites that know the arity of their callee, and
+ *  for creating function values without copying their statics.
+ *
+ *  For running calls without recursing on the native stack: the caller
+ *  manages the frames for the call itself, and can keep its own state on
+ *  the runtime stack.
+ *
+ *  For telling the runtime which executables linked code uses, so that
+ *  snapshots can refer to them, and which modules were linked, so that
+ *  snapshots of other programs are rejected.
+ */
+
+#ifndef FBLE_INTERNAL_RUNTIME_H_
+#define FBLE_INTERNAL_RUNTIME_H_
+
+#include <fble/fble-function.h>  // for FbleFunction
+#include <fble/fble-runtime.h>
+
+/**
+ * @func[FbleNewWorkerRuntime] Creates a worker runtime.
+ *  The worker runtime may read values of the parent runtime that have been
+ *  passed through FbleShareValue, while the parent runtime is in use on
+ *  another thread, subject to the following conditions:
+ *
+ *  @i No frames are pushed or popped on the parent while the worker is alive.
+ *  @item
+ *   The only thing the parent runtime is used for while workers are running
+ *   is FbleAdoptValue and FbleSyncWorkerRuntime, with calls serialized by
+ *   the caller.
+ *
+ *  @arg[FbleRuntime*][parent] The parent runtime.
+ *  @returns[FbleRuntime*] A new worker runtime.
+ *  @sideeffects
+ *   Allocates a new runtime that should be freed using FbleFreeRuntime
+ *   after the parent is done adopting values from it.
+ */
+FbleRuntime* FbleNewWorkerRuntime(FbleRuntime* parent);
+
+/**
+ * @func[FbleSyncWorkerRuntime] Prepares a worker to call adopted functions.
+ *  @arg[FbleRuntime*][worker] The worker runtime.
+ *  @arg[FbleRuntime*][parent] The parent runtime of the worker.
+ *  @sideeffects
+ *   Makes it safe for @a[worker] to call functions adopted into
+ *   @a[parent] since the worker was created.
+ */
+void FbleSyncWorkerRuntime(FbleRuntime* worker, FbleRuntime* parent);
+
+/**
+ * @func[FbleShareValue] Makes a value readable from worker runtimes.
+ *  @arg[FbleRuntime*][runtime] The runtime the value belongs to.
+ *  @arg[FbleValue*][value] The value to share.
+ *  @returns[FbleValue*]
+ *   A value equivalent to @a[value] that can be used from worker runtimes
+ *   created after this call.
+ *  @sideeffects
+ *   May reallocate the value onto the heap of the runtime.
+ */
+FbleValue* FbleShareValue(FbleRuntime* runtime, FbleValue* value);
+
+/**
+ * @func[FbleAdoptValue] Moves a value from a worker to its parent runtime.
+ *  Parts of the value that belong to the parent are left as is.
+ *
+ *  @arg[FbleRuntime*][runtime] The parent runtime.
+ *  @arg[FbleRuntime*][worker] The worker runtime the value belongs to.
+ *  @arg[FbleValue*][value] The value to adopt.
+ *  @returns[FbleValue*]
+ *   A value equivalent to @a[value] allocated on the top frame of
+ *   @a[runtime].
+ *  @sideeffects
+ *   @i Allocates values on the parent runtime without doing any GC work.
+ *   @item
+ *    Transfers ownership of native values to the parent runtime. The value
+ *    must not be used in @a[worker] after this call.
+ */
+FbleValue* FbleAdoptValue(FbleRuntime* runtime, FbleRuntime* worker, FbleValue* value);
+
+/**
+ * @func[FbleCachedValue] Looks up a value cached on a runtime.
+ *  @arg[FbleRuntime*][runtime] The runtime.
+ *  @arg[size_t*][id] The cache slot of the value. See FbleCacheValue.
+ *  @returns[FbleValue*]
+ *   The value cached for @a[id] on @a[runtime], or NULL if there is none or
+ *   it may have been GC'd since it was cached.
+ *  @sideeffects
+ *   None.
+ */
+FbleValue* FbleCachedValue(FbleRuntime* runtime, size_t* id);
+
+/**
+ * @func[FbleCacheValue] Caches a value on a runtime.
+ *  The cache holds a bounded number of values and doesn't keep them alive.
+ *  A cached value is returned by FbleCachedValue until it's evicted by
+ *  another value or the frame it's allocated on is compacted or popped.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime.
+ *  @arg[size_t*][id]
+ *   The cache slot of the value. Must be initialized to 0 and used for
+ *   nothing else. A slot may be used with more than one runtime at a time,
+ *   from different threads.
+ *  @arg[FbleValue*][value] The value to cache.
+ *  @returns[FbleValue*]
+ *   A GC allocated value equivalent to @a[value].
+ *  @sideeffects
+ *   @i Assigns a cache id to @a[id] if it doesn't have one already.
+ *   @i GC allocates the value if it isn't already.
+ */
+FbleValue* FbleCacheValue(FbleRuntime* runtime, size_t* id, FbleValue* value);
+
+/**
+ * @func[FbleFuncValueFunction] Gets the function of a function value.
+ *  @arg[FbleValue*][value] The function value. May be undefined.
+ *  @returns[FbleFunction*]
+ *   The function, or NULL if @a[value] is undefined.
+ *  @sideeffects
+ *   None.
+ */
+FbleFunction* FbleFuncValueFunction(FbleValue* value);
+
+/**
+ * @func[FbleCallExact] Calls a function with exactly its number of args.
+ *  A fast path for FbleCall when the caller knows the call needs no partial
+ *  application, has no unused args to apply to the result, and profiling is
+ *  disabled.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FbleFunction*][function]
+ *   The function to call. Must take exactly as many args as passed.
+ *  @arg[FbleValue**][args] Arguments to pass to the function. Borrowed.
+ *  @returns[FbleValue*]
+ *   The result of the function call, or NULL in case of abort.
+ *  @sideeffects
+ *   Same as FbleCall with a NULL profile thread.
+ */
+FbleValue* FbleCallExact(FbleRuntime* runtime, FbleFunction* function, FbleValue** args);
+
+/**
+ * @func[FbleEnterCallFrame] Pushes a frame for a call.
+ *  Pushes the frame the same way FbleCall does before running a function,
+ *  merging it into the top frame when that's cheaper.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @sideeffects
+ *   Pushes a frame on the runtime stack, which should be popped with
+ *   FblePopFrame or FbleFinishTailCall when the call is done.
+ */
+void FbleEnterCallFrame(FbleRuntime* runtime);
+
+/**
+ * @func[FbleTailCallFrame] Reuses the top frame for a tail call.
+ *  The function and args of the tail call should already be in the tail
+ *  call buffer of the runtime.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @sideeffects
+ *   Compacts the top frame, saving just the function and args of the tail
+ *   call. Updates the tail call buffer to their new values. Anything else
+ *   allocated on the frame must not be used after this call.
+ */
+void FbleTailCallFrame(FbleRuntime* runtime);
+
+/**
+ * @func[FbleFinishTailCall] Runs a tail call to completion.
+ *  The function and args of the tail call should already be in the tail
+ *  call buffer of the runtime.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FbleProfileThread*][profile]
+ *   The current profile thread, or NULL if profiling is disabled.
+ *  @returns[FbleValue*]
+ *   The result of the tail call, or NULL in case of abort.
+ *  @sideeffects
+ *   @i Replaces the current profiling block for each function tail called.
+ *   @i Executes the tail call.
+ *   @i Pops the top frame, which was pushed with FbleEnterCallFrame.
+ */
+FbleValue* FbleFinishTailCall(FbleRuntime* runtime, FbleProfileThread* profile);
+
+/**
+ * @func[FbleAllocRegisters] Allocates registers on the runtime stack.
+ *  Registers are separate from the values allocated on frames, and are
+ *  allocated and freed in strict last in, first out order, independent of
+ *  the pushing and popping of frames.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[size_t][size] The number of bytes to allocate.
+ *  @returns[void*] The allocated registers.
+ *  @sideeffects
+ *   Allocates registers that should be freed using FbleFreeRegisters when
+ *   no longer needed.
+ */
+void* FbleAllocRegisters(FbleRuntime* runtime, size_t size);
+
+/**
+ * @func[FbleFreeRegisters] Frees registers on the runtime stack.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[void*][registers] Registers allocated with FbleAllocRegisters.
+ *  @sideeffects
+ *   Frees the given registers along with all registers allocated after
+ *   them.
+ */
+void FbleFreeRegisters(FbleRuntime* runtime, void* registers);
+
+/**
+ * @func[FbleAddExecutables] Adds to the runtime's known executables.
+ *  FbleSaveValue can only save functions whose executable is known to the
+ *  runtime. Snapshots refer to executables by their position in the list of
+ *  known executables, so executables must be added in the same order when
+ *  saving and loading a snapshot.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FbleExecutableV][executables] The executables to add. Copied.
+ *  @sideeffects
+ *   Appends the executables to the runtime's list of known executables.
+ */
+void FbleAddExecutables(FbleRuntime* runtime, FbleExecutableV executables);
+
+/**
+ * @func[FbleAddModuleHash] Adds to the runtime's record of linked modules.
+ *  FbleLoadValue only loads snapshots saved from a runtime with the same
+ *  modules added in the same order.
+ *
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[uint64_t][hash] The hash of the contents of the linked module.
+ *  @sideeffects
+ *   Updates the runtime's record of linked modules.
+ */
+void FbleAddModuleHash(FbleRuntime* runtime, uint64_t hash);
+
+#endif // FBLE_INTERNAL_RUNTIME_H_
@@ -21,6 +21,7 @@
 #include "data.fble.h"             // for FbleCharValueAccess, etc.
 #include "debug.fble.h"            // for /Std/Stream/Debug% FFI
 #include "env.fble.h"              // for /Std/Io/Env%.GetEnv
+#include "int.fble.h"              // for /Std/Int%
 #include "io.fble.h"               // for FbleIoM
 #include "stdio.fble.h"            // for /Std/Io/File/Internal%
 #include "cli.fble.h"              // for FbleCliArgs, etc.
@@ -536,6 +537,7 @@ int FbleAppMain(int argc, const char* argv[], FblePreloadedModule* preloaded)
 
   FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Stream_2f_Debug_25__2e_PutChar);
   FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Io_2f_Env_25__2e_GetVar);
+  FbleRegisterIntForeignValues(runtime);
   FbleRegisterStdioForeignValues(runtime);
 
   FbleMainStatus status = FbleMain(&ParseArg, &app_args, "fble-app", fbldUsageHelpText,
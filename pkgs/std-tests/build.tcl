@@ -5,9 +5,54 @@ namespace eval "pkgs/std-tests" {
   run_cli_tests $::b/pkgs/std-tests/std-tests-interpreted.tr \
     "-I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests%" ""
 
+  # /Std/Tests interpreted, linked in parallel
+  testsuite $::b/pkgs/std-tests/std-tests-link-threads.tr $::b/pkgs/std/fble-cli \
+    "$::b/pkgs/std/fble-cli --deps-file $::b/pkgs/std-tests/std-tests-link-threads.tr.d --deps-target $::b/pkgs/std-tests/std-tests-link-threads.tr --link-threads 4 -I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests% -- --prefix LinkThreads." \
+    "depfile = $::b/pkgs/std-tests/std-tests-link-threads.tr.d"
+
+  # /Std/Tests interpreted, with background sweeping
+  testsuite $::b/pkgs/std-tests/std-tests-background-sweep.tr $::b/pkgs/std/fble-cli \
+    "$::b/pkgs/std/fble-cli --deps-file $::b/pkgs/std-tests/std-tests-background-sweep.tr.d --deps-target $::b/pkgs/std-tests/std-tests-background-sweep.tr --background-sweep -I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests% -- --prefix BackgroundSweep." \
+    "depfile = $::b/pkgs/std-tests/std-tests-background-sweep.tr.d"
+
+  # /Std/Tests interpreted, with hash consing
+  testsuite $::b/pkgs/std-tests/std-tests-hash-cons.tr $::b/pkgs/std/fble-cli \
+    "$::b/pkgs/std/fble-cli --deps-file $::b/pkgs/std-tests/std-tests-hash-cons.tr.d --deps-target $::b/pkgs/std-tests/std-tests-hash-cons.tr --hash-cons -I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests% -- --prefix HashCons." \
+    "depfile = $::b/pkgs/std-tests/std-tests-hash-cons.tr.d"
+
+  # /Std/Tests interpreted, with a fast GC pace
+  testsuite $::b/pkgs/std-tests/std-tests-gc-pace.tr $::b/pkgs/std/fble-cli \
+    "$::b/pkgs/std/fble-cli --deps-file $::b/pkgs/std-tests/std-tests-gc-pace.tr.d --deps-target $::b/pkgs/std-tests/std-tests-gc-pace.tr --gc-pace 16 -I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests% -- --prefix GcPace." \
+    "depfile = $::b/pkgs/std-tests/std-tests-gc-pace.tr.d"
+
+  # /Std/Tests interpreted, with the smallest stack chunks and no merging
+  testsuite $::b/pkgs/std-tests/std-tests-no-merge.tr $::b/pkgs/std/fble-cli \
+    "$::b/pkgs/std/fble-cli --deps-file $::b/pkgs/std-tests/std-tests-no-merge.tr.d --deps-target $::b/pkgs/std-tests/std-tests-no-merge.tr --stack-chunk-size 1 --merge-limit 0 -I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests% -- --prefix NoMerge." \
+    "depfile = $::b/pkgs/std-tests/std-tests-no-merge.tr.d"
+
+  # /Std/Tests interpreted, with the smallest stack chunks and the merge
+  # limit tuned from a huge starting point
+  testsuite $::b/pkgs/std-tests/std-tests-auto-merge-limit.tr $::b/pkgs/std/fble-cli \
+    "$::b/pkgs/std/fble-cli --deps-file $::b/pkgs/std-tests/std-tests-auto-merge-limit.tr.d --deps-target $::b/pkgs/std-tests/std-tests-auto-merge-limit.tr --stack-chunk-size 1 --merge-limit 1000000000 --auto-merge-limit -I $::s/pkgs/std -I $::s/pkgs/std-tests -m /Std/Tests% -- --prefix AutoMergeLimit." \
+    "depfile = $::b/pkgs/std-tests/std-tests-auto-merge-limit.tr.d"
+
   # /Std/Tests compiled
   cli $::b/pkgs/std-tests/std-tests "/Std/Tests%" "std-tests" ""
   testsuite $::b/pkgs/std-tests/std-tests-compiled.tr \
     $::b/pkgs/std-tests/std-tests \
     "$::b/pkgs/std-tests/std-tests --prefix Compiled."
+
+  # /Std/Tests compiled, loaded from a snapshot
+  build $::b/pkgs/std-tests/std-tests.snapshot \
+    $::b/pkgs/std-tests/std-tests \
+    "rm -f $::b/pkgs/std-tests/std-tests.snapshot && $::b/pkgs/std-tests/std-tests --snapshot $::b/pkgs/std-tests/std-tests.snapshot -- > /dev/null"
+  testsuite $::b/pkgs/std-tests/std-tests-snapshot.tr \
+    "$::b/pkgs/std-tests/std-tests $::b/pkgs/std-tests/std-tests.snapshot" \
+    "$::b/pkgs/std-tests/std-tests --snapshot $::b/pkgs/std-tests/std-tests.snapshot -- --prefix Snapshot."
+
+  # The snapshot tests pass even if the snapshot is ignored, so check that it
+  # was actually loaded.
+  testsuite $::b/pkgs/std-tests/std-tests-snapshot-loaded.tr \
+    $::b/pkgs/std-tests/std-tests-snapshot.tr \
+    "awk '/ignoring.snapshot/{exit(1)}' $::b/pkgs/std-tests/std-tests-snapshot.tr"
 }
@@ -4,7 +4,7 @@ namespace eval "pkgs/std" {
 
   # .c library files.
   set objs [list]
-  foreach {x} { cli.fble data.fble debug.fble env.fble io.fble stdio.fble } {
+  foreach {x} { cli.fble data.fble debug.fble env.fble int.fble io.fble stdio.fble } {
     lappend objs $::b/pkgs/std/$x.o
     obj $::b/pkgs/std/$x.o $::s/pkgs/std/$x.c \
       "-I $::s/include -I $::s/pkgs/std -I $::s/out/pkgs/std" \
@@ -102,6 +102,16 @@ namespace eval "pkgs/std" {
     "$::s/pkgs/std/utf-8.txt $::b/pkgs/std/fble-cli-demo.utf8.cat.out" \
     "diff --strip-trailing-cr $::s/pkgs/std/utf-8.txt $::b/pkgs/std/fble-cli-demo.utf8.cat.out"
 
+  # Test closing files on the background sweeper thread. The files need to
+  # be long enough for the program to garbage collect earlier files while
+  # reading later ones.
+  build $::b/pkgs/std/fble-cli-demo.sweep.cat.out \
+    "$::b/pkgs/std/fble-cli-demo $::s/spec/fble.fbld" \
+    "$::b/pkgs/std/fble-cli-demo --background-sweep -- cat $::s/spec/fble.fbld $::s/spec/fble.fbld $::s/spec/fble.fbld > $::b/pkgs/std/fble-cli-demo.sweep.cat.out"
+  test $::b/pkgs/std/fble-cli-demo.sweep.cat.tr \
+    "$::s/spec/fble.fbld $::b/pkgs/std/fble-cli-demo.sweep.cat.out" \
+    "cat $::s/spec/fble.fbld $::s/spec/fble.fbld $::s/spec/fble.fbld | diff --strip-trailing-cr - $::b/pkgs/std/fble-cli-demo.sweep.cat.out"
+
   # data.fble.test.c unit test
   obj $::b/pkgs/std/data.fble.test.o $::s/pkgs/std/data.fble.test.c \
     "-I $::s/include -I $::s/pkgs/std"
@@ -18,6 +18,7 @@
 #include "data.fble.h"          // for FbleCharValueAccess, etc.
 #include "debug.fble.h"         // for /Std/Stream/Debug%
 #include "env.fble.h"           // for /Std/Io/Env%
+#include "int.fble.h"           // for /Std/Int%
 #include "io.fble.h"            // for FbleIoM
 #include "stdio.fble.h"         // for /Std/Io/File/Internal%
 
@@ -111,6 +112,7 @@ FbleCliMainStatus FbleCliMain(int argc, const char** argv, FblePreloadedModule*
 
   FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Stream_2f_Debug_25__2e_PutChar);
   FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Io_2f_Env_25__2e_GetVar);
+  FbleRegisterIntForeignValues(runtime);
   FbleRegisterStdioForeignValues(runtime);
 
   FbleMainStatus status = FbleMain(NULL, NULL, "fble-cli", fbldUsageHelpText,
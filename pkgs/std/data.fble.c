@@ -3,7 +3,6 @@
  *  Implementation of routines to interact with fble standard data types.
  */
 #include <assert.h>   // for assert
-#include <stdlib.h>   // for abort
 #include <string.h>   // for strlen
 
 #include "data.fble.h"
@@ -17,13 +16,13 @@
 #define CONS_FIELDC 2
 #define MAYBE_TAGWIDTH 1
 
-static FbleValue* MakeIntP(FbleRuntime* runtime, int64_t x);
-static int64_t ReadIntP(FbleValue* num);
+static FbleValue* MakeIntP(FbleRuntime* runtime, uint64_t x);
+static bool ReadIntP(FbleValue* num, uint64_t* result);
 
 /**
  * @func[MakeIntP] Makes an FbleValue of type @l{/Std/Int/IntP%.IntP@}.
  *  @arg[FbleRuntime*][runtime] The runtime context.
- *  @arg[int64_t][x] The integer value. Must be greater than 0.
+ *  @arg[uint64_t][x] The integer value. Must be greater than 0.
  *
  *  @returns[FbleValue*]
  *   An FbleValue for the integer.
@@ -31,36 +30,51 @@ static int64_t ReadIntP(FbleValue* num);
  *  @sideeffects
  *   Allocates a value on the heap.
  */
-static FbleValue* MakeIntP(FbleRuntime* runtime, int64_t x)
+static FbleValue* MakeIntP(FbleRuntime* runtime, uint64_t x)
 {
   assert(x > 0);
-  if (x == 1) {
-    return FbleNewEnumValue(runtime, INTP_TAGWIDTH, 0);
+
+  // The most significant bit is the innermost IntP@ value, so build the
+  // value from the most significant bit down.
+  int bit = 63;
+  while ((x >> bit) == 0) {
+    bit--;
   }
 
-  FbleValue* p = MakeIntP(runtime, x / 2);
-  return FbleNewUnionValue(runtime, INTP_TAGWIDTH, 1 + (x % 2), p);
+  FbleValue* p = FbleNewEnumValue(runtime, INTP_TAGWIDTH, 0);
+  for (int i = bit - 1; i >= 0; --i) {
+    p = FbleNewUnionValue(runtime, INTP_TAGWIDTH, 1 + ((x >> i) & 1), p);
+  }
+  return p;
 }
 
 /**
  * @func[ReadIntP] Reads a number of type @l{/Std/Int/IntP%.IntP@}.
  *  @arg[FbleValue*][x] The value of the number.
+ *  @arg[uint64_t*][result] Output for the number.
  *
- *  @returns[int64_t]
- *   The number x represented as an integer.
+ *  @returns[bool]
+ *   True if the number is less than 2^63. False if the number is too large
+ *   or undefined.
  *
  *  @sideeffects
- *   Behavior is undefined if the int value cannot be represented using the C
- *   int64_t type, for example because it is too large.
+ *   Sets @a[result] to the number, or the low bits of the number if it is
+ *   too large.
  */
-static int64_t ReadIntP(FbleValue* x)
+static bool ReadIntP(FbleValue* x, uint64_t* result)
 {
-  switch (FbleUnionValueTag(x, INTP_TAGWIDTH)) {
-    case 0: return 1;
-    case 1: return 2 * ReadIntP(FbleUnionValueArg(x, INTP_TAGWIDTH));
-    case 2: return 2 * ReadIntP(FbleUnionValueArg(x, INTP_TAGWIDTH)) + 1;
-    default: assert(false && "Invalid IntP@ tag"); abort();
+  uint64_t n = 0;
+  for (int i = 0; i < 64; ++i) {
+    switch (FbleUnionValueTag(x, INTP_TAGWIDTH)) {
+      case 0: *result = n | ((uint64_t)1 << i); return i < 63;
+      case 1: break;
+      case 2: n |= (uint64_t)1 << i; break;
+      default: *result = n; return false;
+    }
+    x = FbleUnionValueArg(x, INTP_TAGWIDTH);
   }
+  *result = n;
+  return false;
 }
 
 // FbleNewCharValue -- see documentation in data.fble.h
@@ -75,13 +89,12 @@ uint32_t FbleCharValueAccess(FbleValue* c)
   return (uint32_t)FbleIntValueAccess(FbleStructValueField(c, 1, 0));
 }
 
-// See documentation in int.fble.h
+// See documentation in data.fble.h
 FbleValue* FbleNewIntValue(FbleRuntime* runtime, int64_t x)
 {
   if (x < 0) {
-    FbleValue* p = MakeIntP(runtime, -x);
-    FbleValue* result = FbleNewUnionValue(runtime, INT_TAGWIDTH, 0, p);
-    return result;
+    FbleValue* p = MakeIntP(runtime, -(uint64_t)x);
+    return FbleNewUnionValue(runtime, INT_TAGWIDTH, 0, p);
   }
 
   if (x == 0) {
@@ -95,12 +108,24 @@ FbleValue* FbleNewIntValue(FbleRuntime* runtime, int64_t x)
 // FbleIntValueAccess -- see documentation in data.fble.h
 int64_t FbleIntValueAccess(FbleValue* x)
 {
+  int64_t result = 0;
+  FbleTryIntValueAccess(x, &result);
+  return result;
+}
+
+// See documentation in data.fble.h
+bool FbleTryIntValueAccess(FbleValue* x, int64_t* result)
+{
+  uint64_t p = 0;
+  bool ok = false;
   switch (FbleUnionValueTag(x, INT_TAGWIDTH)) {
-    case 0: return -ReadIntP(FbleUnionValueArg(x, INT_TAGWIDTH));
-    case 1: return 0;
-    case 2: return ReadIntP(FbleUnionValueArg(x, INT_TAGWIDTH));
-    default: assert(false && "Invalid Int@ tag"); abort();
+    case 0: ok = ReadIntP(FbleUnionValueArg(x, INT_TAGWIDTH), &p); p = -p; break;
+    case 1: ok = true; break;
+    case 2: ok = ReadIntP(FbleUnionValueArg(x, INT_TAGWIDTH), &p); break;
+    default: break;
   }
+  *result = (int64_t)p;
+  return ok;
 }
 
 // See documentation in data.fble.h
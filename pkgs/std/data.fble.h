@@ -6,6 +6,7 @@
 #ifndef FBLE_STD_DATA_FBLE_H_
 #define FBLE_STD_DATA_FBLE_H_
 
+#include <stdbool.h>             // for bool
 #include <stdint.h>              // for uint32_t
 
 #include <fble/fble-runtime.h>   // for FbleValue, etc.
@@ -58,6 +59,23 @@ FbleValue* FbleNewIntValue(FbleRuntime* runtime, int64_t x);
  */
 int64_t FbleIntValueAccess(FbleValue* x);
 
+/**
+ * @func[FbleTryIntValueAccess] Reads a number of type @l{/Std/Int%.Int@}.
+ *  Like FbleIntValueAccess, except it reports whether the number fits in a
+ *  C int64_t instead of having undefined behavior.
+ *
+ *  @arg[FbleValue*][x] The FbleValue value of the number.
+ *  @arg[int64_t*][result] Output for the number.
+ *
+ *  @returns[bool]
+ *   True if the number is defined and between -(2^63-1) and 2^63-1, false
+ *   otherwise.
+ *
+ *  @sideeffects
+ *   Sets @a[result] to the number if it fits in a C int64_t.
+ */
+bool FbleTryIntValueAccess(FbleValue* x, int64_t* result);
+
 /**
  * @func[FbleNewMaybeValue] Construct a @l{/Std/Maybe%.@} value.
  *  @arg[FbleRuntime*][runtime] The runtime context.
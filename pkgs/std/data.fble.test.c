@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>   // for assert
+#include <stdint.h>   // for INT64_MAX, etc.
 #include <string.h>   // for strcmp
 
 #include <fble/fble-alloc.h>       // for FbleFree
@@ -55,8 +56,33 @@ static void TestStringValueAccess()
   FbleFreeRuntime(runtime);
 }
 
+static void TestIntValue()
+{
+  FbleRuntime* runtime = FbleNewRuntime();
+
+  static const int64_t xs[] = {
+    0, 1, -1, 2, -2, 5, -5, 1000000007, INT64_MAX, INT64_MIN + 1
+  };
+  for (size_t i = 0; i < sizeof(xs) / sizeof(xs[0]); ++i) {
+    FbleValue* x = FbleNewIntValue(runtime, xs[i]);
+    assert(FbleIntValueAccess(x) == xs[i]);
+
+    int64_t y = 0;
+    assert(FbleTryIntValueAccess(x, &y));
+    assert(y == xs[i]);
+  }
+
+  // INT64_MIN doesn't fit once read back, because reading only succeeds for
+  // numbers between -(2^63-1) and 2^63-1.
+  int64_t y = 0;
+  assert(!FbleTryIntValueAccess(FbleNewIntValue(runtime, INT64_MIN), &y));
+
+  FbleFreeRuntime(runtime);
+}
+
 int main()
 {
+  TestIntValue();
   TestNewStringValue();
   TestStringValueAccess();
   return 0;
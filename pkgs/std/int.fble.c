@@ -0,0 +1,176 @@
+/**
+ * @file int.fble.c
+ *  Implementation of /Std/Int% foreign functions.
+ *
+ *  Integer arithmetic in fble walks the integer one bit at a time. The
+ *  foreign functions here do the arithmetic on machine words instead when
+ *  the operands and result fit in a C int64_t, and otherwise tail call the
+ *  fble implementation they are given.
+ */
+
+#include "int.fble.h"
+
+#include <stdint.h>     // for int64_t
+
+#include <fble/fble-function.h>  // for FbleForeign, etc.
+#include <fble/fble-runtime.h>   // for FbleValue, etc.
+
+#include "data.fble.h"           // for FbleTryIntValueAccess, etc.
+
+#define COMPARED_TAGWIDTH 2
+
+static FbleValue* Fallback(FbleRuntime* runtime, FbleValue** args);
+static FbleValue* NativeAdd(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args);
+static FbleValue* NativeMul(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args);
+static FbleValue* NativeCmp(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args);
+
+/**
+ * @func[Fallback] Falls back to the fble implementation of an operation.
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @arg[FbleValue**][args]
+ *   The arguments to the foreign function: operands a and b followed by the
+ *   fble implementation f.
+ *
+ *  @returns[FbleValue*]
+ *   runtime->tail_call_sentinel.
+ *
+ *  @sideeffects
+ *   Sets up a tail call to f(a, b).
+ */
+static FbleValue* Fallback(FbleRuntime* runtime, FbleValue** args)
+{
+  runtime->tail_call_argc = 2;
+  runtime->tail_call_buffer[0] = args[2];
+  runtime->tail_call_buffer[1] = args[0];
+  runtime->tail_call_buffer[2] = args[1];
+  return runtime->tail_call_sentinel;
+}
+
+/**
+ * @func[NativeAdd] FbleRunFunction for NativeAdd foreign function.
+ *  See documentation of FbleRunFunction in fble-function.h
+ *
+ *  The fble type of the function is:
+ *
+ *  @code[fble] @
+ *   (Int@, Int@, (Int@, Int@) { Int@; }) { Int@; }
+ *
+ *  @sideeffects
+ *   Allocates the sum, or tail calls the fallback function if it doesn't fit
+ *   in a machine word.
+ */
+static FbleValue* NativeAdd(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args)
+{
+  (void)profile;
+  (void)function;
+
+  int64_t a, b, r;
+  if (!FbleTryIntValueAccess(args[0], &a)
+      || !FbleTryIntValueAccess(args[1], &b)
+      || __builtin_add_overflow(a, b, &r)) {
+    return Fallback(runtime, args);
+  }
+  return FbleNewIntValue(runtime, r);
+}
+
+// /Std/Int%.NativeAdd foreign function.
+FbleForeign _Fble_2f_Std_2f_Int_25__2e_NativeAdd = {
+  .path = "/Std/Int%",
+  .name = "NativeAdd",
+  .num_args = 3,
+  .max_call_args = 2,
+  .run = &NativeAdd,
+};
+
+/**
+ * @func[NativeMul] FbleRunFunction for NativeMul foreign function.
+ *  See documentation of FbleRunFunction in fble-function.h
+ *
+ *  The fble type of the function is:
+ *
+ *  @code[fble] @
+ *   (Int@, Int@, (Int@, Int@) { Int@; }) { Int@; }
+ *
+ *  @sideeffects
+ *   Allocates the product, or tail calls the fallback function if it doesn't
+ *   fit in a machine word.
+ */
+static FbleValue* NativeMul(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args)
+{
+  (void)profile;
+  (void)function;
+
+  int64_t a, b, r;
+  if (!FbleTryIntValueAccess(args[0], &a)
+      || !FbleTryIntValueAccess(args[1], &b)
+      || __builtin_mul_overflow(a, b, &r)) {
+    return Fallback(runtime, args);
+  }
+  return FbleNewIntValue(runtime, r);
+}
+
+// /Std/Int%.NativeMul foreign function.
+FbleForeign _Fble_2f_Std_2f_Int_25__2e_NativeMul = {
+  .path = "/Std/Int%",
+  .name = "NativeMul",
+  .num_args = 3,
+  .max_call_args = 2,
+  .run = &NativeMul,
+};
+
+/**
+ * @func[NativeCmp] FbleRunFunction for NativeCmp foreign function.
+ *  See documentation of FbleRunFunction in fble-function.h
+ *
+ *  The fble type of the function is:
+ *
+ *  @code[fble] @
+ *   (Int@, Int@, Cmp@<Int@>) { Compared@; }
+ *
+ *  @sideeffects
+ *   Tail calls the fallback function if the operands don't fit in a machine
+ *   word.
+ */
+static FbleValue* NativeCmp(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args)
+{
+  (void)profile;
+  (void)function;
+
+  int64_t a, b;
+  if (!FbleTryIntValueAccess(args[0], &a)
+      || !FbleTryIntValueAccess(args[1], &b)) {
+    return Fallback(runtime, args);
+  }
+
+  size_t tag = a < b ? 0 : (a == b ? 1 : 2);
+  return FbleNewEnumValue(runtime, COMPARED_TAGWIDTH, tag);
+}
+
+// /Std/Int/Cmp%.NativeCmp foreign function.
+FbleForeign _Fble_2f_Std_2f_Int_2f_Cmp_25__2e_NativeCmp = {
+  .path = "/Std/Int/Cmp%",
+  .name = "NativeCmp",
+  .num_args = 3,
+  .max_call_args = 2,
+  .run = &NativeCmp,
+};
+
+// See documentation in int.fble.h
+void FbleRegisterIntForeignValues(FbleRuntime* runtime)
+{
+  FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Int_25__2e_NativeAdd);
+  FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Int_25__2e_NativeMul);
+  FbleRegisterForeignValue(runtime, &_Fble_2f_Std_2f_Int_2f_Cmp_25__2e_NativeCmp);
+}
@@ -0,0 +1,20 @@
+/**
+ * @file int.fble.h
+ *  Implementation of @l{/Std/Int%} FFI.
+ */
+
+#ifndef FBLE_STD_INT_FBLE_H_
+#define FBLE_STD_INT_FBLE_H_
+
+#include <fble/fble-runtime.h>   // for FbleRuntime
+
+/**
+ * @func[FbleRegisterIntForeignValues]
+ * @ Registers foreign functions for /Std/Int% and /Std/Int/Cmp%
+ *  @arg[FbleRuntime*][runtime] The runtime context.
+ *  @sideeffects
+ *   Registers the native integer arithmetic foreign values.
+ */
+void FbleRegisterIntForeignValues(FbleRuntime* runtime);
+
+#endif // FBLE_STD_INT_FBLE_H_
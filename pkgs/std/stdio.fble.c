@@ -149,7 +149,7 @@ static FbleValue* Open(
     return FbleNewMaybeValue(runtime, NULL);
   }
 
-  FbleValue* v = FbleNewNativeValue(runtime, fout, &CloseFileOnFree);
+  FbleValue* v = FbleNewConcurrentNativeValue(runtime, fout, &CloseFileOnFree);
   return FbleNewMaybeValue(runtime, v);
 }
 // /Std/Io/File/Binary%.Open foreign function.
@@ -10,6 +10,10 @@ namespace eval "test" {
   }
 
   set bin_sources {
+    fble-alloc-test.c
+    fble-apply-bench.c
+    fble-hash-cons-test.c
+    fble-list-test.c
     fble-mem-test.c
     fble-profiles-test.c
     fble-profile-test.c
@@ -49,6 +53,22 @@ namespace eval "test" {
     fbld_check_dc $::b/test/$x.dc $::s/test/$x
   }
 
+  # fble-alloc-test
+  test $::b/test/fble-alloc-test.tr $::b/test/fble-alloc-test \
+    "$::b/test/fble-alloc-test"
+
+  # fble-apply-bench
+  test $::b/test/fble-apply-bench.tr $::b/test/fble-apply-bench \
+    "$::b/test/fble-apply-bench 1000 > /dev/null"
+
+  # fble-hash-cons-test
+  test $::b/test/fble-hash-cons-test.tr $::b/test/fble-hash-cons-test \
+    "$::b/test/fble-hash-cons-test"
+
+  # fble-list-test
+  test $::b/test/fble-list-test.tr $::b/test/fble-list-test \
+    "$::b/test/fble-list-test"
+
   # fble-profile-test
   test $::b/test/fble-profile-test.tr $::b/test/fble-profile-test \
     "$::b/test/fble-profile-test > /dev/null"
@@ -0,0 +1,174 @@
+/**
+ * @file fble-alloc-test.c
+ *  A program that tests allocation accounting across threads.
+ */
+
+#include <pthread.h>  // for pthread_create, pthread_join, etc.
+#include <stdbool.h>  // for bool
+#include <stdio.h>    // for fprintf, stdout
+
+#include <fble/fble-alloc.h>     // for FbleAllocRaw, FbleFree, etc.
+#include <fble/fble-runtime.h>   // for FbleNewRuntime, etc.
+
+// Number of worker threads to run.
+#define NUM_THREADS 4
+
+// Number of bytes each worker holds on to while the main thread checks the
+// max bytes allocated.
+#define HELD_BYTES 1000
+
+// Number of allocations each worker makes and frees before holding on to
+// HELD_BYTES.
+#define CHURN 10000
+
+static bool sTestsFailed = false;
+
+/**
+ * @value[sLock] Lock for sReady and sRelease.
+ *  @type[pthread_mutex_t]
+ */
+static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @value[sChanged] Signaled when sReady or sRelease changes.
+ *  @type[pthread_cond_t]
+ */
+static pthread_cond_t sChanged = PTHREAD_COND_INITIALIZER;
+
+/**
+ * @value[sReady] Number of workers holding HELD_BYTES.
+ *  @type[int]
+ */
+static int sReady = 0;
+
+/**
+ * @value[sRelease] Set when workers should free their bytes and exit.
+ *  @type[bool]
+ */
+static bool sRelease = false;
+
+static void Fail(const char* file, int line, const char* msg);
+static void* Worker(void* data);
+
+/**
+ * @func[ASSERT] Test assertion function.
+ *  @arg[bool][p] Property to assert to be true.
+ *
+ *  @sideeffects
+ *   Reports a test failure if @a[p] is not true.
+ */
+#define ASSERT(p) { \
+  if (!(p)) { \
+    Fail(__FILE__, __LINE__, #p); \
+  } \
+}
+
+/**
+ * @func[Fail] Reports a test failure.
+ *  @arg[const char*][file] The source code file.
+ *  @arg[int][line] The line number of the failure.
+ *  @arg[const char*][msg] The failure message.
+ *  @sideeffects
+ *   Reports and records the test failure.
+ */
+static void Fail(const char* file, int line, const char* msg)
+{
+  fprintf(stdout, "%s:%i: assert failure: %s\n", file, line, msg);
+  sTestsFailed = true;
+}
+
+/**
+ * @func[Worker] Allocates memory on a worker thread.
+ *  Churns through allocations on its own runtime, then holds on to
+ *  HELD_BYTES until sRelease is set.
+ *
+ *  @arg[void*][data] Unused.
+ *  @returns[void*] NULL.
+ *  @sideeffects
+ *   Allocates and frees memory, increments sReady.
+ */
+static void* Worker(void* data)
+{
+  (void)data;
+
+  FbleRuntime* runtime = FbleNewRuntime();
+  for (size_t i = 0; i < CHURN; ++i) {
+    FbleValue* args[2] = {
+      FbleNewEnumValue(runtime, 1, i % 2),
+      FbleNewEnumValue(runtime, 1, (i + 1) % 2)
+    };
+    FbleNewStructValue(runtime, 2, args);
+    FbleFree(FbleAllocRaw(i % 100 + 1));
+  }
+  FbleFreeRuntime(runtime);
+
+  void* held = FbleAllocRaw(HELD_BYTES);
+
+  pthread_mutex_lock(&sLock);
+  sReady++;
+  pthread_cond_broadcast(&sChanged);
+  while (!sRelease) {
+    pthread_cond_wait(&sChanged, &sLock);
+  }
+  pthread_mutex_unlock(&sLock);
+
+  FbleFree(held);
+  return NULL;
+}
+
+/**
+ * @func[main] Runs the allocation accounting tests.
+ *  @arg[int][argc] The number of args.
+ *  @arg[const char**][argv] The args.
+ *  @returns[int] 0 if the tests pass, 1 otherwise.
+ *  @sideeffects
+ *   Prints failures to stdout. Aborts at exit if memory was leaked.
+ */
+int main(int argc, const char* argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  // Nothing is held by this thread while the workers run, so this is the
+  // baseline for all the checks.
+  FbleResetMaxTotalBytesAllocated();
+  size_t base = FbleMaxTotalBytesAllocated();
+
+  pthread_t threads[NUM_THREADS];
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    pthread_create(threads + i, NULL, &Worker, NULL);
+  }
+
+  // Reset the max while the workers allocate. Every reset and query along
+  // the way must see at least what's allocated at the time.
+  bool ready = false;
+  while (!ready) {
+    FbleResetMaxTotalBytesAllocated();
+    ASSERT(FbleMaxTotalBytesAllocated() >= base);
+
+    pthread_mutex_lock(&sLock);
+    ready = (sReady == NUM_THREADS);
+    pthread_mutex_unlock(&sLock);
+  }
+
+  // All the workers are waiting, each holding HELD_BYTES.
+  FbleResetMaxTotalBytesAllocated();
+  ASSERT(FbleMaxTotalBytesAllocated() == base + NUM_THREADS * HELD_BYTES);
+
+  pthread_mutex_lock(&sLock);
+  sRelease = true;
+  pthread_cond_broadcast(&sChanged);
+  pthread_mutex_unlock(&sLock);
+
+  for (size_t i = 0; i < NUM_THREADS; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // The max stays at least the peak from before the workers freed their
+  // bytes. Once reset, everything the workers allocated is gone.
+  ASSERT(FbleMaxTotalBytesAllocated() >= base + NUM_THREADS * HELD_BYTES);
+  FbleResetMaxTotalBytesAllocated();
+  ASSERT(FbleMaxTotalBytesAllocated() == base);
+
+  return sTestsFailed ? 1 : 0;
+}
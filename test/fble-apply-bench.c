@@ -0,0 +1,77 @@
+/**
+ * @file fble-apply-bench.c
+ *  A program that measures the overhead of calling FbleApply.
+ */
+
+#include <stdio.h>    // for printf, fprintf, stderr
+#include <stdlib.h>   // for atoi
+#include <time.h>     // for clock, CLOCKS_PER_SEC
+
+#include <fble/fble-function.h>   // for FbleExecutable, FbleFunction
+#include <fble/fble-runtime.h>    // for FbleApply, etc.
+
+static FbleValue* Id(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args);
+
+/**
+ * @func[Id] FbleRunFunction for the identity function.
+ *  See documentation of FbleRunFunction in fble-function.h
+ *
+ *  @sideeffects None
+ */
+static FbleValue* Id(
+    FbleRuntime* runtime, FbleProfileThread* profile,
+    FbleFunction* function, FbleValue** args)
+{
+  return args[0];
+}
+
+/**
+ * @func[main] Measures the time per call of FbleApply.
+ *  Calls FbleApply on a native identity function repeatedly and reports the
+ *  average time per call. This is the overhead of calling into fble from C
+ *  for every event, like fble-app does.
+ *
+ *  @arg[int][argc] The number of args.
+ *  @arg[const char**][argv] The args. An optional number of calls to make.
+ *
+ *  @returns[int] 0 on success.
+ *
+ *  @sideeffects
+ *   Prints the time per call to stdout.
+ */
+int main(int argc, const char* argv[])
+{
+  int calls = 2000000;
+  if (argc > 1) {
+    calls = atoi(argv[1]);
+    if (calls <= 0) {
+      fprintf(stderr, "usage: fble-apply-bench [CALLS]\n");
+      return 1;
+    }
+  }
+
+  FbleExecutable executable = {
+    .num_args = 1,
+    .num_statics = 0,
+    .max_call_args = 0,
+    .run = &Id
+  };
+
+  FbleRuntime* runtime = FbleNewRuntime();
+  FbleValue* func = FbleNewFuncValue(runtime, &executable, 0, NULL);
+  FbleValue* arg = FbleNewEnumValue(runtime, 1, 0);
+
+  clock_t start = clock();
+  for (int i = 0; i < calls; ++i) {
+    FbleApply(runtime, func, 1, &arg);
+  }
+  clock_t end = clock();
+
+  FbleFreeRuntime(runtime);
+
+  double ns = 1e9 * (double)(end - start) / CLOCKS_PER_SEC / calls;
+  printf("%d calls, %.1f ns per FbleApply\n", calls, ns);
+  return 0;
+}
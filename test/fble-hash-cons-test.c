@@ -0,0 +1,157 @@
+/**
+ * @file fble-hash-cons-test.c
+ *  A program that tests hash consing of values as they die.
+ */
+
+#include <stdbool.h>  // for bool
+#include <stdio.h>    // for fprintf, stdout
+
+#include <fble/fble-runtime.h>   // for FbleNewRuntime, etc.
+
+// Number of fields of the values to hash cons.
+#define FIELDS 4
+
+// Number of bits of each field. Chosen so the fields together don't fit in
+// a packed value, which would keep the value from being hash consed.
+#define FIELD_BITS 20
+
+// Number of distinct values to allocate each round. More than the number of
+// entries in the hash cons cache, so values also get evicted by others.
+#define VALUES 10000
+
+// Number of rounds of allocating values and letting them die.
+#define ROUNDS 4
+
+static bool sTestsFailed = false;
+
+static void Fail(const char* file, int line, const char* msg);
+static FbleValue* Value(FbleRuntime* runtime, size_t x);
+static bool IsValue(FbleValue* value, size_t x);
+
+/**
+ * @func[ASSERT] Test assertion function.
+ *  @arg[bool][p] Property to assert to be true.
+ *
+ *  @sideeffects
+ *   Reports a test failure if @a[p] is not true.
+ */
+#define ASSERT(p) { \
+  if (!(p)) { \
+    Fail(__FILE__, __LINE__, #p); \
+  } \
+}
+
+/**
+ * @func[Fail] Reports a test failure.
+ *  @arg[const char*][file] The source code file.
+ *  @arg[int][line] The line number of the failure.
+ *  @arg[const char*][msg] The failure message.
+ *  @sideeffects
+ *   Reports and records the test failure.
+ */
+static void Fail(const char* file, int line, const char* msg)
+{
+  fprintf(stdout, "%s:%i: assert failure: %s\n", file, line, msg);
+  sTestsFailed = true;
+}
+
+/**
+ * @func[Value] Allocates a value that can be hash consed.
+ *  @arg[FbleRuntime*][runtime] The runtime.
+ *  @arg[size_t][x] Picks the contents of the value.
+ *  @returns[FbleValue*] A struct value whose fields depend on @a[x].
+ *  @sideeffects
+ *   Allocates a value on the runtime.
+ */
+static FbleValue* Value(FbleRuntime* runtime, size_t x)
+{
+  FbleValue* fields[FIELDS];
+  for (size_t i = 0; i < FIELDS; ++i) {
+    fields[i] = FbleNewEnumValue(runtime, FIELD_BITS, (x + i) % (1 << FIELD_BITS));
+  }
+  return FbleNewStructValue(runtime, FIELDS, fields);
+}
+
+/**
+ * @func[IsValue] Checks the contents of a value.
+ *  @arg[FbleValue*][value] A value allocated by Value.
+ *  @arg[size_t][x] The argument @a[value] should have been allocated with.
+ *  @returns[bool] True if @a[value] has the contents Value gives for @a[x].
+ *  @sideeffects None.
+ */
+static bool IsValue(FbleValue* value, size_t x)
+{
+  for (size_t i = 0; i < FIELDS; ++i) {
+    FbleValue* field = FbleStructValueField(value, FIELDS, i);
+    if (FbleUnionValueTag(field, FIELD_BITS) != (x + i) % (1 << FIELD_BITS)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @func[main] Runs the hash consing tests.
+ *  @arg[int][argc] The number of args.
+ *  @arg[const char**][argv] The args.
+ *  @returns[int] 0 if the tests pass, 1 otherwise.
+ *  @sideeffects
+ *   Prints failures to stdout.
+ */
+int main(int argc, const char* argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  FbleRuntime* runtime = FbleNewRuntime();
+  FbleSetHashConsing(runtime, true);
+  size_t base_bytes = FbleGetRuntimeStats(runtime).gc_bytes;
+
+  {
+    // Identical live values on the same frame are shared.
+    FblePushFrame(runtime);
+    FbleRuntimeStats before = FbleGetRuntimeStats(runtime);
+    FbleValue* a = Value(runtime, 1);
+    FbleValue* b = Value(runtime, 1);
+    FbleValue* c = Value(runtime, 2);
+    FbleRuntimeStats after = FbleGetRuntimeStats(runtime);
+    ASSERT(a == b);
+    ASSERT(a != c);
+    ASSERT(IsValue(a, 1));
+    ASSERT(IsValue(c, 2));
+    ASSERT(after.hash_cons_hits == before.hash_cons_hits + 1);
+    ASSERT(after.hash_cons_misses == before.hash_cons_misses + 2);
+    FblePopFrame(runtime, NULL);
+  }
+
+  for (size_t round = 0; round < ROUNDS; ++round) {
+    // Fill the cache with values, let them all die, and collect them. Each
+    // value swept has to be evicted from the cache on the way out, or later
+    // lookups would read freed memory.
+    FblePushFrame(runtime);
+    for (size_t x = 0; x < VALUES; ++x) {
+      FbleValue* value = Value(runtime, x);
+      ASSERT(IsValue(value, x));
+    }
+    FblePopFrame(runtime, NULL);
+    FbleFullGc(runtime);
+
+    // Nothing dead is kept alive by the cache.
+    ASSERT(FbleGetRuntimeStats(runtime).gc_bytes == base_bytes);
+  }
+
+  {
+    // Values that died are allocated anew rather than reused.
+    FblePushFrame(runtime);
+    FbleRuntimeStats before = FbleGetRuntimeStats(runtime);
+    FbleValue* a = Value(runtime, 1);
+    FbleRuntimeStats after = FbleGetRuntimeStats(runtime);
+    ASSERT(IsValue(a, 1));
+    ASSERT(after.hash_cons_hits == before.hash_cons_hits);
+    ASSERT(after.hash_cons_misses == before.hash_cons_misses + 1);
+    FblePopFrame(runtime, NULL);
+  }
+
+  FbleFreeRuntime(runtime);
+  return sTestsFailed ? 1 : 0;
+}
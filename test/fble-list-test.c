@@ -0,0 +1,114 @@
+/**
+ * @file fble-list-test.c
+ *  A program that tests the memory held on to by list values.
+ */
+
+#include <stdbool.h>  // for bool
+#include <stdio.h>    // for fprintf, stdout
+
+#include <fble/fble-runtime.h>   // for FbleNewRuntime, etc.
+
+// Number of elements of the list to allocate.
+#define LENGTH 10000
+
+static bool sTestsFailed = false;
+
+static void Fail(const char* file, int line, const char* msg);
+static FbleValue* Tail(FbleValue* list);
+
+/**
+ * @func[ASSERT] Test assertion function.
+ *  @arg[bool][p] Property to assert to be true.
+ *
+ *  @sideeffects
+ *   Reports a test failure if @a[p] is not true.
+ */
+#define ASSERT(p) { \
+  if (!(p)) { \
+    Fail(__FILE__, __LINE__, #p); \
+  } \
+}
+
+/**
+ * @func[Fail] Reports a test failure.
+ *  @arg[const char*][file] The source code file.
+ *  @arg[int][line] The line number of the failure.
+ *  @arg[const char*][msg] The failure message.
+ *  @sideeffects
+ *   Reports and records the test failure.
+ */
+static void Fail(const char* file, int line, const char* msg)
+{
+  fprintf(stdout, "%s:%i: assert failure: %s\n", file, line, msg);
+  sTestsFailed = true;
+}
+
+/**
+ * @func[Tail] Gets the tail of a non-empty list.
+ *  @arg[FbleValue*][list] The list.
+ *  @returns[FbleValue*] The tail of the list.
+ *  @sideeffects None.
+ */
+static FbleValue* Tail(FbleValue* list)
+{
+  FbleValue* cons = FbleUnionValueField(list, 1, 0);
+  return FbleStructValueField(cons, 2, 1);
+}
+
+/**
+ * @func[main] Runs the list memory tests.
+ *  @arg[int][argc] The number of args.
+ *  @arg[const char**][argv] The args.
+ *  @returns[int] 0 if the tests pass, 1 otherwise.
+ *  @sideeffects
+ *   Prints failures to stdout.
+ */
+int main(int argc, const char* argv[])
+{
+  (void)argc;
+  (void)argv;
+
+  FbleRuntime* runtime = FbleNewRuntime();
+
+  // Elements too big to pack, so the whole list is allocated in list
+  // blocks. They are all the same value, allocated outside the frames we
+  // measure.
+  FbleValue* fields[4];
+  for (size_t i = 0; i < 4; ++i) {
+    fields[i] = FbleNewEnumValue(runtime, 20, i);
+  }
+  FbleValue* elem = FbleNewStructValue(runtime, 4, fields);
+  FbleValue* elems[LENGTH];
+  for (size_t i = 0; i < LENGTH; ++i) {
+    elems[i] = elem;
+  }
+
+  // Measure the memory held by the whole list.
+  FbleFullGc(runtime);
+  size_t base = FbleGetRuntimeStats(runtime).gc_bytes;
+  FblePushFrame(runtime);
+  FbleValue* list = FblePopFrame(runtime, FbleNewListValue(runtime, LENGTH, elems));
+  FbleFullGc(runtime);
+  size_t whole = FbleGetRuntimeStats(runtime).gc_bytes - base;
+  ASSERT(whole > 0);
+
+  // Measure the memory held by the last element of the list. It should be
+  // a small fraction of the whole list, not the size of one big block.
+  FblePushFrame(runtime);
+  FbleValue* suffix = FbleNewListValue(runtime, LENGTH, elems);
+  for (size_t i = 0; i + 1 < LENGTH; ++i) {
+    suffix = Tail(suffix);
+  }
+  suffix = FblePopFrame(runtime, suffix);
+  FbleFullGc(runtime);
+  size_t held = FbleGetRuntimeStats(runtime).gc_bytes - base - whole;
+  ASSERT(held * 100 < whole);
+
+  // The suffix is still the one element list.
+  ASSERT(FbleUnionValueTag(suffix, 1) == 0);
+  ASSERT(FbleUnionValueTag(Tail(suffix), 1) == 1);
+  ASSERT(FbleUnionValueTag(list, 1) == 0);
+
+  FbleFreeRuntime(runtime);
+  return sTestsFailed ? 1 : 0;
+}
@@ -0,0 +1,19 @@
+# Usage: bash mem-bench.sh FBLE_CLI SRC
+# Reports peak memory use of the Md5 and Sat benchmarks.
+#
+# FBLE_CLI is the fble-cli binary and SRC the fble source directory. For each
+# benchmark, prints the max resident set size and the peak number of bytes of
+# GC values reported by --runtime-stats. Compare the output before and after
+# a change to the GC to see its effect on memory use.
+#
+# For example:
+#   bash test/mem-bench.sh out/pkgs/std/fble-cli .
+
+for bench in md5:/Md5/Bench/Main% sat:/Sat/Bench/Main%; do
+  pkg=${bench%%:*}
+  mod=${bench#*:}
+  echo $mod
+  /usr/bin/time -f "  max resident: %M KB" $1 --runtime-stats \
+    -I $2/pkgs/std -I $2/pkgs/$pkg -m $mod 2>&1 \
+    | grep -e 'max resident' -e 'max gc bytes'
+done
@@ -200,6 +200,17 @@ proc dispatch {} {
   switch $::type {
     no-error {
       execv $::b/test/fble-test.cov --profile $::outdir/profile.txt -I $::s/spec -m $::mpath
+      execv $::b/test/fble-test.cov --link-threads 4 -I $::s/spec -m $::mpath
+
+      # Exercise GC across unmerged frames, including when GC is interrupted
+      # by frame compaction.
+      execv $::b/test/fble-test.cov --merge-limit 0 -I $::s/spec -m $::mpath
+      execv $::b/test/fble-test.cov --stack-chunk-size 64 --merge-limit 8 -I $::s/spec -m $::mpath
+
+      # Exercise the runtime with the smallest stack chunks, both without
+      # merging and with the merge limit tuned from a huge starting point.
+      execv $::b/test/fble-test.cov --stack-chunk-size 1 --merge-limit 0 -I $::s/spec -m $::mpath
+      execv $::b/test/fble-test.cov --stack-chunk-size 1 --merge-limit 1000000000 --auto-merge-limit -I $::s/spec -m $::mpath
       compile_and_run FbleTestMain { execv $compiled --profile $::outdir/profile.txt }
       execv $::b/bin/fble-disassemble.cov -I $::s/spec -m $::mpath
     }
@@ -214,6 +225,9 @@ proc dispatch {} {
 
     runtime-error {
       expect_error runtime $::loc $::b/test/fble-test.cov -I $::s/spec -m $::mpath
+      expect_error runtime $::loc $::b/test/fble-test.cov --link-threads 4 -I $::s/spec -m $::mpath
+      expect_error runtime $::loc $::b/test/fble-test.cov --stack-chunk-size 1 --merge-limit 0 -I $::s/spec -m $::mpath
+      expect_error runtime $::loc $::b/test/fble-test.cov --stack-chunk-size 1 --merge-limit 1000000000 --auto-merge-limit -I $::s/spec -m $::mpath
       compile_and_run FbleTestMain { expect_error runtime $::loc $compiled }
       execv $::b/bin/fble-disassemble.cov -I $::s/spec -m $::mpath
     }